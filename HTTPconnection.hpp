@@ -6,6 +6,20 @@
 #include <atomic>
 #include "data_manager.hpp"
 #include "ThreadPool.hpp"
+#include "multipart_parser.hpp"
+#include "router.hpp"
+#include "http_response.hpp"
+#include "http_range.hpp"
+#include "compress.hpp"
+#include "response_generator.hpp"
+#include "stored_file_reader.hpp"
+#include "read_ahead.hpp"
+#include "tier_mover.hpp"
+#include "pack_compactor.hpp"
+#include "file_writer.hpp"
+#include "upload_session.hpp"
+#include "multipart_upload.hpp"
+#include "delta_sync.hpp"
 
 namespace cloud_backup
 {
@@ -18,12 +32,12 @@ namespace cloud_backup
     public:
         using ptr = std::shared_ptr<HTTPConnection>;
         using sub_fun_t = std::function<void(HTTPConnection::ptr)>;
+        using Router = HTTPRouter<HTTPConnection>;
         HTTPConnection(const std::string &net_fd_identifier, int write_pipe_fd, const std::string &client_ip, uint16_t client_port)
             : _net_fd_identifier(net_fd_identifier), _write_pipe_fd(write_pipe_fd), _client_ip(client_ip), _client_port(client_port)
         {
             llhttp_settings_init(&_settings);
             _settings.on_message_begin = static_on_message_begin;
-            _settings.on_method = static_on_method;
             _settings.on_url = static_on_url;
             _settings.on_url_complete = static_on_url_complete;
             _settings.on_version = static_on_version;
@@ -38,9 +52,12 @@ namespace cloud_backup
             _parser.data = this;
         }
         ~HTTPConnection() { LOG_DEBUG("HTTPConnection destory"); }
+        // 在启动时构建路由表，路由注册失败时直接退出，而不是等到第一个请求到达时才发现
+        static void InitRouter() { GetRouter(); }
 
     public:
         std::atomic<bool> _is_closed = false; // 当前连接是否已关闭
+        std::atomic<bool> _close_after_send = false; // 发送缓冲区中的数据发送完后关闭连接，不再处理该连接上的后续数据
         const std::string _net_fd_identifier; // 当前连接的唯一标识符，由"fd_usetime"组成
         const int _write_pipe_fd;             // pipe_fd用于通知主线程当前连接有哪些事件发生需要主线程处理
         const std::string _client_ip;         // 客户端IP地址
@@ -48,8 +65,9 @@ namespace cloud_backup
         bool _is_processing = false;          // 是否正在处理当前连接读取上来的数据，与_request_buffer共用一把锁保证线程安全
         std::string _request_buffer;          // 存放当前连接读取上来的数据，与_is_processing共用一把锁保证线程安全
         std::mutex _request_mutex;            // 保护_is_processing和_request_buffer的互斥锁
-        std::string _response_buffer;         // 存放当前连接要发送给客户端的数据
-        std::mutex _response_mutex;           // 保护_response_buffer的互斥锁
+        OutputBuffer _response_buffer;        // 存放当前连接要发送给客户端的数据
+        std::mutex _response_mutex;           // 保护_response_buffer和_parked_task的互斥锁
+        sub_fun_t _parked_task;               // 发送缓冲区积压过多时暂停的文件发送或流式生成任务，由主线程在缓冲区排空到水位线以下后重新投递到线程池
 
     private:
         struct HTTPMessageInfo
@@ -58,21 +76,33 @@ namespace cloud_backup
             {
                 if (_cur_upload_file != "" && !DataManager::GetInstance()->Deregister(_cur_upload_file))
                     LOG_ERROR("~HTTPMessageInfo ERROR, deregister file fail, filename:%s", _cur_upload_file.c_str());
+                if (_reserved_upload_file != "" && !DataManager::GetInstance()->Deregister(_reserved_upload_file))
+                    LOG_ERROR("~HTTPMessageInfo ERROR, deregister file fail, filename:%s", _reserved_upload_file.c_str());
             }
             // Request Info
-            std::string _request_method;
+            llhttp_method_t _request_method = HTTP_GET;
             std::string _request_url;
             std::string _request_url_prefix;
             std::string _request_url_path;
+            std::string _request_url_query;
             std::string _request_version;
             std::string _request_cur_header_field;
             std::string _request_cur_header_value;
             std::unordered_map<std::string, std::string> _request_headers;
-            std::string _request_body;
+            const Router::Route *_route = nullptr;
 
             // upload Info
             std::string _body_boundary;
+            MultipartParser _multipart_parser;
             std::string _cur_upload_file;
+            std::string _cur_upload_filepath;
+            std::string _reserved_upload_file; // 请求头中提前声明并已注册的文件名，收到同名的part时直接使用
+            int64_t _reserved_upload_size = 0; // 提前声明的文件大小，收到同名的part时按该大小预先分配磁盘空间
+            std::unique_ptr<FileWriter> _upload_writer; // PUT上传时body或表单上传时当前part直接写入的目标文件，整个文件只打开一次
+            std::unique_ptr<UploadPatch> _upload_patch; // 可续传上传的PATCH请求写入的会话暂存文件
+            std::unique_ptr<MultipartPartWriter> _multipart_part; // 分片上传中当前请求写入的分片
+            std::unique_ptr<DeltaApplier> _delta_applier;         // 增量上传时根据旧文件和增量指令重建新文件
+            std::unique_ptr<StreamDigest> _upload_digest;         // 边接收边计算当前上传文件的校验信息
             std::vector<std::string> _upload_success_files;
             std::vector<std::string> _upload_fail_files;
 
@@ -83,28 +113,42 @@ namespace cloud_backup
             std::string _cur_delete_file;
 
             // Response Info
-            std::string _response_version;
-            std::string _response_status;
-            std::string _response_status_describe;
-            std::unordered_map<std::string, std::string> _response_headers;
+            int _response_http_minor = 1;
+            int _response_status = 0;                // 为0表示还未确定响应状态
+            std::string _response_headers;           // 除Content-Length外的所有响应头，每行以SEP结尾
+            int64_t _response_content_length = -1;   // 为-1时使用_response_body的大小，body在之后单独发送时需要显式设置
+            std::string _response_etag;              // 响应内容被压缩时会转为弱ETag发送
+            ContentEncoding _response_encoding = ContentEncoding::IDENTITY; // body使用的内容编码
+            bool _response_chunked = false;          // body是否使用chunked传输编码在之后单独发送，此时不发送Content-Length
             std::string _response_body;
+            std::shared_ptr<const std::string> _response_body_ref; // 以引用方式发送的body，不为空时忽略_response_body
 
             void clear()
             {
                 // request Info clear
-                _request_method.clear();
+                _request_method = HTTP_GET;
                 _request_url.clear();
                 _request_url_prefix.clear();
                 _request_url_path.clear();
+                _request_url_query.clear();
                 _request_version.clear();
                 _request_cur_header_field.clear();
                 _request_cur_header_value.clear();
                 _request_headers.clear();
-                _request_body.clear();
+                _route = nullptr;
 
                 // upload Info clear
                 _body_boundary.clear();
+                _multipart_parser.Reset();
                 _cur_upload_file.clear();
+                _cur_upload_filepath.clear();
+                _reserved_upload_file.clear();
+                _reserved_upload_size = 0;
+                _upload_writer.reset();
+                _upload_patch.reset();
+                _multipart_part.reset();
+                _delta_applier.reset();
+                _upload_digest.reset();
                 _upload_success_files.clear();
                 _upload_fail_files.clear();
 
@@ -115,22 +159,70 @@ namespace cloud_backup
                 _cur_delete_file.clear();
 
                 // Response Info clear
-                _response_version.clear();
-                _response_status.clear();
-                _response_status_describe.clear();
+                _response_http_minor = 1;
+                _response_status = 0;
                 _response_headers.clear();
+                _response_content_length = -1;
+                _response_etag.clear();
+                _response_encoding = ContentEncoding::IDENTITY;
+                _response_chunked = false;
                 _response_body.clear();
+                _response_body_ref.reset();
             }
-            std::string response_seralize()
+            void add_response_header(std::string_view key, std::string_view value)
             {
-                std::string response;
-                response += _response_version + ' ' + _response_status + ' ' + _response_status_describe + SEP;
-                for (auto &header : _response_headers)
-                    response += header.first + ": " + header.second + SEP;
-                response += SEP;
-                response += _response_body;
-                return response;
+                HTTPHeaderBuilder(&_response_headers).Add(key, value);
             }
+            // 将响应追加到发送缓冲区中: 状态行直接引用预先生成的静态字符串，响应头写入缓冲池中的缓冲区，body以移动或引用的方式追加
+            void response_seralize(OutputBuffer *out)
+            {
+                int64_t content_length = _response_content_length;
+                if (content_length == -1)
+                    content_length = _response_body_ref != nullptr ? _response_body_ref->size() : _response_body.size();
+                std::string head = BufferPool::GetInstance().Acquire();
+                head.append(_response_headers);
+                HTTPHeaderBuilder builder(&head);
+                // 同一资源压缩前后的字节内容不同，压缩后的响应使用弱ETag，与未压缩的表示区分开
+                if (!_response_etag.empty())
+                    builder.Add("ETag", _response_encoding == ContentEncoding::IDENTITY ? _response_etag : "W/" + _response_etag);
+                if (_response_encoding != ContentEncoding::IDENTITY && _response_status != 304)
+                    builder.Add("Content-Encoding", CompressUtil::EncodingName(_response_encoding));
+                // 304响应没有body，不发送Content-Length
+                if (_response_chunked)
+                    builder.Add("Transfer-Encoding", "chunked");
+                else if (_response_status != 304)
+                    builder.Add("Content-Length", content_length);
+                builder.End();
+                out->AppendStatic(HTTPStatusLine(_response_http_minor, _response_status));
+                out->Append(std::move(head));
+                if (_response_body_ref != nullptr)
+                    out->Append(_response_body_ref, 0, _response_body_ref->size());
+                else
+                    out->Append(std::move(_response_body));
+            }
+        };
+        // 一次下载请求要发送的文件内容，由若干个区间组成，多个区间时按multipart/byteranges格式在区间之间插入分段头
+        struct DownloadTask
+        {
+            using ptr = std::shared_ptr<DownloadTask>;
+            std::string _filename;          // 任务不持有文件的节点，之后按文件名和节点编号确认文件仍是同一个版本
+            uint64_t _file_id = 0;          // 打开读取器时文件节点的编号
+            int64_t _file_size = 0;         // 文件的完整大小，多区间时写入每个分段头
+            std::vector<ByteRange> _ranges; // 要发送的区间，完整下载时只有[0, size)一个区间，空文件时为空
+            size_t _range_index = 0;        // 当前正在发送的区间下标
+            int64_t _cur_pos = 0;           // 当前区间中下一个要发送的位置
+            std::string _boundary;          // multipart/byteranges的分隔符，单区间时为空
+            std::string _content_type;      // 多区间时每个分段头中的Content-Type
+            StreamCompressor::ptr _compressor; // 不为空时文件内容压缩后按chunked传输编码发送
+            StoredFileReader::ptr _reader;     // 按文件的存储方式读取文件内容
+            ReadAheadReader::ptr _read_ahead;  // 通过_reader按区间顺序预读后续的内容
+        };
+        // 一次流式生成响应的任务，body由生成器逐段生成后按chunked传输编码发送
+        struct GenerateTask
+        {
+            using ptr = std::shared_ptr<GenerateTask>;
+            ResponseGenerator::ptr _generator;
+            StreamCompressor::ptr _compressor; // 不为空时每段数据压缩后再发送
         };
         llhttp_settings_t _settings;
         llhttp_t _parser;
@@ -143,11 +235,6 @@ namespace cloud_backup
             HTTPConnection *connect = static_cast<HTTPConnection *>(parser->data);
             return connect->on_message_begin(parser);
         }
-        static int static_on_method(llhttp_t *parser, const char *at, size_t length)
-        {
-            HTTPConnection *connect = static_cast<HTTPConnection *>(parser->data);
-            return connect->on_method(parser, at, length);
-        }
         static int static_on_url(llhttp_t *parser, const char *at, size_t length)
         {
             HTTPConnection *connect = static_cast<HTTPConnection *>(parser->data);
@@ -199,28 +286,27 @@ namespace cloud_backup
             _head_info.clear();
             return 0;
         }
-        int on_method(llhttp_t *parser, const char *at, size_t length)
-        {
-            std::string tmp_method(at, length);
-            for (auto &e : tmp_method)
-                if (e >= 'a' && e <= 'z')
-                    e -= 'a' - 'A';
-            _head_info._request_method += tmp_method;
-            return 0;
-        }
         int on_url(llhttp_t *parser, const char *at, size_t length)
         {
             _head_info._request_url += std::string(at, length);
             return 0;
         }
+        // 将URL拆分为前缀(第一段路径)、剩余路径和查询串三部分，前缀用于路由匹配
         int on_url_complete(llhttp_t *parser)
         {
+            std::string url = _head_info._request_url;
+            size_t query_pos = url.find('?');
+            if (query_pos != std::string::npos)
+            {
+                _head_info._request_url_query = url.substr(query_pos + 1);
+                url.resize(query_pos);
+            }
             size_t pos = std::string::npos;
-            if (_head_info._request_url.size() > 1)
-                pos = _head_info._request_url.find('/', 1);
-            _head_info._request_url_prefix = _head_info._request_url.substr(0, pos);
-            if (pos < _head_info._request_url.size())
-                _head_info._request_url_path = _head_info._request_url.substr(pos);
+            if (url.size() > 1)
+                pos = url.find('/', 1);
+            _head_info._request_url_prefix = url.substr(0, pos);
+            if (pos < url.size())
+                _head_info._request_url_path = url.substr(pos);
             return 0;
         }
         int on_version(llhttp_t *parser, const char *at, size_t length)
@@ -252,270 +338,1239 @@ namespace cloud_backup
         }
         int on_headers_complete(llhttp_t *parser)
         {
-            _head_info._response_version = "HTTP/" + _head_info._request_version;
-            if (_head_info._request_method == "GET" && _head_info._request_url_prefix == "/download")
+            _head_info._response_http_minor = llhttp_get_http_minor(parser);
+            _head_info._request_method = static_cast<llhttp_method_t>(llhttp_get_method(parser));
+            _head_info._route = GetRouter().Match(_head_info._request_method, _head_info._request_url_prefix);
+            if (_head_info._route == nullptr)
             {
-                _head_info._cur_download_file = FileUtil::URLDecode(_head_info._request_url_path.substr(1));
-                if (!FileUtil::check_filename(_head_info._cur_download_file))
-                {
-                    LOG_WARN("process download Request fail, download filename is invalid");
-                    _head_info._response_status = "404";
-                    _head_info._response_status_describe = "Not Found";
-                }
+                LOG_WARN("process Request fail, url is invalid");
+                _head_info._response_status = 404;
             }
-            else if (_head_info._request_method == "DELETE" && _head_info._request_url_prefix == "/delete")
+            else if (_head_info._route->_on_headers != nullptr)
+                (this->*(_head_info._route->_on_headers))();
+            // Expect请求头只支持100-continue，其他期望无法满足时响应417
+            bool expect_continue = false;
+            auto expect_it = _head_info._request_headers.find("expect");
+            if (expect_it != _head_info._request_headers.end())
             {
-                _head_info._cur_delete_file = FileUtil::URLDecode(_head_info._request_url_path.substr(1));
-                if (!FileUtil::check_filename(_head_info._cur_delete_file))
+                if (strcasecmp(expect_it->second.c_str(), "100-continue") == 0)
+                    expect_continue = true;
+                else if (_head_info._response_status == 0)
+                    _head_info._response_status = 417;
+            }
+            if ((parser->flags & F_CHUNKED) == 0 && parser->content_length == 0)
+                return 0;
+            // 请求带有body但在body到达之前就已经确定了错误响应，立即发送响应并在发送完后关闭连接
+            // 等待100 Continue的客户端收到最终响应后不会再发送body，节省了传输和写入磁盘的开销
+            if (_head_info._response_status != 0)
+            {
+                LOG_WARN("reject Request before body, status:%d url:%s", _head_info._response_status, _head_info._request_url.c_str());
+                _head_info.add_response_header("Connection", "close");
+                _close_after_send = true;
                 {
-                    LOG_WARN("process delete Request fail, delete filename is invalid");
-                    _head_info._response_status = "404";
-                    _head_info._response_status_describe = "Not Found";
+                    std::unique_lock<std::mutex> response_lock(_response_mutex);
+                    _head_info.response_seralize(&_response_buffer);
                 }
+                notify_new_message_need_send();
+                return HPE_PAUSED;
             }
-            else if (_head_info._request_method == "POST" && _head_info._request_url_prefix == "/upload")
+            if (expect_continue && _head_info._response_http_minor == 1)
             {
-                auto it = _head_info._request_headers.find("content-type");
-                std::string boundary_key = "boundary=";
-                if (it != _head_info._request_headers.end() && it->second.find(boundary_key) != std::string::npos)
-                    _head_info._body_boundary = "--" + it->second.substr(it->second.find(boundary_key) + boundary_key.size());
-                else
                 {
-                    LOG_WARN("process upload Request fail, content-type is invalid");
-                    _head_info._response_status = "400";
-                    _head_info._response_status_describe = "Bad Request";
+                    std::unique_lock<std::mutex> response_lock(_response_mutex);
+                    _response_buffer.AppendStatic("HTTP/1.1 100 Continue\r\n\r\n");
                 }
+                notify_new_message_need_send();
             }
             return 0;
         }
         int on_body(llhttp_t *parser, const char *at, size_t length)
         {
-            if (_head_info._response_status != "")
+            if (_head_info._response_status != 0)
                 return 0;
-            if (_head_info._request_method == "POST" && _head_info._request_url_prefix == "/upload")
-            {
-                _head_info._request_body += std::string(at, length);
-                if (process_upload_body() == false)
-                {
-                    LOG_WARN("process upload Request fail, process_upload_body error");
-                    _head_info._response_status = "400";
-                    _head_info._response_status_describe = "Bad Request";
-                    return 0;
-                }
-            }
+            if (_head_info._route != nullptr && _head_info._route->_on_body != nullptr)
+                (this->*(_head_info._route->_on_body))(at, length);
             return 0;
         }
         int on_message_complete(llhttp_t *parser)
         {
-            if (_head_info._response_status == "")
-            {
-                if (_head_info._request_method == "GET" && (_head_info._request_url_prefix == "/" || _head_info._request_url_prefix == "/showlist"))
-                    process_showlist_request();
-                else if (_head_info._request_method == "GET" && _head_info._request_url_prefix == "/download")
-                    process_download_request();
-                else if (_head_info._request_method == "DELETE" && _head_info._request_url_prefix == "/delete")
-                    process_delete_request();
-                else if (_head_info._request_method == "POST" && _head_info._request_url_prefix == "/upload")
-                    process_upload_request();
-                else if (_head_info._request_method == "GET" && _head_info._request_url_prefix == "/api")
-                    process_api_request();
-                else
-                {
-                    LOG_WARN("process Request fail, url is invalid");
-                    _head_info._response_status = "404";
-                    _head_info._response_status_describe = "Not Found";
-                }
-            }
-            std::string response = _head_info.response_seralize();
+            if (_head_info._response_status == 0 && _head_info._route != nullptr && _head_info._route->_on_complete != nullptr)
+                (this->*(_head_info._route->_on_complete))();
+            compress_response_body();
             {
                 std::unique_lock<std::mutex> response_lock(_response_mutex);
-                _response_buffer += response;
+                _head_info.response_seralize(&_response_buffer);
             }
             notify_new_message_need_send();
             return HPE_PAUSED;
         }
 
-        bool process_upload_body()
+        // 所有请求的路由表，新增接口只需要在这里注册对应的处理函数，不需要修改llhttp的回调
+        static const Router &GetRouter()
         {
-            while (_head_info._request_body.size() > _head_info._body_boundary.size() + SEP.size())
+            static const Router router = []()
             {
-                if (_head_info._cur_upload_file == "")
+                const Router::Route routes[] = {
+                    {HTTP_GET, "/", nullptr, nullptr, &HTTPConnection::process_showlist_request},
+                    {HTTP_GET, "/showlist", nullptr, nullptr, &HTTPConnection::process_showlist_request},
+                    {HTTP_GET, "/download", &HTTPConnection::on_download_headers, nullptr, &HTTPConnection::process_download_request},
+                    {HTTP_DELETE, "/delete", &HTTPConnection::on_delete_headers, nullptr, &HTTPConnection::process_delete_request},
+                    {HTTP_POST, "/upload", &HTTPConnection::on_upload_headers, &HTTPConnection::on_upload_body, &HTTPConnection::process_upload_request},
+                    {HTTP_GET, "/api", nullptr, nullptr, &HTTPConnection::process_api_request},
+                    {HTTP_PUT, "/files", &HTTPConnection::on_put_headers, &HTTPConnection::on_put_body, &HTTPConnection::process_put_request},
+                    {HTTP_POST, "/uploads", nullptr, nullptr, &HTTPConnection::process_session_create_request},
+                    {HTTP_HEAD, "/uploads", nullptr, nullptr, &HTTPConnection::process_session_head_request},
+                    {HTTP_PATCH, "/uploads", &HTTPConnection::on_session_patch_headers, &HTTPConnection::on_session_patch_body, &HTTPConnection::process_session_patch_request},
+                    {HTTP_DELETE, "/uploads", nullptr, nullptr, &HTTPConnection::process_session_delete_request},
+                    {HTTP_POST, "/multipart", nullptr, nullptr, &HTTPConnection::process_multipart_post_request},
+                    {HTTP_PUT, "/multipart", &HTTPConnection::on_multipart_part_headers, &HTTPConnection::on_multipart_part_body, &HTTPConnection::process_multipart_part_request},
+                    {HTTP_GET, "/multipart", nullptr, nullptr, &HTTPConnection::process_multipart_list_request},
+                    {HTTP_DELETE, "/multipart", nullptr, nullptr, &HTTPConnection::process_multipart_abort_request},
+                    {HTTP_GET, "/signature", nullptr, nullptr, &HTTPConnection::process_signature_request},
+                    {HTTP_PUT, "/delta", &HTTPConnection::on_delta_headers, &HTTPConnection::on_delta_body, &HTTPConnection::process_delta_request},
+                };
+                Router router;
+                for (auto &route : routes)
                 {
-                    int pos = _head_info._request_body.find(_head_info._body_boundary);
-                    if (pos == std::string::npos)
-                    {
-                        if (_head_info._request_body.size() > _head_info._body_boundary.size())
-                            _head_info._request_body.erase(0, _head_info._request_body.size() - _head_info._body_boundary.size());
-                    }
-                    else
+                    if (!router.Register(route))
                     {
-                        if (pos > 0)
-                            _head_info._request_body.erase(0, pos);
-                        int head_end_pos = _head_info._request_body.find(SEP + SEP);
-                        if (head_end_pos == std::string::npos)
-                            break;
-                        std::string filename_key = "filename=\"";
-                        int filename_pos = _head_info._request_body.find(filename_key);
-                        if (filename_pos == std::string::npos || filename_pos > head_end_pos)
-                        {
-                            LOG_WARN("process_upload_body WARNING, not find filename in head");
-                            return false;
-                        }
-                        filename_pos += filename_key.size();
-                        int filename_end_pos = _head_info._request_body.find('"', filename_pos);
-                        if (filename_end_pos == std::string::npos || filename_end_pos > head_end_pos)
-                        {
-                            LOG_WARN("process_upload_body WARNING, not find filename end in head filename_end_pos:%d head_end_pos:%d", filename_end_pos, head_end_pos);
-                            return false;
-                        }
-                        _head_info._cur_upload_file = _head_info._request_body.substr(filename_pos, filename_end_pos - filename_pos);
-                        _head_info._request_body.erase(0, head_end_pos + SEP.size() * 2);
-                        if (!FileUtil::check_filename(_head_info._cur_upload_file) ||
-                            !DataManager::GetInstance()->Register(_head_info._cur_upload_file))
-                        {
-                            _head_info._upload_fail_files.push_back(_head_info._cur_upload_file);
-                            _head_info._cur_upload_file.clear();
-                            continue;
-                        }
+                        LOG_FATAL("HTTPConnection initialization error, register route:%s %.*s failed", llhttp_method_name(route._method),
+                                  (int)route._prefix.size(), route._prefix.data());
+                        exit(ROUTER_INIT_ERROR);
                     }
                 }
+                return router;
+            }();
+            return router;
+        }
+
+        void on_download_headers()
+        {
+            _head_info._cur_download_file = FileUtil::URLDecode(_head_info._request_url_path.substr(std::min<size_t>(1, _head_info._request_url_path.size())));
+            if (!FileUtil::check_filename(_head_info._cur_download_file))
+            {
+                LOG_WARN("process download Request fail, download filename is invalid");
+                _head_info._response_status = 404;
+            }
+        }
+        void on_delete_headers()
+        {
+            _head_info._cur_delete_file = FileUtil::URLDecode(_head_info._request_url_path.substr(std::min<size_t>(1, _head_info._request_url_path.size())));
+            if (!FileUtil::check_filename(_head_info._cur_delete_file))
+            {
+                LOG_WARN("process delete Request fail, delete filename is invalid");
+                _head_info._response_status = 404;
+            }
+        }
+        void on_upload_headers()
+        {
+            auto it = _head_info._request_headers.find("content-type");
+            std::string boundary_key = "boundary=";
+            if (it != _head_info._request_headers.end() && it->second.find(boundary_key) != std::string::npos)
+            {
+                std::string boundary = it->second.substr(it->second.find(boundary_key) + boundary_key.size());
+                boundary = boundary.substr(0, boundary.find(';'));
+                if (boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"')
+                    boundary = boundary.substr(1, boundary.size() - 2);
+                _head_info._body_boundary = boundary;
+            }
+            if (_head_info._body_boundary.empty())
+            {
+                LOG_WARN("process upload Request fail, content-type is invalid");
+                _head_info._response_status = 400;
+                return;
+            }
+            if (!check_declared_upload())
+                return;
+            _head_info._multipart_parser.Init(
+                _head_info._body_boundary,
+                [this](const std::string &part_header)
+                { return on_upload_part_begin(part_header); },
+                [this](const char *data, size_t len)
+                { on_upload_part_data(data, len); },
+                [this]()
+                { on_upload_part_end(); });
+        }
+        void on_upload_body(const char *at, size_t length)
+        {
+            if (_head_info._multipart_parser.Execute(at, length) == false)
+            {
+                LOG_WARN("process upload Request fail, multipart body is invalid");
+                _head_info._response_status = 400;
+            }
+        }
+
+        // 客户端可以通过X-Upload-Filename/X-Upload-Size请求头或filename/size查询参数提前声明要上传的文件
+        // 在接收body之前检查磁盘剩余空间(未声明大小时按Content-Length)并注册声明的文件名，不满足条件时设置响应状态并返回false
+        bool check_declared_upload()
+        {
+            std::string declared_filename, declared_size_str;
+            if (!find_request_param("x-upload-filename", "filename", &declared_filename) ||
+                !find_request_param("x-upload-size", "size", &declared_size_str))
+            {
+                _head_info._response_status = 400;
+                return false;
+            }
+            int64_t need_size = (_parser.flags & F_CONTENT_LENGTH) ? static_cast<int64_t>(_parser.content_length) : 0;
+            if (!declared_size_str.empty())
+            {
+                if (!parse_number(declared_size_str, &need_size))
+                {
+                    LOG_WARN("process upload Request fail, declared size is invalid:%s", declared_size_str.c_str());
+                    _head_info._response_status = 400;
+                    return false;
+                }
+            }
+            if (!check_available_space(need_size))
+                return false;
+            if (!declared_filename.empty())
+            {
+                if (!FileUtil::check_filename(declared_filename))
+                {
+                    LOG_WARN("process upload Request fail, declared filename is invalid");
+                    _head_info._response_status = 400;
+                    return false;
+                }
+                if (!DataManager::GetInstance()->Register(declared_filename))
+                {
+                    LOG_WARN("process upload Request fail, declared file already exists, filename:%s", declared_filename.c_str());
+                    _head_info._response_status = 409;
+                    return false;
+                }
+                _head_info._reserved_upload_file = declared_filename;
+                if (!declared_size_str.empty())
+                    _head_info._reserved_upload_size = need_size;
+            }
+            return true;
+        }
+        // 检查备份目录所在磁盘的剩余空间是否足够存放need_size字节，不足时将响应状态设置为507并返回false
+        bool check_available_space(int64_t need_size)
+        {
+            if (need_size <= 0)
+                return true;
+            int64_t available = FileUtil(BackupPathResolver::BackupDir()).GetAvailableSpace();
+            if (available != -1 && available < need_size)
+            {
+                LOG_WARN("process upload Request fail, insufficient storage, need:%lld available:%lld", (long long)need_size, (long long)available);
+                _head_info._response_status = 507;
+                return false;
+            }
+            return true;
+        }
+        // 将字符串完整地解析为非负整数，失败返回false
+        static bool parse_number(const std::string &str, int64_t *value)
+        {
+            auto result = std::from_chars(str.data(), str.data() + str.size(), *value);
+            return !str.empty() && result.ec == std::errc() && result.ptr == str.data() + str.size() && *value >= 0;
+        }
+        // 按请求头优先、查询参数其次的顺序查找参数，查询参数会进行URL解码，都不存在时value为空，解码失败返回false
+        bool find_request_param(const std::string &header_key, const std::string &query_key, std::string *value)
+        {
+            value->clear();
+            auto it = _head_info._request_headers.find(header_key);
+            if (it != _head_info._request_headers.end())
+            {
+                *value = it->second;
+                return true;
+            }
+            std::string_view query(_head_info._request_url_query);
+            while (!query.empty())
+            {
+                size_t amp_pos = query.find('&');
+                std::string_view item = query.substr(0, amp_pos);
+                query.remove_prefix(amp_pos == std::string_view::npos ? query.size() : amp_pos + 1);
+                if (item.size() > query_key.size() && item.substr(0, query_key.size()) == query_key && item[query_key.size()] == '=')
+                {
+                    *value = FileUtil::URLDecode(std::string(item.substr(query_key.size() + 1)));
+                    return !value->empty() || item.size() == query_key.size() + 1;
+                }
+            }
+            return true;
+        }
+
+        // multipart中一个part的头部已完整到达，从中解析出文件名并注册，头部中没有文件名时返回false
+        bool on_upload_part_begin(const std::string &part_header)
+        {
+            std::string filename_key = "filename=\"";
+            size_t filename_pos = part_header.find(filename_key);
+            if (filename_pos == std::string::npos)
+            {
+                LOG_WARN("on_upload_part_begin WARNING, not find filename in head");
+                return false;
+            }
+            filename_pos += filename_key.size();
+            size_t filename_end_pos = part_header.find('"', filename_pos);
+            if (filename_end_pos == std::string::npos)
+            {
+                LOG_WARN("on_upload_part_begin WARNING, not find filename end in head");
+                return false;
+            }
+            _head_info._cur_upload_file = part_header.substr(filename_pos, filename_end_pos - filename_pos);
+            // 与提前声明的文件同名时使用已注册的名额，并按声明的大小预先分配磁盘空间，否则重新注册
+            int64_t reserved_size = 0;
+            if (_head_info._cur_upload_file == _head_info._reserved_upload_file)
+            {
+                _head_info._reserved_upload_file.clear();
+                reserved_size = _head_info._reserved_upload_size;
+            }
+            else if (!FileUtil::check_filename(_head_info._cur_upload_file) ||
+                     !DataManager::GetInstance()->Register(_head_info._cur_upload_file))
+            {
+                _head_info._upload_fail_files.push_back(_head_info._cur_upload_file);
+                _head_info._cur_upload_file.clear();
+                return true;
+            }
+            _head_info._cur_upload_filepath = BackupPathResolver::UploadingPath(_head_info._cur_upload_file);
+            _head_info._upload_digest = std::make_unique<StreamDigest>();
+            _head_info._upload_writer = std::make_unique<FileWriter>();
+            if (!_head_info._upload_writer->Open(_head_info._cur_upload_filepath))
+            {
+                abort_upload_part();
+                return true;
+            }
+            // 预先分配失败不拒绝上传，磁盘空间不足时写入会失败
+            _head_info._upload_writer->Preallocate(reserved_size);
+            _head_info._upload_writer->SetCachePolicy(reserved_size > 0 ? reserved_size : -1);
+            return true;
+        }
+        // 收到当前上传文件的一段内容，写入上传临时文件，当前part已被拒绝时丢弃数据
+        void on_upload_part_data(const char *data, size_t len)
+        {
+            if (_head_info._cur_upload_file == "")
+                return;
+            if (!_head_info._upload_writer->Write(data, len))
+            {
+                abort_upload_part();
+                return;
+            }
+            _head_info._upload_digest->Update(data, len);
+            LOG_DEBUG("on_upload_part_data INFO, upload file:%s size:%zu", _head_info._cur_upload_file.c_str(), len);
+        }
+        // 当前上传文件的内容已全部写入，将其加入DataManager中管理
+        void on_upload_part_end()
+        {
+            if (_head_info._cur_upload_file == "")
+                return;
+            if (!_head_info._upload_writer->Close())
+            {
+                abort_upload_part();
+                return;
+            }
+            int64_t file_size = _head_info._upload_writer->Size();
+            _head_info._upload_writer.reset();
+            FileDigest digest;
+            bool has_digest = _head_info._upload_digest->Finish(&digest);
+            _head_info._upload_success_files.push_back(_head_info._cur_upload_file);
+            DataManager::GetInstance()->Insert(_head_info._cur_upload_file, file_size, has_digest ? &digest : nullptr);
+            _head_info._cur_upload_file.clear();
+        }
+        // 当前part写入失败，注销文件并记为上传失败，同一请求中的后续part不受影响
+        void abort_upload_part()
+        {
+            _head_info._upload_writer.reset();
+            if (!DataManager::GetInstance()->Deregister(_head_info._cur_upload_file))
+                LOG_ERROR("process upload Request error, Deregister fail, filename:%s", _head_info._cur_upload_file.c_str());
+            _head_info._upload_fail_files.push_back(_head_info._cur_upload_file);
+            _head_info._cur_upload_file.clear();
+        }
+
+        // PUT /files/<name>: body即文件的原始内容(Content-Length或chunked)，不经过multipart解析写入上传临时文件，Insert落盘后才移入备份目录
+        void on_put_headers()
+        {
+            std::string filename = FileUtil::URLDecode(_head_info._request_url_path.substr(std::min<size_t>(1, _head_info._request_url_path.size())));
+            if (!FileUtil::check_filename(filename))
+            {
+                LOG_WARN("process put Request fail, filename is invalid");
+                _head_info._response_status = 400;
+                return;
+            }
+            int64_t need_size = (_parser.flags & F_CONTENT_LENGTH) ? static_cast<int64_t>(_parser.content_length) : 0;
+            if (!check_available_space(need_size))
+                return;
+            if (!DataManager::GetInstance()->Register(filename))
+            {
+                LOG_WARN("process put Request fail, file already exists, filename:%s", filename.c_str());
+                _head_info._response_status = 409;
+                return;
+            }
+            _head_info._cur_upload_file = filename;
+            _head_info._cur_upload_filepath = BackupPathResolver::UploadingPath(filename);
+            _head_info._upload_writer = std::make_unique<FileWriter>();
+            _head_info._upload_digest = std::make_unique<StreamDigest>();
+            // 已知Content-Length时预先分配磁盘空间，大文件按配置绕过页缓存写入
+            if (!_head_info._upload_writer->Open(_head_info._cur_upload_filepath) || !_head_info._upload_writer->Preallocate(need_size))
+            {
+                abort_put_upload();
+                return;
+            }
+            _head_info._upload_writer->SetCachePolicy((_parser.flags & F_CONTENT_LENGTH) ? need_size : -1);
+        }
+        void on_put_body(const char *at, size_t length)
+        {
+            _head_info._upload_digest->Update(at, length);
+            if (!_head_info._upload_writer->Write(at, length))
+                abort_put_upload();
+        }
+        void process_put_request()
+        {
+            if (!_head_info._upload_writer->Close())
+            {
+                abort_put_upload();
+                return;
+            }
+            int64_t file_size = _head_info._upload_writer->Size();
+            _head_info._upload_writer.reset();
+            FileDigest digest;
+            bool has_digest = _head_info._upload_digest->Finish(&digest);
+            if (!DataManager::GetInstance()->Insert(_head_info._cur_upload_file, file_size, has_digest ? &digest : nullptr))
+            {
+                LOG_ERROR("process put Request error, Insert fail, filename:%s", _head_info._cur_upload_file.c_str());
+                abort_put_upload();
+                return;
+            }
+            Json::Value root;
+            root["filename"] = _head_info._cur_upload_file;
+            root["size"] = (Json::Int64)file_size;
+            append_file_digest(_head_info._cur_upload_file, &root);
+            _head_info._cur_upload_file.clear();
+            std::string response_body;
+            if (!JsonUtil::Serialize(root, &response_body))
+                LOG_ERROR("process put Request fail, JsonUtil::Serialize error");
+            _head_info._response_status = 201;
+            _head_info.add_response_header("Content-Type", "application/json");
+            _head_info._response_body = std::move(response_body);
+        }
+        // 可续传上传(tus协议): POST /uploads创建会话，PATCH /uploads/<id>从Upload-Offset处续写，HEAD /uploads/<id>查询已写入的偏移
+        // 创建会话时通过Upload-Length声明文件大小，文件名由Upload-Metadata中base64编码的filename给出(也支持X-Upload-Filename/filename参数)
+        void process_session_create_request()
+        {
+            _head_info.add_response_header("Tus-Resumable", "1.0.0");
+            auto length_it = _head_info._request_headers.find("upload-length");
+            int64_t length = -1;
+            if (length_it != _head_info._request_headers.end() && !parse_number(length_it->second, &length))
+                length = -1;
+            std::string filename;
+            auto metadata_it = _head_info._request_headers.find("upload-metadata");
+            if (metadata_it != _head_info._request_headers.end())
+                filename = find_upload_metadata(metadata_it->second, "filename");
+            else
+                find_request_param("x-upload-filename", "filename", &filename);
+            if (length < 0 || !FileUtil::check_filename(filename))
+            {
+                LOG_WARN("process session create Request fail, upload length or filename is invalid");
+                _head_info._response_status = 400;
+                return;
+            }
+            if (!check_available_space(length))
+                return;
+            if (!DataManager::GetInstance()->Register(filename))
+            {
+                LOG_WARN("process session create Request fail, file already exists, filename:%s", filename.c_str());
+                _head_info._response_status = 409;
+                return;
+            }
+            UploadSession::ptr session = UploadSessionManager::GetInstance()->Create(filename, length);
+            if (session == nullptr)
+            {
+                if (!DataManager::GetInstance()->Deregister(filename))
+                    LOG_ERROR("process session create Request error, Deregister fail, filename:%s", filename.c_str());
+                _head_info._response_status = 500;
+                return;
+            }
+            // 大小为0的文件不需要再PATCH，直接完成上传
+            if (length == 0 && UploadSessionManager::GetInstance()->BeginPatch(session, 0))
+            {
+                int64_t offset;
+                bool completed;
+                UploadSessionManager::GetInstance()->EndPatch(session, &offset, &completed);
+            }
+            _head_info._response_status = 201;
+            _head_info.add_response_header("Location", "/uploads/" + session->_id);
+            _head_info.add_response_header("Upload-Expires", HTTPDateFormat(session->_expire_time));
+        }
+        void process_session_head_request()
+        {
+            _head_info.add_response_header("Tus-Resumable", "1.0.0");
+            _head_info.add_response_header("Cache-Control", "no-store");
+            UploadSession::ptr session = get_upload_session();
+            if (session == nullptr)
+            {
+                _head_info._response_status = 404;
+                return;
+            }
+            int64_t offset, length;
+            time_t expire_time;
+            UploadSessionManager::GetInstance()->GetState(session, &offset, &length, &expire_time);
+            _head_info._response_status = 200;
+            _head_info.add_response_header("Upload-Offset", std::to_string(offset));
+            _head_info.add_response_header("Upload-Length", std::to_string(length));
+            _head_info.add_response_header("Upload-Expires", HTTPDateFormat(expire_time));
+        }
+        void on_session_patch_headers()
+        {
+            _head_info.add_response_header("Tus-Resumable", "1.0.0");
+            UploadSession::ptr session = get_upload_session();
+            if (session == nullptr)
+            {
+                _head_info._response_status = 404;
+                return;
+            }
+            auto content_type_it = _head_info._request_headers.find("content-type");
+            if (content_type_it == _head_info._request_headers.end() || content_type_it->second != "application/offset+octet-stream")
+            {
+                _head_info._response_status = 415;
+                return;
+            }
+            auto offset_it = _head_info._request_headers.find("upload-offset");
+            int64_t upload_offset = -1;
+            if (offset_it != _head_info._request_headers.end() && !parse_number(offset_it->second, &upload_offset))
+                upload_offset = -1;
+            if (upload_offset < 0)
+            {
+                _head_info._response_status = 400;
+                return;
+            }
+            int64_t offset, length;
+            time_t expire_time;
+            UploadSessionManager::GetInstance()->GetState(session, &offset, &length, &expire_time);
+            if ((_parser.flags & F_CONTENT_LENGTH) && upload_offset + static_cast<int64_t>(_parser.content_length) > length)
+            {
+                LOG_WARN("process session patch Request fail, body exceeds upload length, session:%s", session->_id.c_str());
+                _head_info._response_status = 413;
+                return;
+            }
+            // 偏移与服务器记录的不一致或者已有其他请求正在写入，客户端需要先通过HEAD获取最新的偏移
+            if (!UploadSessionManager::GetInstance()->BeginPatch(session, upload_offset))
+            {
+                LOG_WARN("process session patch Request fail, offset mismatch or session busy, session:%s offset:%lld",
+                         session->_id.c_str(), (long long)upload_offset);
+                _head_info._response_status = 409;
+                return;
+            }
+            _head_info._upload_patch = std::make_unique<UploadPatch>(session, upload_offset, length);
+            if (!_head_info._upload_patch->Open())
+            {
+                _head_info._upload_patch.reset();
+                _head_info._response_status = 500;
+            }
+        }
+        void on_session_patch_body(const char *at, size_t length)
+        {
+            if (_head_info._upload_patch->Write(at, length))
+                return;
+            int err = _head_info._upload_patch->LastError();
+            _head_info._upload_patch.reset();
+            if (err == 0)
+                _head_info._response_status = 413;
+            else
+                _head_info._response_status = (err == ENOSPC || err == EDQUOT) ? 507 : 500;
+        }
+        void process_session_patch_request()
+        {
+            int64_t offset;
+            bool completed;
+            bool ret = _head_info._upload_patch->End(&offset, &completed);
+            _head_info._upload_patch.reset();
+            if (!ret)
+            {
+                _head_info._response_status = 500;
+                return;
+            }
+            _head_info._response_status = 204;
+            _head_info.add_response_header("Upload-Offset", std::to_string(offset));
+        }
+        void process_session_delete_request()
+        {
+            _head_info.add_response_header("Tus-Resumable", "1.0.0");
+            std::string id = _head_info._request_url_path.substr(std::min<size_t>(1, _head_info._request_url_path.size()));
+            _head_info._response_status = UploadSessionManager::GetInstance()->Terminate(id) ? 204 : 404;
+        }
+        // 根据URL中的会话id获取未过期的上传会话，不存在时返回nullptr
+        UploadSession::ptr get_upload_session()
+        {
+            std::string id = _head_info._request_url_path.substr(std::min<size_t>(1, _head_info._request_url_path.size()));
+            return UploadSessionManager::GetInstance()->Get(id);
+        }
+        // 从Upload-Metadata请求头("key base64value,key2 base64value2")中获取指定key的值，不存在或解码失败时返回空串
+        static std::string find_upload_metadata(const std::string &metadata, const std::string &key)
+        {
+            std::string_view list(metadata);
+            while (!list.empty())
+            {
+                size_t comma_pos = list.find(',');
+                std::string_view item = list.substr(0, comma_pos);
+                list.remove_prefix(comma_pos == std::string_view::npos ? list.size() : comma_pos + 1);
+                while (!item.empty() && item.front() == ' ')
+                    item.remove_prefix(1);
+                size_t space_pos = item.find(' ');
+                if (item.substr(0, space_pos) != key)
+                    continue;
+                std::string value;
+                if (space_pos == std::string_view::npos || !Base64Util::Decode(std::string(item.substr(space_pos + 1)), &value))
+                    return "";
+                return value;
+            }
+            return "";
+        }
+
+        // 分片上传: POST /multipart创建上传(声明文件名、总大小和分片大小)，PUT /multipart/<id>/<n>上传第n片，
+        // POST /multipart/<id>在所有分片完成后提交，GET /multipart/<id>查询已完成的分片，DELETE /multipart/<id>放弃上传
+        void process_multipart_post_request()
+        {
+            if (_head_info._request_url_path.empty() || _head_info._request_url_path == "/")
+                create_multipart_upload();
+            else
+                complete_multipart_upload();
+        }
+        void create_multipart_upload()
+        {
+            std::string filename, size_str, part_size_str;
+            int64_t size = -1, part_size = -1;
+            if (!find_request_param("x-upload-filename", "filename", &filename) || !FileUtil::check_filename(filename) ||
+                !find_request_param("x-upload-size", "size", &size_str) || !parse_number(size_str, &size) ||
+                !find_request_param("x-part-size", "part_size", &part_size_str) || !parse_number(part_size_str, &part_size) || part_size == 0)
+            {
+                LOG_WARN("process multipart create Request fail, filename, size or part size is invalid");
+                _head_info._response_status = 400;
+                return;
+            }
+            // 只有一个分片时不限制分片的最小大小
+            int64_t part_count = (size + part_size - 1) / part_size;
+            if ((part_count > 1 && part_size < Config::GetInstance()->GetMultipartMinPartSize()) ||
+                part_count > Config::GetInstance()->GetMultipartMaxPartCount())
+            {
+                LOG_WARN("process multipart create Request fail, part size:%lld is out of range", (long long)part_size);
+                _head_info._response_status = 400;
+                return;
+            }
+            if (!check_available_space(size))
+                return;
+            if (!DataManager::GetInstance()->Register(filename))
+            {
+                LOG_WARN("process multipart create Request fail, file already exists, filename:%s", filename.c_str());
+                _head_info._response_status = 409;
+                return;
+            }
+            MultipartUpload::ptr upload = MultipartUploadManager::GetInstance()->Create(filename, size, part_size);
+            if (upload == nullptr)
+            {
+                if (!DataManager::GetInstance()->Deregister(filename))
+                    LOG_ERROR("process multipart create Request error, Deregister fail, filename:%s", filename.c_str());
+                _head_info._response_status = 500;
+                return;
+            }
+            Json::Value root;
+            root["upload_id"] = upload->_id;
+            root["part_size"] = (Json::Int64)upload->_part_size;
+            root["part_count"] = upload->_part_count;
+            set_json_response(201, root);
+            _head_info.add_response_header("Location", "/multipart/" + upload->_id);
+        }
+        void complete_multipart_upload()
+        {
+            MultipartUpload::ptr upload = MultipartUploadManager::GetInstance()->Get(_head_info._request_url_path.substr(1));
+            if (upload == nullptr)
+            {
+                _head_info._response_status = 404;
+                return;
+            }
+            if (MultipartUploadManager::GetInstance()->Complete(upload))
+            {
+                Json::Value root;
+                root["filename"] = upload->_filename;
+                root["size"] = (Json::Int64)upload->_size;
+                append_file_digest(upload->_filename, &root);
+                set_json_response(200, root);
+                return;
+            }
+            // 上传已经结束但没能加入DataManager，暂存数据已删除，客户端需要重新上传
+            if (MultipartUploadManager::GetInstance()->Get(upload->_id) == nullptr)
+            {
+                _head_info._response_status = 500;
+                return;
+            }
+            // 还有分片未完成或正在写入，返回缺少的分片编号
+            std::vector<int> done_parts;
+            MultipartUploadManager::GetInstance()->GetDoneParts(upload, &done_parts);
+            Json::Value root;
+            root["missing_parts"] = Json::Value(Json::arrayValue);
+            for (int part_number = 1, i = 0; part_number <= upload->_part_count; part_number++)
+            {
+                if (i < (int)done_parts.size() && done_parts[i] == part_number)
+                    i++;
                 else
+                    root["missing_parts"].append(part_number);
+            }
+            set_json_response(409, root);
+        }
+        void on_multipart_part_headers()
+        {
+            std::string path = _head_info._request_url_path.substr(std::min<size_t>(1, _head_info._request_url_path.size()));
+            size_t slash_pos = path.find('/');
+            int64_t part_number = 0;
+            MultipartUpload::ptr upload;
+            if (slash_pos != std::string::npos)
+                upload = MultipartUploadManager::GetInstance()->Get(path.substr(0, slash_pos));
+            if (upload == nullptr)
+            {
+                _head_info._response_status = 404;
+                return;
+            }
+            if (!parse_number(path.substr(slash_pos + 1), &part_number) || part_number < 1 || part_number > upload->_part_count ||
+                ((_parser.flags & F_CONTENT_LENGTH) && static_cast<int64_t>(_parser.content_length) != upload->PartLength(part_number)))
+            {
+                LOG_WARN("process multipart part Request fail, part number or length is invalid, upload:%s", upload->_id.c_str());
+                _head_info._response_status = 400;
+                return;
+            }
+            if (!MultipartUploadManager::GetInstance()->BeginPart(upload, part_number))
+            {
+                LOG_WARN("process multipart part Request fail, part is being written, upload:%s part:%lld", upload->_id.c_str(), (long long)part_number);
+                _head_info._response_status = 409;
+                return;
+            }
+            _head_info._multipart_part = std::make_unique<MultipartPartWriter>(upload, part_number);
+            if (!_head_info._multipart_part->Open())
+            {
+                _head_info._multipart_part.reset();
+                _head_info._response_status = 500;
+            }
+        }
+        void on_multipart_part_body(const char *at, size_t length)
+        {
+            if (_head_info._multipart_part->Write(at, length))
+                return;
+            int err = _head_info._multipart_part->LastError();
+            _head_info._multipart_part.reset();
+            if (err == 0)
+                _head_info._response_status = 400;
+            else
+                _head_info._response_status = (err == ENOSPC || err == EDQUOT) ? 507 : 500;
+        }
+        void process_multipart_part_request()
+        {
+            bool ret = _head_info._multipart_part->End();
+            _head_info._multipart_part.reset();
+            _head_info._response_status = ret ? 200 : 400;
+        }
+        void process_multipart_list_request()
+        {
+            MultipartUpload::ptr upload = MultipartUploadManager::GetInstance()->Get(_head_info._request_url_path.substr(std::min<size_t>(1, _head_info._request_url_path.size())));
+            if (upload == nullptr)
+            {
+                _head_info._response_status = 404;
+                return;
+            }
+            std::vector<int> done_parts;
+            MultipartUploadManager::GetInstance()->GetDoneParts(upload, &done_parts);
+            Json::Value root;
+            root["upload_id"] = upload->_id;
+            root["filename"] = upload->_filename;
+            root["size"] = (Json::Int64)upload->_size;
+            root["part_size"] = (Json::Int64)upload->_part_size;
+            root["part_count"] = upload->_part_count;
+            root["done_parts"] = Json::Value(Json::arrayValue);
+            for (int part_number : done_parts)
+                root["done_parts"].append(part_number);
+            set_json_response(200, root);
+        }
+        void process_multipart_abort_request()
+        {
+            std::string id = _head_info._request_url_path.substr(std::min<size_t>(1, _head_info._request_url_path.size()));
+            if (MultipartUploadManager::GetInstance()->Abort(id))
+                _head_info._response_status = 204;
+            else
+                _head_info._response_status = MultipartUploadManager::GetInstance()->Get(id) == nullptr ? 404 : 409;
+        }
+        // 增量上传: 客户端先通过GET /signature/<name>获取旧版本文件的块签名，在新文件上滑动计算弱校验和找出未变化的块，
+        // 再通过PUT /delta/<name>上传由复制块和新数据组成的增量指令，服务器用旧文件(base参数，默认与目标同名)和增量重建出新文件
+        // 目标文件已存在时替换其内容，否则作为新文件加入，If-Match可以保证增量是基于签名对应的那个版本计算的
+        void process_signature_request()
+        {
+            std::string filename = FileUtil::URLDecode(_head_info._request_url_path.substr(std::min<size_t>(1, _head_info._request_url_path.size())));
+            int64_t block_size = 0;
+            if (!find_delta_block_size(&block_size))
+                return;
+            // HTTP/1.0时签名在当前线程中一次生成完，不在Guard内进行，节点拷贝一次
+            DataManagerNode::ptr file_info_node;
+            StoredFileReader::ptr reader;
+            {
+                EpochReclaimer::Guard guard;
+                const DataManagerNode::ptr *node;
+                reader = open_stored_file(filename, &node);
+                if (node != nullptr)
+                    file_info_node = *node;
+            }
+            if (reader == nullptr)
+            {
+                _head_info._response_status = file_info_node == nullptr ? 404 : 500;
+                return;
+            }
+            _head_info._response_etag = file_entity_tag(file_info_node->_info);
+            negotiate_response_encoding();
+            _head_info._response_status = 200;
+            _head_info.add_response_header("Content-Type", "application/json");
+            start_generated_response(std::make_shared<SignatureGenerator>(file_info_node->_info, reader, block_size));
+        }
+        void on_delta_headers()
+        {
+            std::string filename = FileUtil::URLDecode(_head_info._request_url_path.substr(std::min<size_t>(1, _head_info._request_url_path.size())));
+            std::string base_name, size_str;
+            int64_t block_size = 0, target_size = -1;
+            if (!FileUtil::check_filename(filename) || !find_request_param("x-delta-base", "base", &base_name) ||
+                !find_request_param("x-upload-size", "size", &size_str) || !parse_number(size_str, &target_size))
+            {
+                LOG_WARN("process delta Request fail, filename or size is invalid");
+                _head_info._response_status = 400;
+                return;
+            }
+            if (!find_delta_block_size(&block_size))
+                return;
+            if (base_name.empty())
+                base_name = filename;
+            // 之后注册目标文件需要获取分片锁，在Guard之外使用的基准文件节点拷贝一次
+            DataManagerNode::ptr base_node;
+            StoredFileReader::ptr base_reader;
+            {
+                EpochReclaimer::Guard guard;
+                const DataManagerNode::ptr *node;
+                base_reader = open_stored_file(base_name, &node);
+                if (node != nullptr)
+                    base_node = *node;
+            }
+            if (base_reader == nullptr)
+            {
+                _head_info._response_status = base_node == nullptr ? 404 : 500;
+                return;
+            }
+            auto if_match_it = _head_info._request_headers.find("if-match");
+            if (if_match_it != _head_info._request_headers.end() && !HTTPETagListMatch(if_match_it->second, file_entity_tag(base_node->_info)))
+            {
+                LOG_WARN("process delta Request fail, base file:%s has changed", base_name.c_str());
+                _head_info._response_status = 412;
+                return;
+            }
+            if (!check_available_space(target_size))
+                return;
+            if (DataManager::GetInstance()->GetFileInfoNode(filename) == nullptr)
+            {
+                if (!DataManager::GetInstance()->Register(filename))
                 {
-                    std::string file_content;
-                    int pos = _head_info._request_body.find(SEP + _head_info._body_boundary);
-                    if (pos == std::string::npos)
-                    {
-                        if (_head_info._request_body.size() > _head_info._body_boundary.size() + SEP.size())
-                            file_content = _head_info._request_body.substr(0, _head_info._request_body.size() - _head_info._body_boundary.size() - SEP.size());
-                    }
-                    else
-                        file_content = _head_info._request_body.substr(0, pos);
-                    std::string target_file_dir = Config::GetInstance()->GetBackupFileDir();
-                    if (target_file_dir.back() != '/')
-                        target_file_dir += '/';
-                    FileUtil target_file(target_file_dir + _head_info._cur_upload_file);
-                    if (file_content.size() > 0)
-                    {
-                        _head_info._request_body.erase(0, file_content.size());
-                        if (!target_file.AppendContent(file_content))
-                        {
-                            if (!DataManager::GetInstance()->Deregister(_head_info._cur_upload_file))
-                                LOG_ERROR("process_upload_body error, Deregister fail, filename:%s", _head_info._cur_upload_file.c_str());
-                            _head_info._upload_fail_files.push_back(_head_info._cur_upload_file);
-                            _head_info._cur_upload_file.clear();
-                            continue;
-                        }
-                        LOG_DEBUG("process_upload_body INFO, upload file:%s size:%d", _head_info._cur_upload_file.c_str(), file_content.size());
-                    }
-                    if (pos != std::string::npos)
-                    {
-                        _head_info._upload_success_files.push_back(_head_info._cur_upload_file);
-                        DataManager::GetInstance()->Insert(_head_info._cur_upload_file, target_file.GetFileSize());
-                        _head_info._cur_upload_file.clear();
-                        continue;
-                    }
+                    _head_info._response_status = 409;
+                    return;
                 }
+                _head_info._cur_upload_file = filename;
+            }
+            _head_info._delta_applier = std::make_unique<DeltaApplier>(base_reader, base_node->_info._size, block_size, target_size);
+            if (!_head_info._delta_applier->Open())
+                abort_delta_upload();
+        }
+        void on_delta_body(const char *at, size_t length)
+        {
+            if (!_head_info._delta_applier->Feed(at, length))
+                abort_delta_upload();
+        }
+        void process_delta_request()
+        {
+            if (!_head_info._delta_applier->Finish())
+            {
+                abort_delta_upload();
+                return;
+            }
+            std::string filename = FileUtil::URLDecode(_head_info._request_url_path.substr(1));
+            std::string staging_path = _head_info._delta_applier->StagingPath();
+            int64_t file_size = FileUtil(staging_path).GetFileSize();
+            bool is_new = !_head_info._cur_upload_file.empty();
+            FileDigest digest;
+            const FileDigest *digest_ptr = _head_info._delta_applier->Digest(&digest) ? &digest : nullptr;
+            bool ret = is_new ? rename(staging_path.c_str(), BackupPathResolver::UploadingPath(filename).c_str()) == 0 &&
+                                    DataManager::GetInstance()->Insert(filename, file_size, digest_ptr)
+                              : DataManager::GetInstance()->Replace(filename, staging_path, file_size, digest_ptr);
+            if (!ret)
+            {
+                LOG_ERROR("process delta Request error, commit file:%s failed", filename.c_str());
+                abort_delta_upload();
+                _head_info._response_status = is_new ? 500 : 409;
+                return;
+            }
+            _head_info._delta_applier->Release();
+            _head_info._delta_applier.reset();
+            _head_info._cur_upload_file.clear();
+            Json::Value root;
+            root["filename"] = filename;
+            root["size"] = (Json::Int64)file_size;
+            append_file_digest(filename, &root);
+            set_json_response(is_new ? 201 : 200, root);
+        }
+        // 读取增量同步使用的块大小参数，没有时使用配置中的默认值，不合法时设置400并返回false
+        bool find_delta_block_size(int64_t *block_size)
+        {
+            std::string block_size_str;
+            *block_size = Config::GetInstance()->GetDeltaBlockSize();
+            if (!find_request_param("x-block-size", "block_size", &block_size_str) ||
+                (!block_size_str.empty() && (!parse_number(block_size_str, block_size) || *block_size < DeltaApplier::MIN_BLOCK_SIZE || *block_size > DeltaApplier::MAX_BLOCK_SIZE)))
+            {
+                LOG_WARN("process delta Request fail, block size:%s is invalid", block_size_str.c_str());
+                _head_info._response_status = 400;
+                return false;
             }
             return true;
         }
+        // 增量上传失败时删除临时文件并注销新注册的目标文件
+        void abort_delta_upload()
+        {
+            int err = _head_info._delta_applier != nullptr ? _head_info._delta_applier->LastError() : EIO;
+            _head_info._delta_applier.reset();
+            if (!_head_info._cur_upload_file.empty() && !DataManager::GetInstance()->Deregister(_head_info._cur_upload_file))
+                LOG_ERROR("process delta Request error, Deregister fail, filename:%s", _head_info._cur_upload_file.c_str());
+            _head_info._cur_upload_file.clear();
+            if (err == 0)
+                _head_info._response_status = 400;
+            else
+                _head_info._response_status = (err == ENOSPC || err == EDQUOT) ? 507 : 500;
+        }
+        // 备份文件的ETag，有校验信息时直接使用内容的SHA-256作为强ETag，内容相同的文件ETag相同
+        // 没有校验信息的旧文件由文件名、上传时间和大小组成，文件被替换后随之改变
+        static std::string file_entity_tag(const BackupInfoNode &info)
+        {
+            if (!info._digest._sha256.empty())
+                return '"' + info._digest._sha256 + '"';
+            return '"' + info._filename + '-' + std::to_string(info._time) + '-' + std::to_string(info._size) + '"';
+        }
+        // 查找文件的当前版本并打开读取器，*node设置为读取器对应的节点，文件不存在时*node为nullptr
+        // 调用者需要持有EpochReclaimer::Guard，*node只在Guard内有效，不拷贝节点的智能指针，Guard内不能再获取DataManager的分片锁
+        // 节点在查找之后被替换或迁移时重新查找，保证响应头和读取的内容来自同一个版本
+        static StoredFileReader::ptr open_stored_file(const std::string &filename, const DataManagerNode::ptr **node)
+        {
+            constexpr int MAX_ATTEMPTS = 3;
+            for (int i = 0; i < MAX_ATTEMPTS; i++)
+            {
+                *node = DataManager::GetInstance()->FindFileInfoNode(filename);
+                if (*node == nullptr)
+                    return nullptr;
+                StoredFileReader::ptr reader = StoredFileReader::Open(***node);
+                if (reader != nullptr || !(**node)->_is_retired)
+                    return reader;
+            }
+            LOG_WARN("open stored file:%s error, replaced too frequently", filename.c_str());
+            return nullptr;
+        }
+        // 在上传成功的响应中附带文件的校验信息
+        void append_file_digest(const std::string &filename, Json::Value *root)
+        {
+            DataManagerNode::ptr file_info_node = DataManager::GetInstance()->GetFileInfoNode(filename);
+            if (file_info_node == nullptr || file_info_node->_info._digest._sha256.empty())
+                return;
+            (*root)["sha256"] = file_info_node->_info._digest._sha256;
+            (*root)["crc32c"] = DigestUtil::Crc32cHex(file_info_node->_info._digest._crc32c);
+        }
+        // 未压缩的下载响应中附带文件内容的摘要(RFC 9530的Repr-Digest和RFC 3230的Digest)，Range响应中的摘要也是对完整文件计算的
+        void add_digest_headers(const FileDigest &digest)
+        {
+            if (digest._sha256.empty() || _head_info._response_encoding != ContentEncoding::IDENTITY)
+                return;
+            std::string sha256 = Base64Util::Encode(DigestUtil::HexDecode(digest._sha256));
+            _head_info.add_response_header("Repr-Digest", "sha-256=:" + sha256 + ':');
+            _head_info.add_response_header("Digest", "sha-256=" + sha256 + ",crc32c=" + Base64Util::Encode(DigestUtil::Crc32cBytes(digest._crc32c)));
+        }
+        // 将JSON对象序列化为响应body
+        void set_json_response(int status, const Json::Value &root)
+        {
+            std::string response_body;
+            if (!JsonUtil::Serialize(root, &response_body))
+            {
+                LOG_ERROR("set json response fail, JsonUtil::Serialize error");
+                _head_info._response_status = 500;
+                return;
+            }
+            _head_info._response_status = status;
+            _head_info.add_response_header("Content-Type", "application/json");
+            _head_info._response_body = std::move(response_body);
+        }
+
+        // PUT上传失败时注销目标文件，磁盘空间不足时响应507，其他错误响应500
+        void abort_put_upload()
+        {
+            int err = _head_info._upload_writer != nullptr ? _head_info._upload_writer->LastError() : 0;
+            _head_info._upload_writer.reset();
+            if (!DataManager::GetInstance()->Deregister(_head_info._cur_upload_file))
+                LOG_ERROR("process put Request error, Deregister fail, filename:%s", _head_info._cur_upload_file.c_str());
+            _head_info._cur_upload_file.clear();
+            _head_info._response_status = (err == ENOSPC || err == EDQUOT) ? 507 : 500;
+        }
 
+        // 按RFC 7232处理条件请求头，资源未发生变化时将响应状态设置为304并返回true，调用者不再需要构建body
+        // If-None-Match存在时忽略If-Modified-Since，last_modified为0表示资源没有修改时间
+        bool check_not_modified(const std::string &etag, time_t last_modified)
+        {
+            auto if_none_match_it = _head_info._request_headers.find("if-none-match");
+            if (if_none_match_it != _head_info._request_headers.end())
+            {
+                if (!HTTPETagListMatch(if_none_match_it->second, etag))
+                    return false;
+            }
+            else
+            {
+                auto if_modified_since_it = _head_info._request_headers.find("if-modified-since");
+                time_t since = 0;
+                if (if_modified_since_it == _head_info._request_headers.end() || last_modified <= 0 ||
+                    !HTTPDateParse(if_modified_since_it->second, &since) || last_modified > since)
+                    return false;
+            }
+            _head_info._response_status = 304;
+            return true;
+        }
+        // 响应内容可以压缩时调用，按Accept-Encoding协商内容编码，并告知缓存响应内容随Accept-Encoding变化
+        void negotiate_response_encoding()
+        {
+            _head_info.add_response_header("Vary", "Accept-Encoding");
+            auto it = _head_info._request_headers.find("accept-encoding");
+            if (it != _head_info._request_headers.end())
+                _head_info._response_encoding = CompressUtil::Negotiate(it->second);
+        }
+        // 一次性压缩已经完整构建好的body，在线程池中执行，body过小或压缩失败时按原内容发送
+        void compress_response_body()
+        {
+            // 304没有body，但要保留协商出的编码，使其ETag与被验证的200响应一致
+            if (_head_info._response_encoding == ContentEncoding::IDENTITY || _head_info._response_chunked || _head_info._response_status == 304)
+                return;
+            const std::string &body = _head_info._response_body_ref != nullptr ? *_head_info._response_body_ref : _head_info._response_body;
+            if (_head_info._response_status != 200 || _head_info._response_content_length != -1 ||
+                (long long)body.size() < Config::GetInstance()->GetCompressMinSize())
+            {
+                _head_info._response_encoding = ContentEncoding::IDENTITY;
+                return;
+            }
+            StreamCompressor compressor(_head_info._response_encoding, Config::GetInstance()->GetCompressLevel());
+            std::string compressed_body;
+            if (!compressor.Compress(body.data(), body.size(), true, &compressed_body))
+            {
+                LOG_WARN("compress response body fail, send it uncompressed");
+                _head_info._response_encoding = ContentEncoding::IDENTITY;
+                return;
+            }
+            _head_info._response_body = std::move(compressed_body);
+            _head_info._response_body_ref.reset();
+        }
+        // 以流式方式发送生成器生成的body，HTTP/1.1按chunked传输编码边生成边发送，内存占用与body总大小无关
+        // HTTP/1.0不支持chunked，只能一次性生成完整的body后按Content-Length发送
+        void start_generated_response(ResponseGenerator::ptr generator)
+        {
+            size_t chunk_size = Config::GetInstance()->GetStreamChunkSize();
+            if (_head_info._response_http_minor == 0)
+            {
+                while (!generator->Generate(&_head_info._response_body, _head_info._response_body.size() + chunk_size))
+                    ;
+                return;
+            }
+            GenerateTask::ptr task = std::make_shared<GenerateTask>();
+            task->_generator = std::move(generator);
+            if (_head_info._response_encoding != ContentEncoding::IDENTITY)
+            {
+                task->_compressor = std::make_shared<StreamCompressor>(_head_info._response_encoding, Config::GetInstance()->GetCompressLevel());
+                if (!task->_compressor->IsValid())
+                {
+                    task->_compressor.reset();
+                    _head_info._response_encoding = ContentEncoding::IDENTITY;
+                }
+            }
+            _head_info._response_chunked = true;
+            _sub_task = std::bind(&HTTPConnection::sendGenerated, std::placeholders::_1, task);
+        }
+        // default.html的内容很少变化，按文件的修改时间缓存其内容，所有连接以引用的方式共享同一份内容发送，失败返回nullptr
+        static std::shared_ptr<const std::string> GetShowlistPage(time_t *page_last_modified)
+        {
+            static std::mutex page_mutex;
+            static std::shared_ptr<const std::string> page;
+            static time_t page_mtime = 0;
+            const char *page_path = "./wwwroot/default.html";
+            struct stat st;
+            if (stat(page_path, &st) == -1)
+            {
+                LOG_ERROR("GetShowlistPage error, stat error:%d message:%s", errno, strerror(errno));
+                return nullptr;
+            }
+            std::unique_lock<std::mutex> lock(page_mutex);
+            if (page == nullptr || page_mtime != st.st_mtime)
+            {
+                std::string file_content;
+                if (!FileUtil(page_path).GetContent(&file_content))
+                    return nullptr;
+                page = std::make_shared<const std::string>(std::move(file_content));
+                page_mtime = st.st_mtime;
+            }
+            *page_last_modified = page_mtime;
+            return page;
+        }
         void process_showlist_request()
         {
-            FileUtil default_file("./wwwroot/default.html");
-            std::string file_content;
-            if (!default_file.GetContent(&file_content))
+            time_t last_modified = 0;
+            std::shared_ptr<const std::string> page = GetShowlistPage(&last_modified);
+            if (page == nullptr)
             {
                 LOG_ERROR("client_ip:%s client_port:%d Get File Content error, filename:default.html",
                           _client_ip.c_str(), _client_port);
                 notify_close_curent_connection();
                 return;
             }
-            _head_info._response_status = "200";
-            _head_info._response_status_describe = "OK";
-            _head_info._response_headers["Content-Type"] = "text/html";
-            _head_info._response_headers["Content-Length"] = std::to_string(file_content.size());
-            _head_info._response_body = file_content;
+            std::string etag = "\"page-" + std::to_string(last_modified) + '-' + std::to_string(page->size()) + '"';
+            _head_info._response_etag = etag;
+            negotiate_response_encoding();
+            _head_info.add_response_header("Last-Modified", HTTPDateFormat(last_modified));
+            _head_info.add_response_header("Cache-Control", "no-cache");
+            if (check_not_modified(etag, last_modified))
+                return;
+            _head_info._response_status = 200;
+            _head_info.add_response_header("Content-Type", "text/html");
+            _head_info._response_body_ref = page;
         }
         void process_download_request()
         {
-            auto data_manager = DataManager::GetInstance();
-            DataManagerNode::ptr file_info_node = data_manager->GetFileInfoNode(_head_info._cur_download_file);
-            if (file_info_node == nullptr)
+            // 处理请求期间处于Guard内，直接读取目录中的节点而不拷贝其智能指针，下载任务中只记录文件名和节点编号
+            EpochReclaimer::Guard guard;
+            const DataManagerNode::ptr *node;
+            StoredFileReader::ptr reader = open_stored_file(_head_info._cur_download_file, &node);
+            if (node == nullptr)
             {
                 LOG_WARN("process download Request fail, filename not found, filename:%s", _head_info._cur_download_file.c_str());
-                _head_info._response_status = "404";
-                _head_info._response_status_describe = "Not Found";
+                _head_info._response_status = 404;
+                return;
+            }
+            if (reader == nullptr)
+            {
+                _head_info._response_status = 500;
                 return;
             }
+            DataManagerNode &file_info_node = **node;
             LOG_DEBUG("process download Request, filename:%s size:%lld time:%lld",
-                      file_info_node->_info._filename.c_str(), file_info_node->_info._size, file_info_node->_info._time);
-            std::string ETag = file_info_node->_info._filename + '-' + std::to_string(file_info_node->_info._time) + '-' + std::to_string(file_info_node->_info._size);
-            _head_info._response_status = "200";
-            _head_info._response_status_describe = "OK";
-            _head_info._response_headers["Content-Type"] = "application/octet-stream";
-            _head_info._response_headers["Accept-Ranges"] = "bytes";
-            _head_info._response_headers["ETag"] = ETag;
-            _head_info._response_headers["Content-Length"] = std::to_string(file_info_node->_info._size);
-            _head_info._response_headers["Content-Disposition"] = "attachment; filename=\"" + file_info_node->_info._filename + '"';
+                      file_info_node._info._filename.c_str(), file_info_node._info._size, file_info_node._info._time);
+            std::string ETag = file_entity_tag(file_info_node._info);
+            _head_info._response_etag = ETag;
+            _head_info.add_response_header("Last-Modified", HTTPDateFormat(file_info_node._info._time));
+            // 只压缩配置中指定类型的完整文件下载，Range请求需要按原始字节定位，始终不压缩
+            // 压缩后的长度无法提前知道，需要使用chunked传输编码，HTTP/1.0的客户端不支持
+            int64_t file_size = file_info_node._info._size;
+            if (CompressUtil::IsCompressibleFile(file_info_node._info._filename))
+            {
+                negotiate_response_encoding();
+                if (_head_info._request_headers.count("range") || _head_info._response_http_minor == 0 ||
+                    file_size < Config::GetInstance()->GetCompressMinSize())
+                    _head_info._response_encoding = ContentEncoding::IDENTITY;
+            }
+            if (check_not_modified(ETag, file_info_node._info._time))
+                return;
+            _head_info._response_status = 200;
+            _head_info.add_response_header("Accept-Ranges", "bytes");
+            _head_info.add_response_header("Content-Disposition", "attachment; filename=\"" + file_info_node._info._filename + '"');
             LOG_DEBUG("process download Request, ETag:%s", ETag.c_str());
-            long long start_pos = 0;
-            long long end_pos = file_info_node->_info._size;
-            if (_head_info._request_headers.find("if-range") != _head_info._request_headers.end() &&
-                _head_info._request_headers.find("range") != _head_info._request_headers.end())
+            TierMover::GetInstance()->RecordAccess(file_info_node);
+            DownloadTask::ptr task = std::make_shared<DownloadTask>();
+            task->_filename = file_info_node._info._filename;
+            task->_file_id = file_info_node._id;
+            task->_file_size = file_info_node._info._size;
+            task->_reader = reader;
+            task->_content_type = "application/octet-stream";
+            if (file_size > 0)
+                task->_ranges.push_back({0, file_size});
+            // If-Range与当前ETag不一致说明客户端手中的是旧版本，此时忽略Range发送完整的文件
+            auto range_it = _head_info._request_headers.find("range");
+            auto if_range_it = _head_info._request_headers.find("if-range");
+            if (range_it != _head_info._request_headers.end() &&
+                (if_range_it == _head_info._request_headers.end() || if_range_it->second == ETag))
+            {
+                std::vector<ByteRange> ranges;
+                HTTPRangeUtil::ParseResult result = HTTPRangeUtil::Parse(range_it->second, file_size, &ranges);
+                if (result == HTTPRangeUtil::ParseResult::UNSATISFIABLE)
+                {
+                    LOG_WARN("process download Request fail, range not satisfiable, filename:%s range:%s",
+                             file_info_node._info._filename.c_str(), range_it->second.c_str());
+                    _head_info._response_status = 416;
+                    _head_info.add_response_header("Content-Range", "bytes */" + std::to_string(file_size));
+                    return;
+                }
+                if (result == HTTPRangeUtil::ParseResult::SATISFIABLE)
+                {
+                    _head_info._response_status = 206;
+                    if (ranges.size() == 1)
+                    {
+                        _head_info.add_response_header("Content-Type", task->_content_type);
+                        _head_info.add_response_header("Content-Range", HTTPRangeUtil::ContentRange(ranges[0], file_size));
+                        _head_info._response_content_length = ranges[0]._end - ranges[0]._start;
+                    }
+                    else
+                    {
+                        task->_boundary = HTTPRangeUtil::NewBoundary();
+                        _head_info.add_response_header("Content-Type", "multipart/byteranges; boundary=" + task->_boundary);
+                        _head_info._response_content_length = HTTPRangeUtil::MultipartLength(task->_boundary, task->_content_type, ranges, file_size);
+                    }
+                    task->_ranges = std::move(ranges);
+                }
+            }
+            if (_head_info._response_status == 200)
             {
-                if (_head_info._request_headers["if-range"] == ETag && _head_info._request_headers["range"].find("bytes=") == 0)
+                _head_info.add_response_header("Content-Type", task->_content_type);
+                _head_info._response_content_length = file_size;
+                if (_head_info._response_encoding != ContentEncoding::IDENTITY)
                 {
-                    std::string range_value = _head_info._request_headers["range"].substr(6);
-                    int dash_pos = range_value.find('-');
-                    start_pos = std::stoll(range_value.substr(0, dash_pos));
-                    if (dash_pos + 1 < range_value.size())
-                        end_pos = std::min(std::stoll(range_value.substr(dash_pos + 1)) + 1, end_pos);
+                    task->_compressor = std::make_shared<StreamCompressor>(_head_info._response_encoding, Config::GetInstance()->GetCompressLevel());
+                    if (task->_compressor->IsValid())
+                        _head_info._response_chunked = true;
+                    else
+                    {
+                        task->_compressor.reset();
+                        _head_info._response_encoding = ContentEncoding::IDENTITY;
+                    }
                 }
-                _head_info._response_status = "206";
-                _head_info._response_status_describe = "Partial Content";
-                _head_info._response_headers["Content-Length"] = std::to_string(end_pos - start_pos);
-                _head_info._response_headers["Content-Range"] = "bytes " + std::to_string(start_pos) + '-' + std::to_string(end_pos - 1) + '/' + std::to_string(file_info_node->_info._size);
             }
-            _sub_task = std::bind(&HTTPConnection::sendFile, std::placeholders::_1, file_info_node, start_pos, end_pos);
+            add_digest_headers(file_info_node._info._digest);
+            if (!task->_ranges.empty())
+                task->_cur_pos = task->_ranges[0]._start;
+            task->_read_ahead = std::make_shared<ReadAheadReader>(task->_reader, task->_ranges, Config::GetInstance()->GetMaxFileReadSize(),
+                                                                  Config::GetInstance()->GetDownloadReadAheadDepth());
+            _sub_task = std::bind(&HTTPConnection::sendFile, std::placeholders::_1, task);
         }
         void process_delete_request()
         {
             auto data_manager = DataManager::GetInstance();
             if (data_manager->Delete(_head_info._cur_delete_file))
-            {
-                _head_info._response_status = "200";
-                _head_info._response_status_describe = "OK";
-            }
+                _head_info._response_status = 200;
             else
             {
                 LOG_WARN("process delete Request fail, filename not found, filename:%s", _head_info._cur_delete_file.c_str());
-                _head_info._response_status = "404";
-                _head_info._response_status_describe = "Not Found";
+                _head_info._response_status = 404;
             }
         }
         void process_upload_request()
         {
-            if (_head_info._upload_fail_files.empty())
+            // body已结束但最后一个part没有遇到结束分隔符，该文件视为上传失败
+            if (_head_info._cur_upload_file != "")
+                abort_upload_part();
+            // 提前声明的文件没有出现在body中，释放其注册的名额
+            if (_head_info._reserved_upload_file != "")
             {
-                _head_info._response_status = "200";
-                _head_info._response_status_describe = "OK";
+                LOG_WARN("process upload Request, declared file not found in body, filename:%s", _head_info._reserved_upload_file.c_str());
+                if (!DataManager::GetInstance()->Deregister(_head_info._reserved_upload_file))
+                    LOG_ERROR("process upload Request error, Deregister fail, filename:%s", _head_info._reserved_upload_file.c_str());
+                _head_info._reserved_upload_file.clear();
             }
+            if (_head_info._upload_fail_files.empty())
+                _head_info._response_status = 200;
             else if (_head_info._upload_success_files.empty())
-            {
-                _head_info._response_status = "400";
-                _head_info._response_status_describe = "Bad Request";
-            }
+                _head_info._response_status = 400;
             else
-            {
-                _head_info._response_status = "207";
-                _head_info._response_status_describe = "Multi-Status";
-            }
+                _head_info._response_status = 207;
             Json::Value root;
             root["success_count"] = (Json::Int64)_head_info._upload_success_files.size();
             root["fail_count"] = (Json::Int64)_head_info._upload_fail_files.size();
             root["total_count"] = (Json::Int64)(_head_info._upload_success_files.size() + _head_info._upload_fail_files.size());
             for (auto &file : _head_info._upload_success_files)
+            {
                 root["success_files"].append(file);
+                Json::Value checksum;
+                append_file_digest(file, &checksum);
+                if (!checksum.isNull())
+                    root["checksums"][file] = checksum;
+            }
             for (auto &file : _head_info._upload_fail_files)
                 root["fail_files"].append(file);
             std::string response_body;
@@ -525,45 +1580,30 @@ namespace cloud_backup
                 response_body.clear();
                 return;
             }
-            _head_info._response_headers["Content-Type"] = "application/json";
-            _head_info._response_headers["Content-Length"] = std::to_string(response_body.size());
-            _head_info._response_body = response_body;
+            _head_info.add_response_header("Content-Type", "application/json");
+            _head_info._response_body = std::move(response_body);
         }
         void process_api_request()
         {
             if (_head_info._request_url_path == "/GetBackupFiles")
             {
+                // 文件列表的ETag由DataManager的版本号生成，列表未变化时直接响应304，不需要遍历和序列化整个列表
                 auto data_manager = DataManager::GetInstance();
-                std::vector<BackupInfoNode> all_files;
-                data_manager->GetAllBackupInfo(&all_files);
-                Json::Value root;
-                for (auto &file_info : all_files)
-                {
-                    Json::Value file_node;
-                    file_node["filename"] = file_info._filename;
-                    file_node["size"] = Json::Int64(file_info._size);
-                    file_node["time"] = Json::Int64(file_info._time);
-                    root["files"].append(file_node);
-                }
-                std::string response_body;
-                if (!JsonUtil::Serialize(root, &response_body))
-                {
-                    LOG_ERROR("process api Request fail, JsonUtil::Serialize error");
-                    _head_info._response_status = "404";
-                    _head_info._response_status_describe = "Not Found";
+                std::string etag = "\"list-" + std::to_string(data_manager->GetLoadTime()) + '-' + std::to_string(data_manager->GetVersion()) + '"';
+                _head_info._response_etag = etag;
+                _head_info.add_response_header("Cache-Control", "no-cache");
+                negotiate_response_encoding();
+                if (check_not_modified(etag, 0))
                     return;
-                }
-                _head_info._response_status = "200";
-                _head_info._response_status_describe = "OK";
-                _head_info._response_headers["Content-Type"] = "application/json";
-                _head_info._response_headers["Content-Length"] = std::to_string(response_body.size());
-                _head_info._response_body = response_body;
+                // 文件列表可能很大，逐段生成并发送，不在内存中构建完整的JSON
+                _head_info._response_status = 200;
+                _head_info.add_response_header("Content-Type", "application/json");
+                start_generated_response(std::make_shared<FileListGenerator>());
             }
             else
             {
                 LOG_WARN("process api Request fail, url is invalid");
-                _head_info._response_status = "404";
-                _head_info._response_status_describe = "Not Found";
+                _head_info._response_status = 404;
             }
         }
 
@@ -600,6 +1640,9 @@ namespace cloud_backup
                 object->notify_close_curent_connection();
                 return;
             }
+            // 请求在body到达之前已被拒绝，连接将在响应发送完后关闭，不再处理剩余的数据
+            if (object->_close_after_send)
+                return;
             if (err == HPE_PAUSED)
             {
                 handle_size = llhttp_get_error_pos(&object->_parser) - cur_handle_request.c_str();
@@ -623,61 +1666,150 @@ namespace cloud_backup
             }
         }
         // 将文件内容分段的写入到发送缓冲区中(默认之前已经构建好了HTTP响应报头并已经放入其中，现在放入的是HTTP响应的body)
+        // 每次只发送当前区间中的一段数据，多区间时在每个区间开始前插入分段头，最后一个区间发送完后追加结束分隔符
+        // 发送缓冲区积压超过水位线时暂停，等待期间预读器在后台读取后续的段，恢复时通常可以直接取用
         // 如果出现任何异常和错误都直接通知主进程关闭当前连接
-        static void sendFile(HTTPConnection::ptr object, DataManagerNode::ptr file_info_node, long long start_pos, long long end_pos)
+        static void sendFile(HTTPConnection::ptr object, DownloadTask::ptr task)
         {
             if (object->_is_closed)
                 return;
             object->_sub_task = sub_fun_t();
+            {
+                std::unique_lock<std::mutex> response_lock(object->_response_mutex);
+                if (object->_response_buffer.Size() >= Config::GetInstance()->GetResponseBufferHighWatermark())
+                {
+                    object->_parked_task = std::bind(&HTTPConnection::sendFile, std::placeholders::_1, task);
+                    return;
+                }
+            }
 
             auto data_manager = DataManager::GetInstance();
-            if (file_info_node == nullptr)
+            if (task == nullptr)
             {
                 object->notify_close_curent_connection();
                 return;
             }
-            if (start_pos >= end_pos)
-                LOG_WARN("read position more than file:%s tail", file_info_node->_info._filename.c_str());
-            else
+            if (task->_range_index < task->_ranges.size())
             {
-                std::string file_content;
+                const ByteRange &range = task->_ranges[task->_range_index];
+                int64_t start_pos = task->_cur_pos;
+                int64_t end_pos = range._end;
+                std::string part_header;
+                if (!task->_boundary.empty() && start_pos == range._start)
+                    part_header = HTTPRangeUtil::PartHeader(task->_boundary, task->_content_type, range, task->_file_size);
+                // 文件内容以共享只读字符串的形式引用进发送缓冲区，LRU中缓存的内容不需要再拷贝一次
+                std::shared_ptr<const std::string> file_content;
                 if (start_pos == 0)
-                    file_content = data_manager->GetFilePreContent(file_info_node->_info._filename);
-                if (file_content == "")
+                    file_content = data_manager->GetFilePreContent(task->_filename, task->_file_id);
+                if (file_content == nullptr)
                 {
                     long long read_size = Config::GetInstance()->GetMaxFileReadSize();
-                    read_size = std::min(read_size, end_pos - start_pos);
-                    std::string target_file_dir = Config::GetInstance()->GetBackupFileDir();
-                    if (target_file_dir.back() != '/')
-                        target_file_dir += '/';
-                    FileUtil target_file(target_file_dir + file_info_node->_info._filename);
+                    read_size = std::min<long long>(read_size, end_pos - start_pos);
+                    if (!task->_read_ahead->Read(task->_range_index, start_pos, read_size, &file_content))
                     {
-                        std::shared_lock<std::shared_mutex> file_read_lock(file_info_node->_rwlock);
-                        if (!target_file.GetContent(&file_content, start_pos, read_size))
-                        {
-                            LOG_ERROR("client_ip:%s client_port:%d Get File Content error, filename:%s",
-                                      object->_client_ip.c_str(), object->_client_port, file_info_node->_info._filename.c_str());
-                            object->notify_close_curent_connection();
-                            return;
-                        }
+                        LOG_ERROR("client_ip:%s client_port:%d Get File Content error, filename:%s",
+                                  object->_client_ip.c_str(), object->_client_port, task->_filename.c_str());
+                        object->notify_close_curent_connection();
+                        return;
                     }
-                    if (start_pos == 0 && !data_manager->PutFilePreContent(file_info_node->_info._filename, file_content))
+                    if (start_pos == 0 && !data_manager->PutFilePreContent(task->_filename, task->_file_id, file_content))
                     {
                         LOG_ERROR("client_ip:%s client_port:%d Put File TO LRU error, filename:%s",
-                                  object->_client_ip.c_str(), object->_client_port, file_info_node->_info._filename.c_str());
+                                  object->_client_ip.c_str(), object->_client_port, task->_filename.c_str());
+                        object->notify_close_curent_connection();
+                        return;
+                    }
+                }
+                size_t send_size = std::min<int64_t>(file_content->size(), end_pos - start_pos);
+                if (send_size == 0)
+                {
+                    LOG_ERROR("client_ip:%s client_port:%d file:%s is shorter than expected",
+                              object->_client_ip.c_str(), object->_client_port, task->_filename.c_str());
+                    object->notify_close_curent_connection();
+                    return;
+                }
+                task->_cur_pos += send_size;
+                if (task->_cur_pos >= end_pos && ++task->_range_index < task->_ranges.size())
+                    task->_cur_pos = task->_ranges[task->_range_index]._start;
+                bool is_finished = task->_range_index == task->_ranges.size();
+                std::string compressed_content;
+                if (task->_compressor != nullptr)
+                {
+                    compressed_content = BufferPool::GetInstance().Acquire();
+                    if (!task->_compressor->Compress(file_content->data(), send_size, is_finished, &compressed_content))
+                    {
+                        LOG_ERROR("client_ip:%s client_port:%d compress file content error, filename:%s",
+                                  object->_client_ip.c_str(), object->_client_port, task->_filename.c_str());
                         object->notify_close_curent_connection();
                         return;
                     }
                 }
                 {
                     std::unique_lock<std::mutex> response_lock(object->_response_mutex);
-                    object->_response_buffer += file_content;
+                    object->_response_buffer.Append(std::move(part_header));
+                    if (task->_compressor != nullptr)
+                    {
+                        HTTPAppendChunk(&object->_response_buffer, std::move(compressed_content));
+                        if (is_finished)
+                            HTTPAppendLastChunk(&object->_response_buffer);
+                    }
+                    else
+                        object->_response_buffer.Append(file_content, 0, send_size);
+                    if (is_finished && !task->_boundary.empty())
+                        object->_response_buffer.Append(HTTPRangeUtil::CloseDelimiter(task->_boundary));
                 }
                 object->notify_new_message_need_send();
-                start_pos += file_content.size();
-                if (start_pos < end_pos)
-                    object->_sub_task = std::bind(&HTTPConnection::sendFile, std::placeholders::_1, file_info_node, start_pos, end_pos);
+                if (task->_range_index < task->_ranges.size())
+                    object->_sub_task = std::bind(&HTTPConnection::sendFile, std::placeholders::_1, task);
             }
+            dispatch_sub_task(object);
+        }
+        // 流式生成响应body并按chunked传输编码写入发送缓冲区，每次只生成一段数据
+        // 发送缓冲区中积压的数据超过水位线时暂停生成，由主线程在数据发送出去后恢复，保证内存占用不随body大小增长
+        static void sendGenerated(HTTPConnection::ptr object, GenerateTask::ptr task)
+        {
+            if (object->_is_closed)
+                return;
+            object->_sub_task = sub_fun_t();
+            {
+                std::unique_lock<std::mutex> response_lock(object->_response_mutex);
+                if (object->_response_buffer.Size() >= Config::GetInstance()->GetResponseBufferHighWatermark())
+                {
+                    object->_parked_task = std::bind(&HTTPConnection::sendGenerated, std::placeholders::_1, task);
+                    return;
+                }
+            }
+            std::string chunk = BufferPool::GetInstance().Acquire();
+            bool is_finished = task->_generator->Generate(&chunk, Config::GetInstance()->GetStreamChunkSize());
+            if (task->_compressor != nullptr)
+            {
+                std::string compressed_chunk = BufferPool::GetInstance().Acquire();
+                if (!task->_compressor->Compress(chunk.data(), chunk.size(), is_finished, &compressed_chunk))
+                {
+                    LOG_ERROR("client_ip:%s client_port:%d compress generated response error",
+                              object->_client_ip.c_str(), object->_client_port);
+                    object->notify_close_curent_connection();
+                    return;
+                }
+                BufferPool::GetInstance().Release(std::move(chunk));
+                chunk = std::move(compressed_chunk);
+            }
+            {
+                std::unique_lock<std::mutex> response_lock(object->_response_mutex);
+                HTTPAppendChunk(&object->_response_buffer, std::move(chunk));
+                if (is_finished)
+                    HTTPAppendLastChunk(&object->_response_buffer);
+            }
+            object->notify_new_message_need_send();
+            if (!is_finished)
+                object->_sub_task = std::bind(&HTTPConnection::sendGenerated, std::placeholders::_1, task);
+            dispatch_sub_task(object);
+        }
+
+    private:
+        // 响应的一部分发送任务完成后调用: 还有后续任务时继续执行，否则回到请求处理，没有待处理的请求时结束本轮处理
+        static void dispatch_sub_task(HTTPConnection::ptr object)
+        {
             if (object->_sub_task == nullptr)
             {
                 std::unique_lock<std::mutex> request_lock(object->_request_mutex);
@@ -0,0 +1,15 @@
+#include "backup_path.hpp"
+
+// 离线迁移工具: 将平铺布局的备份目录(backup_file_dir/<filename>)迁移为分片布局(backup_file_dir/<aa>/<bb>/<filename>)
+// 服务器启动时也会自动执行同样的迁移，文件很多时可以在升级前先停服执行本工具，避免启动时间过长
+// 需要在config.json所在的目录下运行，运行期间不能启动服务器
+int main()
+{
+    // 初始化日志器
+    cloud_backup::InitCloudBackupLogger();
+
+    size_t moved = 0;
+    bool ret = cloud_backup::BackupPathResolver::MigrateFlatLayout(&moved);
+    std::cout << "migrated " << moved << " files to " << cloud_backup::BackupPathResolver::BackupDir() << (ret ? "" : ", some files failed") << std::endl;
+    return ret ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+#ifndef CLOUD_BACKUP_BACKUP_PATH_HPP
+#define CLOUD_BACKUP_BACKUP_PATH_HPP
+
+#include "util.hpp"
+#include "config.hpp"
+#include "group_commit.hpp"
+
+namespace cloud_backup
+{
+    // 备份文件所在的存储层，新上传的文件总是在热存储层，长期未被下载的文件由TierMover降级到冷存储层
+    enum class StorageTier
+    {
+        HOT,  // backup_file_dir，通常位于速度快、容量小的磁盘
+        COLD, // cold_storage_dir，通常位于速度慢、容量大的磁盘
+    };
+
+    // 备份文件在备份目录中的分片布局: <backup_file_dir>/<aa>/<bb>/<filename>
+    // aa和bb是文件名的FNV-1a哈希值最高两个字节的十六进制表示，最多65536个分片目录，单个目录内的文件数保持在较小的规模
+    // 所有备份文件路径都必须通过该类获取，哈希算法一旦确定就不能修改，否则已有文件将无法找到
+    // 配置了冷存储目录时冷存储层使用相同的分片布局，文件所在的层记录在其备份信息中，查找文件时不需要探测各层的目录
+    class BackupPathResolver
+    {
+    public:
+        static constexpr const char *MIGRATING_SUFFIX = ".cbmigrating"; // 迁移时与分片目录同名的文件暂时改名所加的后缀
+
+        // 是否配置了冷存储层
+        static bool TieringEnabled() { return !Config::GetInstance()->GetColdStorageDir().empty(); }
+        // 获取存储层的备份目录的路径，以'/'结尾
+        static std::string BackupDir(StorageTier tier = StorageTier::HOT)
+        {
+            std::string backup_dir = tier == StorageTier::COLD ? Config::GetInstance()->GetColdStorageDir() : Config::GetInstance()->GetBackupFileDir();
+            if (backup_dir.back() != '/')
+                backup_dir += '/';
+            return backup_dir;
+        }
+        // 获取文件所在的分片目录，以'/'结尾
+        static std::string ShardDir(const std::string &filename, StorageTier tier = StorageTier::HOT)
+        {
+            uint32_t hash = 2166136261u;
+            for (char ch : filename)
+                hash = (hash ^ static_cast<uint8_t>(ch)) * 16777619u;
+            unsigned char prefix[2] = {static_cast<unsigned char>(hash >> 24), static_cast<unsigned char>(hash >> 16 & 0xff)};
+            return BackupDir(tier) + HashUtil::HexEncode(prefix, 1) + '/' + HashUtil::HexEncode(prefix + 1, 1) + '/';
+        }
+        // 获取文件在存储层的备份目录中的路径，去重存储的文件对应的是其文件清单
+        static std::string FilePath(const std::string &filename, StorageTier tier = StorageTier::HOT) { return ShardDir(filename, tier) + filename; }
+        // 创建文件所在的分片目录，在备份目录中创建新文件前调用，失败返回false
+        static bool PrepareFilePath(const std::string &filename, StorageTier tier = StorageTier::HOT)
+        {
+            std::string shard_dir = ShardDir(filename, tier);
+            std::error_code ec;
+            bool is_created = fs::create_directories(shard_dir, ec);
+            if (ec)
+            {
+                LOG_ERROR("BackupPathResolver error, create directory:%s error:%s", shard_dir.c_str(), ec.message().c_str());
+                return false;
+            }
+            // 落盘时只同步文件所在的分片目录，新建的分片目录需要先在上两级目录中落盘
+            std::string backup_dir = BackupDir(tier);
+            if (is_created && !GroupCommitter::GetInstance()->Sync({backup_dir, backup_dir + shard_dir.substr(backup_dir.size(), 3)}))
+            {
+                LOG_ERROR("BackupPathResolver error, sync new directory:%s failed", shard_dir.c_str());
+                return false;
+            }
+            return true;
+        }
+        // 获取正在上传的文件所在的目录，以'/'结尾，与备份文件位于同一文件系统，上传完成后可以直接改名移入分片目录
+        static std::string UploadingDir() { return BackupDir() + ".uploading/"; }
+        // 获取已注册的文件在上传过程中的临时路径，按文件名的SHA-256命名，同一时刻一个文件名只会有一个上传
+        static std::string UploadingPath(const std::string &filename)
+        {
+            return UploadingDir() + HashUtil::Sha256Hex(filename.data(), filename.size());
+        }
+        // 清空上传临时目录，启动时调用，重启后之前的注册都已失效，残留的都是未完成上传的文件，失败返回false
+        static bool ClearUploadingDir() { return ClearDir(UploadingDir()); }
+        // 获取迁移到存储层的文件在复制过程中所在的目录，以'/'结尾，与目标位置位于同一文件系统
+        static std::string MigratingDir(StorageTier tier) { return BackupDir(tier) + ".migrating/"; }
+        // 获取文件迁移到存储层时复制的目标临时路径
+        static std::string MigratingPath(const std::string &filename, StorageTier tier)
+        {
+            return MigratingDir(tier) + HashUtil::Sha256Hex(filename.data(), filename.size());
+        }
+        // 清空各存储层的迁移临时目录，启动时调用，残留的都是复制到一半的文件，失败返回false
+        static bool ClearMigratingDirs()
+        {
+            if (!ClearDir(MigratingDir(StorageTier::HOT)))
+                return false;
+            return !TieringEnabled() || ClearDir(MigratingDir(StorageTier::COLD));
+        }
+        // 遍历存储层所有分片目录中的普通文件，分片目录之外的文件不会被返回，失败返回false
+        static bool ScanFiles(std::vector<FileUtil> *files, StorageTier tier = StorageTier::HOT)
+        {
+            files->clear();
+            std::error_code ec;
+            for (auto &first : fs::directory_iterator(BackupDir(tier), ec))
+            {
+                if (!first.is_directory() || !IsShardName(first.path().filename().string()))
+                    continue;
+                for (auto &second : fs::directory_iterator(first.path(), ec))
+                {
+                    if (!second.is_directory() || !IsShardName(second.path().filename().string()))
+                        continue;
+                    for (auto &file : fs::directory_iterator(second.path(), ec))
+                        if (file.is_regular_file())
+                            files->push_back(FileUtil(file.path().string()));
+                }
+            }
+            if (ec)
+            {
+                LOG_ERROR("BackupPathResolver ScanFiles error:%s", ec.message().c_str());
+                return false;
+            }
+            return true;
+        }
+        // 将平铺在备份目录顶层的文件移动到各自的分片目录中，用于升级以前的平铺布局，可以重复执行，中途退出后再次执行会继续迁移
+        // 文件名恰好与分片目录同名(两个十六进制字符)的文件会先改名让出位置，moved返回本次移动的文件数，有文件移动失败时返回false
+        static bool MigrateFlatLayout(size_t *moved = nullptr)
+        {
+            std::string backup_dir = BackupDir();
+            std::vector<std::string> filenames;
+            std::error_code ec;
+            fs::create_directories(backup_dir, ec);
+            for (auto &file : fs::directory_iterator(backup_dir, ec))
+                if (file.is_regular_file())
+                    filenames.push_back(file.path().filename().string());
+            if (ec)
+            {
+                LOG_ERROR("BackupPathResolver MigrateFlatLayout error, scan directory:%s error:%s", backup_dir.c_str(), ec.message().c_str());
+                return false;
+            }
+            for (auto &filename : filenames)
+            {
+                if (!IsShardName(filename))
+                    continue;
+                std::string new_name = filename + MIGRATING_SUFFIX;
+                if (rename((backup_dir + filename).c_str(), (backup_dir + new_name).c_str()) == -1)
+                {
+                    LOG_ERROR("BackupPathResolver MigrateFlatLayout error, rename file:%s error:%d message:%s", filename.c_str(), errno, strerror(errno));
+                    return false;
+                }
+                filename = new_name;
+            }
+            bool ret = true;
+            size_t count = 0;
+            for (auto &current_name : filenames)
+            {
+                std::string filename = current_name;
+                size_t suffix_len = strlen(MIGRATING_SUFFIX);
+                if (filename.size() == 2 + suffix_len && filename.compare(2, suffix_len, MIGRATING_SUFFIX) == 0 && IsShardName(filename.substr(0, 2)))
+                    filename = filename.substr(0, 2);
+                if (!PrepareFilePath(filename) || rename((backup_dir + current_name).c_str(), FilePath(filename).c_str()) == -1)
+                {
+                    LOG_ERROR("BackupPathResolver MigrateFlatLayout error, move file:%s failed", filename.c_str());
+                    ret = false;
+                    continue;
+                }
+                count++;
+            }
+            if (count > 0)
+                LOG_INFO("BackupPathResolver migrated %zu files from flat layout to sharded layout", count);
+            if (moved != nullptr)
+                *moved = count;
+            return ret;
+        }
+
+    private:
+        // 删除目录及其中的所有内容后重新创建
+        static bool ClearDir(const std::string &dir)
+        {
+            std::error_code ec;
+            fs::remove_all(dir, ec);
+            if (!ec)
+                fs::create_directories(dir, ec);
+            if (ec)
+            {
+                LOG_ERROR("BackupPathResolver error, clear directory:%s error:%s", dir.c_str(), ec.message().c_str());
+                return false;
+            }
+            return true;
+        }
+        // 分片目录名是两个小写十六进制字符
+        static bool IsShardName(const std::string &name)
+        {
+            if (name.size() != 2)
+                return false;
+            for (char ch : name)
+                if (!(ch >= '0' && ch <= '9') && !(ch >= 'a' && ch <= 'f'))
+                    return false;
+            return true;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include <iostream>
+#include <iomanip>
+#include <shared_mutex>
+#include <unordered_map>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <functional>
+#include "rcu_map.hpp"
+
+// 文件目录查找的读扩展性基准测试: 多个线程按文件名查找文件节点并读取其大小，比较几种目录结构在不同线程数下的吞吐
+//   global   全局一把读写锁保护的hash表(分片之前的DataManager)
+//   sharded  按文件名哈希分片，每个分片一把读写锁(DataManager分片后加锁查找)
+//   rcu      按文件名哈希分片，在EpochReclaimer::Guard内查找，不拷贝节点指针(DataManager当前的GetFileSize和下载路径)
+//   rcu_copy 同rcu，但把节点的智能指针拷贝出Guard(DataManager当前的GetFileInfoNode)，每次查找修改节点的引用计数
+//   rcu_lock 同rcu_copy，再加节点的读锁读取(之前的下载路径，打开文件和每段读取都持有节点的读锁)
+// 分两种负载测试: 每个线程随机查找不同的文件名，以及所有线程都查找同一个热点文件名(锁和引用计数所在的缓存行在线程间争用)
+// 用法: ./catalog_lookup_bench [文件数量(默认100000)] [每轮测试的毫秒数(默认1000)] [最大线程数(默认CPU核数的2倍)]
+struct FileNode
+{
+    std::string _filename;
+    int64_t _size;
+    std::shared_mutex _rwlock;
+};
+using FileNodePtr = std::shared_ptr<FileNode>;
+
+static const size_t SHARD_COUNT = 16;
+
+struct GlobalCatalog
+{
+    std::unordered_map<std::string, FileNodePtr> _hash;
+    std::shared_mutex _rwlock;
+
+    int64_t FindSize(const std::string &filename)
+    {
+        std::shared_lock<std::shared_mutex> read_lock(_rwlock);
+        auto it = _hash.find(filename);
+        return it == _hash.end() ? -1 : it->second->_size;
+    }
+};
+
+struct ShardedCatalog
+{
+    struct Shard
+    {
+        std::unordered_map<std::string, FileNodePtr> _hash;
+        std::shared_mutex _rwlock;
+    };
+    Shard _shards[SHARD_COUNT];
+
+    Shard &GetShard(const std::string &filename) { return _shards[std::hash<std::string>()(filename) % SHARD_COUNT]; }
+    int64_t FindSize(const std::string &filename)
+    {
+        Shard &shard = GetShard(filename);
+        std::shared_lock<std::shared_mutex> read_lock(shard._rwlock);
+        auto it = shard._hash.find(filename);
+        return it == shard._hash.end() ? -1 : it->second->_size;
+    }
+};
+
+struct RcuCatalog
+{
+    cloud_backup::RcuMap<FileNodePtr> _shards[SHARD_COUNT];
+
+    cloud_backup::RcuMap<FileNodePtr> &GetShard(const std::string &filename) { return _shards[std::hash<std::string>()(filename) % SHARD_COUNT]; }
+    int64_t FindSize(const std::string &filename)
+    {
+        cloud_backup::EpochReclaimer::Guard guard;
+        const FileNodePtr *node = GetShard(filename).Find(filename);
+        return node == nullptr ? -1 : (*node)->_size;
+    }
+    FileNodePtr FindNode(const std::string &filename)
+    {
+        cloud_backup::EpochReclaimer::Guard guard;
+        const FileNodePtr *node = GetShard(filename).Find(filename);
+        return node == nullptr ? nullptr : *node;
+    }
+};
+
+// threads个线程在duration内不断从filenames中随机查找，返回每秒的查找次数，查找失败时退出
+static double RunLookups(const std::vector<std::string> &filenames, size_t threads, std::chrono::milliseconds duration,
+                         const std::function<int64_t(const std::string &)> &find)
+{
+    std::atomic<bool> is_stop = false;
+    std::atomic<size_t> ready = 0;
+    std::vector<size_t> counts(threads * 8, 0); // 每个线程的计数相隔一条缓存行
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++)
+        workers.emplace_back([&, i]()
+                             {
+                                 std::mt19937_64 rng(i + 1);
+                                 size_t count = 0;
+                                 ready++;
+                                 while (!is_stop.load(std::memory_order_relaxed))
+                                 {
+                                     for (int j = 0; j < 64; j++)
+                                     {
+                                         const std::string &filename = filenames[rng() % filenames.size()];
+                                         if (find(filename) < 0)
+                                         {
+                                             std::cerr << "lookup failed: " << filename << std::endl;
+                                             exit(1);
+                                         }
+                                     }
+                                     count += 64;
+                                 }
+                                 counts[i * 8] = count; });
+    while (ready < threads)
+        std::this_thread::yield();
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(duration);
+    is_stop = true;
+    for (auto &worker : workers)
+        worker.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t total = 0;
+    for (size_t i = 0; i < threads; i++)
+        total += counts[i * 8];
+    return total / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t file_count = argc > 1 ? std::stoul(argv[1]) : 100000;
+    std::chrono::milliseconds duration(argc > 2 ? std::stoul(argv[2]) : 1000);
+    size_t max_threads = argc > 3 ? std::stoul(argv[3]) : std::max<size_t>(std::thread::hardware_concurrency(), 1) * 2;
+
+    std::vector<std::string> filenames;
+    GlobalCatalog global;
+    ShardedCatalog sharded;
+    RcuCatalog rcu;
+    for (size_t i = 0; i < file_count; i++)
+    {
+        std::string filename = "backup_" + std::to_string(i) + ".bin";
+        FileNodePtr node(new FileNode{filename, (int64_t)i, {}});
+        filenames.push_back(filename);
+        global._hash[filename] = node;
+        sharded.GetShard(filename)._hash[filename] = node;
+        rcu.GetShard(filename).Set(filename, node);
+    }
+
+    std::vector<std::string> hot_filenames{filenames[file_count / 2]};
+    std::cout << file_count << " files, " << duration.count() << "ms per run, million lookups per second" << std::endl;
+    for (auto *workload : {&filenames, &hot_filenames})
+    {
+        std::cout << (workload == &filenames ? "random names" : "one hot name") << std::endl;
+        std::cout << std::setw(8) << "threads" << std::setw(12) << "global" << std::setw(12) << "sharded"
+                  << std::setw(12) << "rcu" << std::setw(12) << "rcu_copy" << std::setw(12) << "rcu_lock" << std::endl;
+        for (size_t threads = 1; threads <= max_threads; threads *= 2)
+        {
+            double global_rate = RunLookups(*workload, threads, duration, [&](const std::string &filename)
+                                            { return global.FindSize(filename); });
+            double sharded_rate = RunLookups(*workload, threads, duration, [&](const std::string &filename)
+                                             { return sharded.FindSize(filename); });
+            double rcu_rate = RunLookups(*workload, threads, duration, [&](const std::string &filename)
+                                         { return rcu.FindSize(filename); });
+            double rcu_copy_rate = RunLookups(*workload, threads, duration, [&](const std::string &filename)
+                                              { FileNodePtr node = rcu.FindNode(filename);
+                                                return node == nullptr ? -1 : node->_size; });
+            double rcu_lock_rate = RunLookups(*workload, threads, duration, [&](const std::string &filename)
+                                              { FileNodePtr node = rcu.FindNode(filename);
+                                                if (node == nullptr)
+                                                    return (int64_t)-1;
+                                                std::shared_lock<std::shared_mutex> file_read_lock(node->_rwlock);
+                                                return node->_size; });
+            std::cout << std::fixed << std::setprecision(2) << std::setw(8) << threads << std::setw(12) << global_rate / 1e6
+                      << std::setw(12) << sharded_rate / 1e6 << std::setw(12) << rcu_rate / 1e6 << std::setw(12) << rcu_copy_rate / 1e6
+                      << std::setw(12) << rcu_lock_rate / 1e6 << std::endl;
+        }
+    }
+    return 0;
+}
@@ -81,16 +81,21 @@ void DateManagerTest()
     dmp->GetAllBackupInfo(&infos);
     for (auto &e : infos)
         std::cout << e._filename << "——" << e._size << "——" << e._time << "\n";
-    std::cout << dmp->GetFilePreContent("test1") << "\n";
-    dmp->PutFilePreContent("test1", "hello world");
-    std::cout << dmp->GetFilePreContent("test1") << "\n";
-    dmp->PutFilePreContent("test2", "thank you");
-    std::cout << dmp->GetFilePreContent("test1") << "\n";
-    std::cout << dmp->GetFilePreContent("test2") << "\n";
-    dmp->PutFilePreContent("test3", "you are welcome");
-    std::cout << dmp->GetFilePreContent("test1") << "\n";
-    std::cout << dmp->GetFilePreContent("test2") << "\n";
-    std::cout << dmp->GetFilePreContent("test3") << "\n";
+    auto print_pre_content = [&](const std::string &filename)
+    {
+        auto content = dmp->GetFilePreContent(filename, dmp->GetFileInfoNode(filename)->_id);
+        std::cout << (content == nullptr ? "" : *content) << "\n";
+    };
+    print_pre_content("test1");
+    dmp->PutFilePreContent("test1", dmp->GetFileInfoNode("test1")->_id, std::make_shared<const std::string>("hello world"));
+    print_pre_content("test1");
+    dmp->PutFilePreContent("test2", dmp->GetFileInfoNode("test2")->_id, std::make_shared<const std::string>("thank you"));
+    print_pre_content("test1");
+    print_pre_content("test2");
+    dmp->PutFilePreContent("test3", dmp->GetFileInfoNode("test3")->_id, std::make_shared<const std::string>("you are welcome"));
+    print_pre_content("test1");
+    print_pre_content("test2");
+    print_pre_content("test3");
 
     dmp->Delete("test1");
 }
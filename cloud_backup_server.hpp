@@ -23,6 +23,16 @@ namespace cloud_backup
                 LOG_ERROR("ModifyCloudBackupLoggerSinks error, exit");
                 exit(LOAD_CONFIG_FILE_ERROR);
             }
+            // 恢复暂存目录中未完成的可续传上传会话，并启动过期会话的清理线程
+            UploadSessionManager::GetInstance();
+            // 恢复暂存目录中未完成的分片上传
+            MultipartUploadManager::GetInstance();
+            // 配置了冷存储层时启动存储层之间的迁移线程
+            TierMover::GetInstance();
+            // 开启包文件存储时启动包文件的整理线程
+            PackCompactor::GetInstance();
+            // 构建请求的路由表
+            HTTPConnection::InitRouter();
             // 读取配置文件获取服务器端口号
             _server_port = config->GetServerPort();
 
@@ -283,6 +293,9 @@ namespace cloud_backup
                     tmp_buffer[read_bytes] = '\0';
                     LOG_DEBUG("NetReader INFO, read %d bytes from net_fd:%d", read_bytes, net_fd);
                     LOG_DEBUG("%s", tmp_buffer);
+                    // 请求已被提前拒绝，连接即将关闭，客户端仍在发送的数据直接丢弃
+                    if (connection->_close_after_send)
+                        continue;
                     std::unique_lock<std::mutex> request_lock(connection->_request_mutex);
                     for (int i = 0; i < read_bytes; ++i)
                         connection->_request_buffer += tmp_buffer[i];
@@ -304,14 +317,14 @@ namespace cloud_backup
             }
             HTTPConnection::ptr connection = _connections[net_fd];
             std::unique_lock<std::mutex> response_lock(connection->_response_mutex);
-            if (connection->_response_buffer.empty())
+            if (connection->_response_buffer.Empty())
             {
                 LOG_WARN("NetWriter WARN, response buffer is empty for net_fd: %d", net_fd);
                 return;
             }
             while (true)
             {
-                ssize_t write_bytes = write(net_fd, connection->_response_buffer.c_str(), connection->_response_buffer.size());
+                ssize_t write_bytes = connection->_response_buffer.WriteTo(net_fd);
                 if (write_bytes < 0)
                 {
                     if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -325,9 +338,12 @@ namespace cloud_backup
                 else if (write_bytes >= 0)
                 {
                     LOG_DEBUG("NetWriter INFO, write %d bytes to net_fd:%d", write_bytes, net_fd);
-                    LOG_DEBUG("%s", connection->_response_buffer.substr(0, write_bytes).c_str());
-                    connection->_response_buffer.erase(0, write_bytes);
-                    if (connection->_response_buffer.empty())
+                    if (connection->_response_buffer.Empty() && connection->_close_after_send)
+                    {
+                        LOG_INFO("Server will terminate the connection net_fd:%d after response sent", net_fd);
+                        NetExcepter(net_fd);
+                    }
+                    else if (connection->_response_buffer.Empty())
                     {
                         if (_epoller.EpollMod(net_fd, EPOLLIN | EPOLLET) == false)
                             LOG_WARN("NetWriter WARN, EpollMod net_fd:%d to EPOLLIN failed", net_fd);
@@ -340,6 +356,14 @@ namespace cloud_backup
                     break;
                 }
             }
+            // 发送缓冲区已排空到水位线以下，恢复之前因积压而暂停的文件发送或流式生成任务
+            HTTPConnection::sub_fun_t parked_task;
+            if (connection->_parked_task && !connection->_is_closed &&
+                connection->_response_buffer.Size() < Config::GetInstance()->GetResponseBufferHighWatermark())
+                std::swap(parked_task, connection->_parked_task);
+            response_lock.unlock();
+            if (parked_task)
+                TaskThreadPool::GetInstance()->push(std::bind(parked_task, connection));
         }
         // 网络连接异常处理
         void NetExcepter(int net_fd)
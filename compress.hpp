@@ -0,0 +1,141 @@
+#ifndef CLOUD_BACKUP_COMPRESS_HPP
+#define CLOUD_BACKUP_COMPRESS_HPP
+
+#include <zlib.h>
+#include <string_view>
+#include "config.hpp"
+
+namespace cloud_backup
+{
+    // HTTP响应的内容编码
+    enum class ContentEncoding
+    {
+        IDENTITY, // 不压缩
+        GZIP,
+        DEFLATE,
+    };
+
+    class CompressUtil
+    {
+    public:
+        // 根据Accept-Encoding请求头选择响应使用的内容编码，按q值选择，q值相同时优先gzip，都不可接受时返回IDENTITY
+        static ContentEncoding Negotiate(const std::string &accept_encoding)
+        {
+            double gzip_q = 0, deflate_q = 0, any_q = -1;
+            std::string_view list(accept_encoding);
+            while (!list.empty())
+            {
+                size_t comma_pos = list.find(',');
+                std::string_view item = list.substr(0, comma_pos);
+                list.remove_prefix(comma_pos == std::string_view::npos ? list.size() : comma_pos + 1);
+                double q = 1;
+                size_t semicolon_pos = item.find(';');
+                if (semicolon_pos != std::string_view::npos)
+                {
+                    std::string_view param = item.substr(semicolon_pos + 1);
+                    size_t q_pos = param.find("q=");
+                    if (q_pos != std::string_view::npos)
+                        q = atof(std::string(param.substr(q_pos + 2)).c_str());
+                    item = item.substr(0, semicolon_pos);
+                }
+                while (!item.empty() && item.front() == ' ')
+                    item.remove_prefix(1);
+                while (!item.empty() && item.back() == ' ')
+                    item.remove_suffix(1);
+                if (item == "gzip" || item == "x-gzip")
+                    gzip_q = q;
+                else if (item == "deflate")
+                    deflate_q = q;
+                else if (item == "*")
+                    any_q = q;
+            }
+            if (any_q > 0)
+            {
+                gzip_q = gzip_q > 0 ? gzip_q : any_q;
+                deflate_q = deflate_q > 0 ? deflate_q : any_q;
+            }
+            if (gzip_q <= 0 && deflate_q <= 0)
+                return ContentEncoding::IDENTITY;
+            return gzip_q >= deflate_q ? ContentEncoding::GZIP : ContentEncoding::DEFLATE;
+        }
+        // 内容编码在Content-Encoding响应头中的名称
+        static std::string_view EncodingName(ContentEncoding encoding)
+        {
+            if (encoding == ContentEncoding::GZIP)
+                return "gzip";
+            if (encoding == ContentEncoding::DEFLATE)
+                return "deflate";
+            return "identity";
+        }
+        // 根据文件的扩展名判断下载时是否值得压缩，可压缩的扩展名由配置文件指定
+        static bool IsCompressibleFile(const std::string &filename)
+        {
+            size_t dot_pos = filename.find_last_of('.');
+            if (dot_pos == std::string::npos)
+                return false;
+            std::string extension = filename.substr(dot_pos);
+            for (auto &ch : extension)
+                ch = tolower(ch);
+            for (auto &compressible : Config::GetInstance()->GetCompressDownloadExtensions())
+                if (extension == compressible)
+                    return true;
+            return false;
+        }
+    };
+
+    // 基于zlib的流式压缩器，一个对象对应一个响应body，数据可以分多次传入
+    class StreamCompressor
+    {
+    public:
+        using ptr = std::shared_ptr<StreamCompressor>;
+        StreamCompressor(ContentEncoding encoding, int level)
+        {
+            // windowBits加16输出gzip格式，否则输出HTTP的deflate所要求的zlib格式
+            int window_bits = encoding == ContentEncoding::GZIP ? 15 + 16 : 15;
+            _is_valid = deflateInit2(&_stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            if (!_is_valid)
+                LOG_ERROR("StreamCompressor error, deflateInit2 failed");
+        }
+        ~StreamCompressor()
+        {
+            if (_is_valid)
+                deflateEnd(&_stream);
+        }
+        bool IsValid() { return _is_valid; }
+        // 压缩[data, data+len)并将输出追加到out中，finish为true表示这是body的最后一段数据，失败返回false
+        bool Compress(const char *data, size_t len, bool finish, std::string *out)
+        {
+            if (!_is_valid)
+                return false;
+            _stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+            _stream.avail_in = len;
+            int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+            while (true)
+            {
+                size_t old_size = out->size();
+                size_t out_room = deflateBound(&_stream, _stream.avail_in) + 64;
+                out->resize(old_size + out_room);
+                _stream.next_out = reinterpret_cast<Bytef *>(out->data() + old_size);
+                _stream.avail_out = out_room;
+                int ret = deflate(&_stream, flush);
+                out->resize(old_size + out_room - _stream.avail_out);
+                if (ret == Z_STREAM_ERROR)
+                {
+                    LOG_ERROR("StreamCompressor error, deflate failed");
+                    return false;
+                }
+                if (finish ? ret == Z_STREAM_END : (_stream.avail_in == 0 && _stream.avail_out != 0))
+                    return true;
+            }
+        }
+
+    private:
+        StreamCompressor(const StreamCompressor &) = delete;
+        StreamCompressor &operator=(const StreamCompressor &) = delete;
+
+        z_stream _stream{};
+        bool _is_valid = false;
+    };
+}
+
+#endif
@@ -37,6 +37,43 @@ namespace cloud_backup
         size_t GetPerHandleRequestSize() { return _per_handle_request_size; }
         std::string GetDataManagerFilePath() { return _data_manager_filepath; }
         std::string GetBackupFileDir() { return _backup_file_dir; }
+        int GetCompressLevel() { return _compress_level; }
+        long long GetCompressMinSize() { return _compress_min_size; }
+        const std::vector<std::string> &GetCompressDownloadExtensions() { return _compress_download_extensions; }
+        size_t GetStreamChunkSize() { return _stream_chunk_size; }
+        size_t GetResponseBufferHighWatermark() { return _response_buffer_high_watermark; }
+        std::string GetUploadStagingDir() { return _upload_staging_dir; }
+        int64_t GetUploadSessionExpireSeconds() { return _upload_session_expire_seconds; }
+        int64_t GetMultipartMinPartSize() { return _multipart_min_part_size; }
+        int GetMultipartMaxPartCount() { return _multipart_max_part_count; }
+        bool GetDedupEnable() { return _dedup_enable; }
+        std::string GetDedupChunkDir() { return _dedup_chunk_dir; }
+        size_t GetDedupMinChunkSize() { return _dedup_min_chunk_size; }
+        size_t GetDedupAvgChunkSize() { return _dedup_avg_chunk_size; }
+        size_t GetDedupMaxChunkSize() { return _dedup_max_chunk_size; }
+        bool GetCompressAtRestEnable() { return _compress_at_rest_enable; }
+        int64_t GetCompressAtRestFrameSize() { return _compress_at_rest_frame_size; }
+        int64_t GetDeltaBlockSize() { return _delta_block_size; }
+        int GetDurableCommitLatencyMs() { return _durable_commit_latency_ms; }
+        size_t GetDurableCommitMaxBatch() { return _durable_commit_max_batch; }
+        int64_t GetLargeFileThreshold() { return _large_file_threshold; }
+        const std::string &GetLargeFileIOMode() { return _large_file_io_mode; }
+        size_t GetFdCacheCapacity() { return _fd_cache_capacity; }
+        size_t GetDownloadReadAheadDepth() { return _download_read_ahead_depth; }
+        size_t GetReadAheadThreadsSize() { return _read_ahead_threads_size; }
+        std::string GetColdStorageDir() { return _cold_storage_dir; }
+        int GetTierDemoteAfterDays() { return _tier_demote_after_days; }
+        int GetTierPromoteAccessCount() { return _tier_promote_access_count; }
+        int GetTierScanInterval() { return _tier_scan_interval; }
+        int64_t GetTierMigrateRate() { return _tier_migrate_rate; }
+        bool GetPackEnable() { return _pack_enable; }
+        int64_t GetPackMaxFileSize() { return _pack_max_file_size; }
+        std::string GetPackDir() { return _pack_dir; }
+        int64_t GetPackFileSize() { return _pack_file_size; }
+        double GetPackCompactRatio() { return _pack_compact_ratio; }
+        int GetPackCompactInterval() { return _pack_compact_interval; }
+        int64_t GetMetadataCheckpointSize() { return _metadata_checkpoint_size; }
+        int GetDataManagerShardCount() { return _data_manager_shard_count; }
 
     private:
         Config() { ReadConfigFile(); }
@@ -73,6 +110,50 @@ namespace cloud_backup
             _per_handle_request_size = root["per_handle_request_size"].asUInt();
             _data_manager_filepath = root["data_manager_filepath"].asString();
             _backup_file_dir = root["backup_file_dir"].asString();
+            _compress_level = root["compress_level"].asInt();
+            _compress_min_size = root["compress_min_size"].asInt64();
+            for (auto &extension : root["compress_download_extensions"])
+                _compress_download_extensions.push_back(extension.asString());
+            _stream_chunk_size = root["stream_chunk_size"].asUInt();
+            _response_buffer_high_watermark = root["response_buffer_high_watermark"].asUInt();
+            _upload_staging_dir = root["upload_staging_dir"].asString();
+            _upload_session_expire_seconds = root["upload_session_expire_seconds"].asInt64();
+            _multipart_min_part_size = root["multipart_min_part_size"].asInt64();
+            _multipart_max_part_count = root["multipart_max_part_count"].asInt();
+            _dedup_enable = root["dedup_enable"].asBool();
+            _dedup_chunk_dir = root["dedup_chunk_dir"].asString();
+            _dedup_min_chunk_size = root["dedup_min_chunk_size"].asUInt();
+            _dedup_avg_chunk_size = root["dedup_avg_chunk_size"].asUInt();
+            _dedup_max_chunk_size = root["dedup_max_chunk_size"].asUInt();
+            // 分块器按平均块大小计算掩码，至少需要2位，且需要满足最小块大小<=平均块大小<=最大块大小
+            if (_dedup_avg_chunk_size < 4 || _dedup_min_chunk_size > _dedup_avg_chunk_size || _dedup_avg_chunk_size > _dedup_max_chunk_size)
+            {
+                LOG_ERROR("invalid dedup chunk size, min:%zu avg:%zu max:%zu, ReadConfigFile fail", _dedup_min_chunk_size, _dedup_avg_chunk_size, _dedup_max_chunk_size);
+                exit(LOAD_CONFIG_FILE_ERROR);
+            }
+            _compress_at_rest_enable = root["compress_at_rest_enable"].asBool();
+            _compress_at_rest_frame_size = root["compress_at_rest_frame_size"].asInt64();
+            _delta_block_size = root["delta_block_size"].asInt64();
+            _durable_commit_latency_ms = root["durable_commit_latency_ms"].asInt();
+            _durable_commit_max_batch = root["durable_commit_max_batch"].asUInt();
+            _large_file_threshold = root["large_file_threshold"].asInt64();
+            _large_file_io_mode = root["large_file_io_mode"].asString();
+            _fd_cache_capacity = root["fd_cache_capacity"].asUInt();
+            _download_read_ahead_depth = root["download_read_ahead_depth"].asUInt();
+            _read_ahead_threads_size = root["read_ahead_threads_size"].asUInt();
+            _cold_storage_dir = root["cold_storage_dir"].asString();
+            _tier_demote_after_days = root["tier_demote_after_days"].asInt();
+            _tier_promote_access_count = root["tier_promote_access_count"].asInt();
+            _tier_scan_interval = root["tier_scan_interval"].asInt();
+            _tier_migrate_rate = root["tier_migrate_rate"].asInt64();
+            _pack_enable = root["pack_enable"].asBool();
+            _pack_max_file_size = root["pack_max_file_size"].asInt64();
+            _pack_dir = root["pack_dir"].asString();
+            _pack_file_size = root["pack_file_size"].asInt64();
+            _pack_compact_ratio = root["pack_compact_ratio"].asDouble();
+            _pack_compact_interval = root["pack_compact_interval"].asInt();
+            _metadata_checkpoint_size = root["metadata_checkpoint_size"].asInt64();
+            _data_manager_shard_count = root["data_manager_shard_count"].asInt();
             return true;
         }
 
@@ -91,6 +172,43 @@ namespace cloud_backup
         size_t _per_handle_request_size;    // 每次处理请求的最大字节数
         std::string _data_manager_filepath; // 数据管理器文件路径，存储所有备份文件的属性信息
         std::string _backup_file_dir;       // 备份文件存储目录
+        int _compress_level;                // 响应压缩使用的zlib压缩级别，取值1~9
+        long long _compress_min_size;       // 响应body达到该字节数才进行压缩
+        std::vector<std::string> _compress_download_extensions; // 下载时需要压缩的文件扩展名(小写，带'.')，为空表示下载不压缩
+        size_t _stream_chunk_size;              // 流式生成的响应每次生成的chunk大小
+        size_t _response_buffer_high_watermark; // 发送缓冲区积压超过该字节数时暂停文件发送和流式生成，等待发送缓冲区排空
+        std::string _upload_staging_dir;        // 可续传上传会话的暂存目录，存放未完成的文件和会话信息
+        int64_t _upload_session_expire_seconds; // 可续传上传会话在没有新数据写入后的过期时间，单位为秒
+        int64_t _multipart_min_part_size;       // 分片上传中除最后一片外每片的最小字节数
+        int _multipart_max_part_count;          // 分片上传允许的最大分片数
+        bool _dedup_enable;                     // 是否将上传完成的文件切分成内容定义的块去重存储
+        std::string _dedup_chunk_dir;           // 去重存储的块目录，块按SHA-256摘要命名
+        size_t _dedup_min_chunk_size;           // 内容定义分块的最小块大小
+        size_t _dedup_avg_chunk_size;           // 内容定义分块的期望平均块大小，需要是2的幂
+        size_t _dedup_max_chunk_size;           // 内容定义分块的最大块大小
+        bool _compress_at_rest_enable;          // 是否将上传完成的文件分帧压缩后存储(开启去重存储时优先去重)
+        int64_t _compress_at_rest_frame_size;   // 静态压缩每帧解压后的大小，Range读取时最多多解压一帧
+        int64_t _delta_block_size;              // 增量上传的块签名默认使用的块大小
+        int _durable_commit_latency_ms;         // 上传落盘的组提交窗口，单位为毫秒，越大每次落盘合并的上传越多但单次上传的确认越慢
+        size_t _durable_commit_max_batch;       // 一次组提交最多合并的上传数
+        int64_t _large_file_threshold;          // 达到该字节数的文件按large_file_io_mode读写，不超过0表示不区分大文件
+        std::string _large_file_io_mode;        // 大文件的读写方式: "buffered"普通读写，"fadvise"读写后丢弃页缓存，"direct"使用O_DIRECT
+        size_t _fd_cache_capacity;              // 下载和读取去重块时缓存的只读文件描述符数量，为0时不缓存
+        size_t _download_read_ahead_depth;      // 每个下载在发送当前段的同时最多提前读取的段数(每段max_file_read_size字节)，为0时不预读
+        size_t _read_ahead_threads_size;        // 执行下载预读的I/O线程数量
+        std::string _cold_storage_dir;          // 冷存储层的目录，为空时不分层，所有文件都保存在backup_file_dir中
+        int _tier_demote_after_days;            // 文件超过这么多天没有被下载(从未下载过的按上传时间计算)时降级到冷存储层
+        int _tier_promote_access_count;         // 冷存储层的文件连续被下载这么多次(相邻两次间隔不超过一天)后提升回热存储层，为0时不提升
+        int _tier_scan_interval;                // 扫描需要降级的文件的间隔秒数
+        int64_t _tier_migrate_rate;             // 在存储层之间复制文件的限速(字节/秒)，为0时不限速
+        bool _pack_enable;                      // 是否把小文件追加到包文件中保存，关闭后已保存在包文件中的文件仍然可以读取
+        int64_t _pack_max_file_size;            // 小于该字节数的文件保存到包文件中
+        std::string _pack_dir;                  // 包文件存储目录
+        int64_t _pack_file_size;                // 单个包文件达到该字节数后换一个新的包文件写入
+        double _pack_compact_ratio;             // 包文件中已删除记录的字节数占比达到该值时整理该包文件
+        int _pack_compact_interval;             // 检查需要整理的包文件的间隔秒数
+        int64_t _metadata_checkpoint_size;      // 元数据日志达到该字节数时生成检查点，把所有文件的备份信息写成新的快照并删除旧的日志
+        int _data_manager_shard_count;          // 数据管理器按文件名哈希分成的分片数，每个分片有独立的锁，与LRU缓存无关(LRU由所有分片共用)
     };
 }
 #endif
\ No newline at end of file
@@ -2,32 +2,63 @@
 #define CLOUD_BACKUP_DATA_MANAGER_HPP
 
 #include <shared_mutex>
+#include <atomic>
 #include <condition_variable>
 #include <unordered_set>
 #include "util.hpp"
 #include "config.hpp"
+#include "dedup_store.hpp"
+#include "frame_store.hpp"
+#include "digest.hpp"
+#include "backup_path.hpp"
+#include "group_commit.hpp"
+#include "large_file_io.hpp"
+#include "fd_cache.hpp"
+#include "pack_store.hpp"
+#include "metadata_journal.hpp"
+#include "rcu_map.hpp"
 
 namespace cloud_backup
 {
+    // 备份文件在备份目录中的存储方式
+    enum class FileStorageType
+    {
+        PLAIN,  // 备份目录中直接保存文件内容
+        DEDUP,  // 备份目录中保存的是文件清单，内容以去重块的形式存放在块目录中
+        FRAMES, // 备份目录中保存的是分帧压缩后的文件
+        PACKED, // 文件内容作为一条记录保存在包文件中，备份目录中没有该文件
+    };
     struct BackupInfoNode
     {
         std::string _filename; // 文件名(仅文件名，不含路径)
         int64_t _size;         // 文件大小(单位:字节)
         time_t _time;          // 文件上传完成的时间
+        FileStorageType _storage = FileStorageType::PLAIN;
+        FileDigest _digest;    // 文件内容的校验信息
+        StorageTier _tier = StorageTier::HOT; // 文件当前所在的存储层
+        uint32_t _pack_id = 0;                // 包文件存储的文件所在的包文件编号
+        int64_t _pack_offset = 0;             // 包文件存储的文件内容在包文件中的起始位置
     };
     // 数据管理类的节点，包含文件备份信息和LRU结构的相关属性，二者共用该节点
     struct DataManagerNode
     {
         using ptr = std::shared_ptr<DataManagerNode>;
-        DataManagerNode() {}
+        DataManagerNode() : _id(_next_id.fetch_add(1, std::memory_order_relaxed)) {}
         ~DataManagerNode() {}
 
-        BackupInfoNode _info;      // 文件备份信息
-        std::shared_mutex _rwlock; // 读写锁，保证多线程环境下对当前文件安全访问
+        const uint64_t _id;   // 节点编号，每个节点唯一，不持有节点时用来确认文件的当前版本是否仍是之前看到的那个
+        BackupInfoNode _info; // 文件备份信息
 
-        std::string _file_pre_content;    // 文件起始的部分内容，作为LRU缓存中的Value值(用于快速响应下载的需求)
+        std::atomic<bool> _is_retired = false; // 节点已被替换、迁移或删除，其记录的存储位置可能已属于文件的其他版本，设置后等待EpochReclaimer的宽限期再改动存储
+        std::atomic<time_t> _last_access = 0;  // 最近一次被下载的时间，为0表示上传后还没有被下载过
+        std::atomic<int> _access_streak = 0;  // 在冷存储层时连续被下载的次数，相邻两次下载间隔过久时重新计数
+
+        std::shared_ptr<const std::string> _file_pre_content; // 文件起始的部分内容，作为LRU缓存中的Value值(用于快速响应下载的需求)
         DataManagerNode *_next = nullptr; // 链表指针，指向下一个节点
         DataManagerNode *_prev = nullptr; // 链表指针，指向上一个节点
+
+    private:
+        inline static std::atomic<uint64_t> _next_id = 1;
     };
 
     // DataManager类是用于记录所有存储到云端的备份文件属性信息的单例类
@@ -58,7 +89,7 @@ namespace cloud_backup
                 while (current != _guard)
                 {
                     DataManagerNode *next_node = current->_next;
-                    current->_file_pre_content.clear();
+                    current->_file_pre_content.reset();
                     current->_prev = nullptr;
                     current->_next = nullptr;
                     current = next_node;
@@ -81,11 +112,11 @@ namespace cloud_backup
                 return true;
             }
             // 将不在链表中的节点插入链表头
-            bool PushToHead(DataManagerNode *node, const std::string &file_pre_content)
+            bool PushToHead(DataManagerNode *node, std::shared_ptr<const std::string> file_pre_content)
             {
                 if (node == nullptr || node->_next != nullptr || node->_prev != nullptr)
                     return false;
-                node->_file_pre_content = file_pre_content;
+                node->_file_pre_content = std::move(file_pre_content);
 
                 node->_next = _guard->_next;
                 node->_prev = _guard;
@@ -104,7 +135,7 @@ namespace cloud_backup
                     return true;
                 node->_prev->_next = node->_next;
                 node->_next->_prev = node->_prev;
-                node->_file_pre_content.clear();
+                node->_file_pre_content.reset();
                 node->_prev = nullptr;
                 node->_next = nullptr;
                 _size--;
@@ -118,50 +149,65 @@ namespace cloud_backup
                 return Remove(_guard->_prev);
             }
         };
+        // 按文件名哈希划分的一个分片，每个分片有独立的hash表和读写锁，不同分片中的文件的操作互不竞争
+        // 已上传成功的文件同时发布到_published中，下载查找文件时不加锁，修改时在写锁下与_hash一起更新
+        struct DataManagerShard
+        {
+            std::unordered_map<std::string, DataManagerNode::ptr> _hash; // 分片内文件名到文件属性信息的映射(包括已注册未上传的文件)
+            RcuMap<DataManagerNode::ptr> _published;                     // 已上传成功的文件，读取不加锁
+            std::shared_mutex _rwlock;                                   // 读写锁，保证多线程环境下对_hash的安全访问和对_published的串行修改
+        };
 
     public:
         using ptr = std::shared_ptr<DataManager>;
         ~DataManager() { _file_storage_thread.join(); }
-        // 向文件管理对象中注册一个将要上传的文件，如果文件不存在会在磁盘的对应目录下创建该文件，如果文件存在会清空文件，后序不允许同名文件的注册
+        // 向文件管理对象中注册一个将要上传的文件，并在上传临时目录中创建(或清空)该文件的临时文件，上传的内容写入临时文件，后序不允许同名文件的注册
         bool Register(const std::string &filename)
         {
-            std::unique_lock<std::shared_mutex> write_lock(_rwlock);
-            if (_hash.find(filename) != _hash.end())
+            DataManagerShard &shard = GetShard(filename);
             {
-                LOG_INFO("Register error, file already register: %s", filename.c_str());
-                return false;
+                std::unique_lock<std::shared_mutex> write_lock(shard._rwlock);
+                if (shard._hash.find(filename) != shard._hash.end())
+                {
+                    LOG_INFO("Register error, file already register: %s", filename.c_str());
+                    return false;
+                }
+                if (!FileUtil::check_filename(filename))
+                    return false;
+                shard._hash[filename] = nullptr;
             }
-            if (!FileUtil::check_filename(filename))
-                return false;
-            std::string target_file_dir = Config::GetInstance()->GetBackupFileDir();
-            if (target_file_dir.back() != '/')
-                target_file_dir += '/';
-            FileUtil target_file(target_file_dir + filename);
+            // 文件名已被占用，其他线程不会再访问该临时文件，创建或清空时不需要持有锁，失败时再释放文件名
+            bool ret_value = true;
+            FileUtil target_file(BackupPathResolver::UploadingPath(filename));
             if (target_file.Exists() && target_file.Clear() == false)
             {
                 LOG_WARN("Register error, file already exists, clear file fail: %s", filename.c_str());
-                return false;
+                ret_value = false;
             }
             else if (!target_file.Exists() && !target_file.AppendContent(""))
             {
                 LOG_WARN("Register error, create target file failed: %s", filename.c_str());
-                return false;
+                ret_value = false;
             }
-            _hash[filename] = nullptr;
-            return true;
+            if (!ret_value)
+            {
+                std::unique_lock<std::shared_mutex> write_lock(shard._rwlock);
+                shard._hash.erase(filename);
+            }
+            return ret_value;
         }
-        // 注销一个文件备份信息，文件名必须是之前已经注册过并且未上传成功的，如果文件此时依然存在于磁盘上会同步将磁盘上的文件删除
+        // 注销一个文件备份信息，文件名必须是之前已经注册过并且未上传成功的，如果文件的临时文件此时依然存在会同步将其删除
         bool Deregister(const std::string &filename)
         {
-            std::unique_lock<std::shared_mutex> write_lock(_rwlock);
-            if (_hash.find(filename) == _hash.end())
-                LOG_WARN("Deregister error, file not found: %s", filename.c_str());
-            else
-                _hash.erase(filename);
-            std::string target_file_dir = Config::GetInstance()->GetBackupFileDir();
-            if (target_file_dir.back() != '/')
-                target_file_dir += '/';
-            FileUtil target_file(target_file_dir + filename);
+            {
+                DataManagerShard &shard = GetShard(filename);
+                std::unique_lock<std::shared_mutex> write_lock(shard._rwlock);
+                if (shard._hash.find(filename) == shard._hash.end())
+                    LOG_WARN("Deregister error, file not found: %s", filename.c_str());
+                else
+                    shard._hash.erase(filename);
+            }
+            FileUtil target_file(BackupPathResolver::UploadingPath(filename));
             if (target_file.Exists() && target_file.RemoveRegularFile() == false)
             {
                 LOG_ERROR("Deregister error, file:%s RemoveRegularFile failed", filename.c_str());
@@ -169,16 +215,55 @@ namespace cloud_backup
             }
             return true;
         }
-        // 将上传成功的文件加入DataManager中管理，文件必须在之前已经通过Register注册过
-        bool Insert(const std::string &filename, int64_t filesize)
+        // 将上传成功的文件加入DataManager中管理，文件必须在之前已经通过Register注册过，内容已完整写入临时文件
+        // 加入前会按配置转换文件的存储方式，再经过组提交落盘后改名移入备份目录(足够小的文件按配置追加到包文件中)，返回true时文件已经持久化
+        // digest为上传时边接收边计算的校验信息，为空时在加入前读取整个文件计算
+        bool Insert(const std::string &filename, int64_t filesize, const FileDigest *digest = nullptr)
         {
-            std::unique_lock<std::shared_mutex> write_lock(_rwlock);
-            if (_hash.find(filename) == _hash.end())
+            DataManagerShard &shard = GetShard(filename);
+            {
+                std::shared_lock<std::shared_mutex> read_lock(shard._rwlock);
+                auto it = shard._hash.find(filename);
+                if (it == shard._hash.end() || it->second != nullptr)
+                {
+                    LOG_WARN("Insert error, file not registered or already exist: %s", filename.c_str());
+                    return false;
+                }
+            }
+            // 文件名已注册但还未加入，其他线程不会访问该文件，计算校验信息、转换存储方式和等待落盘时都不需要持有锁
+            std::string uploading_path = BackupPathResolver::UploadingPath(filename);
+            BackupInfoNode info;
+            info._filename = filename;
+            info._size = filesize;
+            if (!GetDigest(uploading_path, digest, &info._digest))
+                return false;
+            if (!PackFile(uploading_path, &info))
+            {
+                info._storage = ConvertStorage(uploading_path);
+                if (!CommitFile(filename, uploading_path, filesize, info._storage))
+                {
+                    if (info._storage == FileStorageType::DEDUP)
+                        DedupStore::GetInstance()->ReleaseFile(uploading_path);
+                    return false;
+                }
+                FdCache::GetInstance()->Invalidate(BackupPathResolver::FilePath(filename));
+            }
+            std::unique_lock<std::shared_mutex> write_lock(shard._rwlock);
+            if (shard._hash.find(filename) == shard._hash.end())
             {
                 LOG_WARN("Insert error, file not registered: %s", filename.c_str());
+                if (info._storage == FileStorageType::PACKED)
+                    PackStore::GetInstance()->Release(filename, info._pack_id, filesize);
+                else
+                {
+                    if (info._storage == FileStorageType::DEDUP)
+                        DedupStore::GetInstance()->ReleaseFile(BackupPathResolver::FilePath(filename));
+                    unlink(BackupPathResolver::FilePath(filename).c_str());
+                    FdCache::GetInstance()->Invalidate(BackupPathResolver::FilePath(filename));
+                }
                 return false;
             }
-            if (_hash[filename] != nullptr)
+            if (shard._hash[filename] != nullptr)
             {
                 LOG_WARN("Insert error, file is exist: %s", filename.c_str());
                 return false;
@@ -189,125 +274,383 @@ namespace cloud_backup
                 LOG_FATAL("Register error, create DataManagerNode failed");
                 return false;
             }
-            new_node->_info._filename = filename;
-            new_node->_info._size = filesize;
+            new_node->_info = std::move(info);
             new_node->_info._time = time(nullptr);
-            _hash[filename] = new_node;
-            _is_dirty = true;
-            _file_storage_cond.notify_all();
+            shard._hash[filename] = new_node;
+            shard._published.Set(filename, new_node);
+            _version++;
+            bool is_journaled = JournalPut(*new_node);
+            write_lock.unlock();
+            // 文件已经生效，记录没能写入日志时已经请求检查点把它写入快照
+            if (!is_journaled || !_journal.Sync())
+                LOG_ERROR("Insert error, persist record of file:%s failed", filename.c_str());
             return true;
         }
-        // 从DataManager中删除文件备份信息的记录，并同步清除LRU中的数据，如果文件此时依然存在于磁盘上会同步将磁盘上的文件删除，文件必须是之前已经Insert过上传成功的
-        bool Delete(const std::string &filename)
+        // 用filepath处已完整写入的新文件替换一个已上传成功的文件的内容，替换后文件的上传时间更新为当前时间
+        // 新文件会先按配置转换存储方式并落盘再移入备份目录，正在读取旧文件的下载不受影响，失败时旧文件保持不变
+        bool Replace(const std::string &filename, const std::string &filepath, int64_t filesize, const FileDigest *digest = nullptr)
         {
-            std::unique_lock<std::shared_mutex> write_lock(_rwlock);
-            if (IsValidFile(filename) == false)
-            {
-                LOG_WARN("Delete error, file not valid: %s", filename.c_str());
+            BackupInfoNode info;
+            info._filename = filename;
+            info._size = filesize;
+            if (!GetDigest(filepath, digest, &info._digest))
                 return false;
+            bool is_packed = PackFile(filepath, &info);
+            if (!is_packed)
+            {
+                info._storage = ConvertStorage(filepath);
+                if (!SyncStoredFile(filepath, info._storage))
+                {
+                    LOG_ERROR("Replace error, sync file:%s failed", filename.c_str());
+                    if (info._storage == FileStorageType::DEDUP)
+                        DedupStore::GetInstance()->ReleaseFile(filepath);
+                    return false;
+                }
+                if (LargeFileIO::ModeFor(filesize) != LargeFileIOMode::BUFFERED)
+                    LargeFileIO::DropFileCache(filepath);
+                // 新建分片目录时需要等待其落盘，在加锁之前完成
+                if (!BackupPathResolver::PrepareFilePath(filename))
+                {
+                    if (info._storage == FileStorageType::DEDUP)
+                        DedupStore::GetInstance()->ReleaseFile(filepath);
+                    return false;
+                }
             }
-            std::unique_lock<std::mutex> list_lock(_list_mutex);
-            if (_list.Remove(_hash[filename].get()) == false)
             {
-                LOG_ERROR("Delete error, file: %s Remove failed From LRU", filename.c_str());
+                DataManagerShard &shard = GetShard(filename);
+                std::unique_lock<std::shared_mutex> write_lock(shard._rwlock);
+                if (IsValidFile(shard, filename) == false)
+                {
+                    LOG_WARN("Replace error, file not valid: %s", filename.c_str());
+                    if (is_packed)
+                        PackStore::GetInstance()->Release(filename, info._pack_id, filesize);
+                    else if (info._storage == FileStorageType::DEDUP)
+                        DedupStore::GetInstance()->ReleaseFile(filepath);
+                    return false;
+                }
+                DataManagerNode::ptr old_node = shard._hash[filename];
+                DataManagerNode::ptr new_node(new DataManagerNode);
+                new_node->_info = std::move(info);
+                new_node->_info._time = time(nullptr);
+                {
+                    // 新内容总是写入热存储层或包文件，旧文件没有被改名覆盖时(在冷存储层或新内容保存在包文件中)改名后再删除
+                    const BackupInfoNode &old_info = old_node->_info;
+                    RetireNode(old_node);
+                    std::string old_path = BackupPathResolver::FilePath(filename, old_info._tier);
+                    DedupManifest::ptr old_manifest;
+                    if (old_info._storage == FileStorageType::DEDUP)
+                        old_manifest = DedupStore::GetInstance()->LoadManifest(old_path);
+                    if (!is_packed)
+                    {
+                        if (rename(filepath.c_str(), BackupPathResolver::FilePath(filename).c_str()) == -1)
+                        {
+                            LOG_ERROR("Replace error, rename file:%s error:%d message:%s", filename.c_str(), errno, strerror(errno));
+                            old_node->_is_retired = false;
+                            if (new_node->_info._storage == FileStorageType::DEDUP)
+                                DedupStore::GetInstance()->ReleaseFile(filepath);
+                            return false;
+                        }
+                        FdCache::GetInstance()->Invalidate(BackupPathResolver::FilePath(filename));
+                    }
+                    if (old_info._storage == FileStorageType::PACKED)
+                        PackStore::GetInstance()->Release(filename, old_info._pack_id, old_info._size);
+                    else if (is_packed || old_info._tier != StorageTier::HOT)
+                    {
+                        if (unlink(old_path.c_str()) == -1)
+                            LOG_WARN("Replace error, remove old file:%s error:%d message:%s", old_path.c_str(), errno, strerror(errno));
+                        FdCache::GetInstance()->Invalidate(old_path);
+                    }
+                    if (old_manifest != nullptr)
+                        DedupStore::GetInstance()->ReleaseManifest(old_manifest);
+                }
+                {
+                    std::unique_lock<std::mutex> list_lock(_list_mutex);
+                    _list.Remove(old_node.get());
+                }
+                shard._hash[filename] = new_node;
+                shard._published.Set(filename, new_node);
+                _version++;
+                JournalPut(*new_node);
+            }
+            // 替换已经生效，改名或记录没能落盘时重启后可能回到旧版本，但不会出现不完整的文件
+            if (!is_packed && !GroupCommitter::GetInstance()->Sync({BackupPathResolver::FilePath(filename)}))
+                LOG_ERROR("Replace error, sync rename of file:%s failed", filename.c_str());
+            else if (!_journal.Sync())
+                LOG_ERROR("Replace error, sync record of file:%s failed", filename.c_str());
+            return true;
+        }
+        // 将文件迁移到另一个存储层，staging_path是已在目标层的迁移临时目录中复制完成的文件内容
+        // 只有node仍是文件的当前版本时才会生效，复制期间文件被删除或替换时返回false，由调用者删除临时文件
+        // 改名移入目标层后用新节点替换旧节点，正在读取旧位置的下载不受影响，旧位置的文件在新位置落盘后才删除
+        bool MoveTier(const DataManagerNode::ptr &node, const std::string &staging_path, StorageTier tier)
+        {
+            const std::string &filename = node->_info._filename;
+            if (!GroupCommitter::GetInstance()->Sync({staging_path}))
+            {
+                LOG_ERROR("MoveTier error, sync file:%s failed", filename.c_str());
+                return false;
+            }
+            std::string old_path = BackupPathResolver::FilePath(filename, node->_info._tier);
+            std::string new_path = BackupPathResolver::FilePath(filename, tier);
+            if (!BackupPathResolver::PrepareFilePath(filename, tier))
                 return false;
+            {
+                DataManagerShard &shard = GetShard(filename);
+                std::unique_lock<std::shared_mutex> write_lock(shard._rwlock);
+                auto it = shard._hash.find(filename);
+                if (it == shard._hash.end() || it->second != node)
+                {
+                    LOG_INFO("MoveTier cancelled, file:%s was deleted or replaced", filename.c_str());
+                    return false;
+                }
+                if (rename(staging_path.c_str(), new_path.c_str()) == -1)
+                {
+                    LOG_ERROR("MoveTier error, rename file:%s error:%d message:%s", filename.c_str(), errno, strerror(errno));
+                    return false;
+                }
+                FdCache::GetInstance()->Invalidate(new_path);
+                DataManagerNode::ptr new_node(new DataManagerNode);
+                new_node->_info = node->_info;
+                new_node->_info._tier = tier;
+                new_node->_last_access = node->_last_access.load();
+                RetireNode(node);
+                {
+                    // 缓存的文件起始内容与存储层无关，转移到新节点上
+                    std::unique_lock<std::mutex> list_lock(_list_mutex);
+                    if (node->_next != nullptr && node->_prev != nullptr)
+                    {
+                        std::shared_ptr<const std::string> file_pre_content = node->_file_pre_content;
+                        _list.Remove(node.get());
+                        _list.PushToHead(new_node.get(), std::move(file_pre_content));
+                    }
+                }
+                it->second = new_node;
+                shard._published.Set(it->first, new_node);
+                JournalPut(*new_node);
+            }
+            // 改名或记录没能落盘时保留旧位置的文件，重启后以记录的存储层为准清理多余的一份(日志和新位置在同一个文件系统中时共享一次落盘)
+            if (!GroupCommitter::GetInstance()->Sync({new_path}) || !_journal.Sync())
+            {
+                LOG_ERROR("MoveTier error, sync rename of file:%s failed", filename.c_str());
+                return true;
+            }
+            if (unlink(old_path.c_str()) == -1)
+                LOG_WARN("MoveTier error, remove old file:%s error:%d message:%s", old_path.c_str(), errno, strerror(errno));
+            FdCache::GetInstance()->Invalidate(old_path);
+            return true;
+        }
+        // 把包文件存储的文件的索引指向其记录被整理后的新位置，新位置的记录需要已经落盘
+        // 只有node仍是文件的当前版本时才会生效，整理期间文件被删除或替换时返回false，由调用者释放新位置的记录
+        bool RelocatePacked(const DataManagerNode::ptr &node, uint32_t pack_id, int64_t pack_offset)
+        {
+            const BackupInfoNode &old_info = node->_info;
+            {
+                DataManagerShard &shard = GetShard(old_info._filename);
+                std::unique_lock<std::shared_mutex> write_lock(shard._rwlock);
+                auto it = shard._hash.find(old_info._filename);
+                if (it == shard._hash.end() || it->second != node)
+                {
+                    LOG_INFO("RelocatePacked cancelled, file:%s was deleted or replaced", old_info._filename.c_str());
+                    return false;
+                }
+                DataManagerNode::ptr new_node(new DataManagerNode);
+                new_node->_info = old_info;
+                new_node->_info._pack_id = pack_id;
+                new_node->_info._pack_offset = pack_offset;
+                new_node->_last_access = node->_last_access.load();
+                RetireNode(node);
+                {
+                    std::unique_lock<std::mutex> list_lock(_list_mutex);
+                    if (node->_next != nullptr && node->_prev != nullptr)
+                    {
+                        std::shared_ptr<const std::string> file_pre_content = node->_file_pre_content;
+                        _list.Remove(node.get());
+                        _list.PushToHead(new_node.get(), std::move(file_pre_content));
+                    }
+                }
+                it->second = new_node;
+                shard._published.Set(it->first, new_node);
+                JournalPut(*new_node);
+            }
+            // 新位置的记录落盘前不释放旧记录，重启后仍可以从旧位置读取
+            if (!_journal.Sync())
+            {
+                LOG_ERROR("RelocatePacked error, sync record of file:%s failed", old_info._filename.c_str());
+                return true;
+            }
+            // 正在读取旧位置的下载持有包文件的描述符，旧记录所在的包文件被删除也不受影响
+            PackStore::GetInstance()->Release(old_info._filename, old_info._pack_id, old_info._size);
+            return true;
+        }
+        // 从DataManager中删除文件备份信息的记录，并同步清除LRU中的数据，如果文件此时依然存在于磁盘上会同步将磁盘上的文件删除，文件必须是之前已经Insert过上传成功的
+        bool Delete(const std::string &filename)
+        {
+            DataManagerShard &shard = GetShard(filename);
+            DataManagerNode::ptr node;
+            {
+                std::unique_lock<std::shared_mutex> write_lock(shard._rwlock);
+                if (IsValidFile(shard, filename) == false)
+                {
+                    LOG_WARN("Delete error, file not valid: %s", filename.c_str());
+                    return false;
+                }
+                node = shard._hash[filename];
+                {
+                    std::unique_lock<std::mutex> list_lock(_list_mutex);
+                    if (_list.Remove(node.get()) == false)
+                    {
+                        LOG_ERROR("Delete error, file: %s Remove failed From LRU", filename.c_str());
+                        return false;
+                    }
+                }
+                // 文件名先保留为已注册未上传的状态，删除磁盘上的文件时不持有锁，期间该文件的下载和同名文件的注册都会失败
+                shard._hash[filename] = nullptr;
+                shard._published.Erase(filename);
+                _version++;
+                JournalDelete(filename);
             }
-            std::string target_file_dir = Config::GetInstance()->GetBackupFileDir();
-            if (target_file_dir.back() != '/')
-                target_file_dir += '/';
             bool ret_value = true;
-            FileUtil target_file(target_file_dir + filename);
+            FileUtil target_file(BackupPathResolver::FilePath(filename, node->_info._tier));
+            RetireNode(node);
+            if (node->_info._storage == FileStorageType::PACKED)
+                PackStore::GetInstance()->Release(filename, node->_info._pack_id, node->_info._size);
+            else
             {
-                std::unique_lock<std::shared_mutex> file_write_lock(_hash[filename]->_rwlock);
+                if (node->_info._storage == FileStorageType::DEDUP && !DedupStore::GetInstance()->ReleaseFile(target_file.GetFilePath()))
+                    LOG_ERROR("delete target file:%s error, release dedup chunks failed", filename.c_str());
                 if (target_file.Exists() && target_file.RemoveRegularFile() == false)
                 {
                     LOG_ERROR("delete target file:%s failed, RemoveRegularFile failed", filename.c_str());
                     ret_value = false;
                 }
+                FdCache::GetInstance()->Invalidate(target_file.GetFilePath());
             }
-            _hash.erase(filename);
-            _is_dirty = true;
-            _file_storage_cond.notify_all();
+            {
+                std::unique_lock<std::shared_mutex> write_lock(shard._rwlock);
+                auto it = shard._hash.find(filename);
+                if (it != shard._hash.end() && it->second == nullptr)
+                    shard._hash.erase(it);
+            }
+            if (!_journal.Sync())
+                LOG_ERROR("Delete error, sync record of file:%s failed", filename.c_str());
             return ret_value;
         }
         // 根据文件名获取文件管理信息节点，失败返回nullptr，因为返回的是智能指针所以即使DataManager内部的数据被清理掉了也不会导致非法访问
+        // 只在已发布的文件中查找一次，不加锁，与修改并发时返回修改前或修改后的节点，返回时拷贝一次智能指针
         DataManagerNode::ptr GetFileInfoNode(const std::string &filename)
         {
-            std::shared_lock<std::shared_mutex> read_lock(_rwlock);
-            if (IsValidFile(filename) == false)
+            EpochReclaimer::Guard guard;
+            const DataManagerNode::ptr *node = FindFileInfoNode(filename);
+            if (node == nullptr)
             {
                 LOG_WARN("GetFileReadPermit error, file not valid: %s", filename.c_str());
                 return nullptr;
             }
-            return _hash[filename];
+            return *node;
         }
-        // 从数据管理器中获取所有的文件备份属性信息
+        // 在调用者持有的EpochReclaimer::Guard内查找文件的当前节点，不拷贝智能指针，返回的指针只在该Guard内有效，文件不存在时返回nullptr
+        // Guard内的节点可能随时被替换但不会被释放，Guard内看到节点还没有被标记失效时，其记录的存储位置在Guard退出之前不会被改动
+        const DataManagerNode::ptr *FindFileInfoNode(const std::string &filename)
+        {
+            return GetShard(filename)._published.Find(filename);
+        }
+        // 从数据管理器中获取所有的文件备份属性信息，逐个分片加读锁复制，不会同时阻塞所有分片的修改
         bool GetAllBackupInfo(std::vector<BackupInfoNode> *infos)
         {
             infos->clear();
-            std::shared_lock<std::shared_mutex> read_lock(_rwlock);
-            infos->reserve(_hash.size());
-            for (auto &[filename, node] : _hash)
+            for (auto &shard : _shards)
             {
-                if (node != nullptr)
+                std::shared_lock<std::shared_mutex> read_lock(shard->_rwlock);
+                for (auto &[filename, node] : shard->_hash)
                 {
+                    if (node == nullptr)
+                        continue;
                     BackupInfoNode info;
                     info._filename = node->_info._filename;
                     info._size = node->_info._size;
                     info._time = node->_info._time;
+                    info._storage = node->_info._storage;
+                    info._digest = node->_info._digest;
+                    info._tier = node->_info._tier;
+                    info._pack_id = node->_info._pack_id;
+                    info._pack_offset = node->_info._pack_offset;
                     infos->push_back(info);
                 }
             }
             return true;
         }
-        // 快速获取指定文件的的大小
+        // 获取所有已上传成功文件的节点指针快照，节点在Insert后不再修改，调用者可以在不持有锁的情况下逐个读取其备份信息
+        void GetAllFileInfoNodes(std::vector<DataManagerNode::ptr> *nodes)
+        {
+            nodes->clear();
+            for (auto &shard : _shards)
+            {
+                std::shared_lock<std::shared_mutex> read_lock(shard->_rwlock);
+                for (auto &[filename, node] : shard->_hash)
+                    if (node != nullptr)
+                        nodes->push_back(node);
+            }
+        }
+        // 获取文件备份信息的版本号，每次有文件加入或删除时版本号都会递增，可用于判断文件列表是否发生过变化
+        uint64_t GetVersion() { return _version; }
+        // 获取DataManager的加载时间，与版本号一起唯一标识一个版本的文件列表(重启后版本号会从0开始重新计数)
+        time_t GetLoadTime() { return _load_time; }
+        // 下载只更新节点中的最近下载时间而不写入日志，由TierMover定期调用生成一次检查点将其写入快照
+        void SaveAccessTimes() { RequestCheckpoint(); }
+        // 快速获取指定文件的的大小，在Guard内直接读取节点，不拷贝智能指针
         uint64_t GetFileSize(const std::string &filename)
         {
-            std::shared_lock<std::shared_mutex> read_lock(_rwlock);
-            if (IsValidFile(filename) == false)
+            EpochReclaimer::Guard guard;
+            const DataManagerNode::ptr *node = FindFileInfoNode(filename);
+            if (node == nullptr)
             {
                 LOG_WARN("GetFileSize error, file not valid: %s", filename.c_str());
                 return -1;
             }
-            return _hash[filename]->_info._size;
+            return (*node)->_info._size;
         }
-        // 尝试从LRU中获取文件起始的部分内容，失败返回空串
-        std::string GetFilePreContent(const std::string &filename)
+        // 尝试从LRU中获取文件编号为node_id的版本的起始部分内容，返回的内容与LRU共享不会拷贝，文件已被替换、删除或不在LRU中时返回nullptr
+        // 在Guard内查找节点，不持有节点的引用计数，节点只有在是文件的当前版本时才会在链表中，被替换或删除时在链表锁下移出
+        std::shared_ptr<const std::string> GetFilePreContent(const std::string &filename, uint64_t node_id)
         {
-            std::shared_lock<std::shared_mutex> read_lock(_rwlock);
-            if (IsValidFile(filename) == false)
-            {
-                LOG_WARN("GetFilePreContent error, file not valid: %s", filename.c_str());
-                return "";
-            }
+            EpochReclaimer::Guard guard;
+            const DataManagerNode::ptr *node = FindFileInfoNode(filename);
+            if (node == nullptr || (*node)->_id != node_id)
+                return nullptr;
             std::unique_lock<std::mutex> list_lock(_list_mutex);
-            if (_hash[filename]->_next == nullptr || _hash[filename]->_prev == nullptr)
+            if ((*node)->_next == nullptr || (*node)->_prev == nullptr)
             {
                 LOG_INFO("GetFilePreContent error, file not in LRU list: %s", filename.c_str());
-                return "";
+                return nullptr;
             }
-            if (_list.MoveToHead(_hash[filename].get()) == false)
+            if (_list.MoveToHead(node->get()) == false)
             {
                 LOG_ERROR("GetFilePreContent error, MoveToHead failed for file: %s", filename.c_str());
-                return "";
+                return nullptr;
             }
-            return _hash[filename]->_file_pre_content;
+            return (*node)->_file_pre_content;
         }
-        // 将文件起始的部分内容放入LRU中缓存，如果已经存在则将其更新为最近一次访问的数据
-        bool PutFilePreContent(const std::string &filename, std::string file_pre_content)
+        // 将文件编号为node_id的版本的起始部分内容放入LRU中缓存，如果已经存在则将其更新为最近一次访问的数据，内容以共享的方式存放，仅在超出缓存大小时才截断拷贝
+        // 在分片的读锁下确认该版本仍是文件的当前版本，旧版本的下载不会把旧内容放进新版本的缓存
+        bool PutFilePreContent(const std::string &filename, uint64_t node_id, std::shared_ptr<const std::string> file_pre_content)
         {
-            if (file_pre_content.size() > Config::GetInstance()->GetLRUFileContentSize())
-                file_pre_content = file_pre_content.substr(0, Config::GetInstance()->GetLRUFileContentSize());
-            std::shared_lock<std::shared_mutex> read_lock(_rwlock);
-            if (IsValidFile(filename) == false)
-            {
-                LOG_WARN("PutFilePreContent error, file not valid: %s", filename.c_str());
+            if (file_pre_content == nullptr)
                 return false;
+            if (file_pre_content->size() > Config::GetInstance()->GetLRUFileContentSize())
+                file_pre_content = std::make_shared<const std::string>(file_pre_content->substr(0, Config::GetInstance()->GetLRUFileContentSize()));
+            DataManagerShard &shard = GetShard(filename);
+            std::shared_lock<std::shared_mutex> read_lock(shard._rwlock);
+            auto it = shard._hash.find(filename);
+            if (it == shard._hash.end() || it->second == nullptr || it->second->_id != node_id)
+            {
+                LOG_INFO("PutFilePreContent skipped, file:%s was deleted or replaced", filename.c_str());
+                return true;
             }
+            DataManagerNode *node = it->second.get();
             std::unique_lock<std::mutex> list_lock(_list_mutex);
-            if (_hash[filename]->_next == nullptr || _hash[filename]->_prev == nullptr)
+            if (node->_next == nullptr || node->_prev == nullptr)
             {
-                if (_list.PushToHead(_hash[filename].get(), file_pre_content) == false)
+                if (_list.PushToHead(node, file_pre_content) == false)
                 {
                     LOG_ERROR("PutFilePreContent error, PushToHead failed for file: %s", filename.c_str());
                     return false;
@@ -315,7 +658,7 @@ namespace cloud_backup
             }
             else
             {
-                if (_list.MoveToHead(_hash[filename].get()) == false)
+                if (_list.MoveToHead(node) == false)
                 {
                     LOG_ERROR("GetFilePreContent error, MoveToHead failed for file: %s", filename.c_str());
                     return false;
@@ -327,17 +670,49 @@ namespace cloud_backup
     private:
         DataManager(const DataManager &) = delete;
         DataManager &operator=(const DataManager &) = delete;
-        DataManager(const std::string &filepath) : _file(filepath)
+        DataManager(const std::string &filepath) : _file(filepath), _journal(filepath)
         {
             if (!_file.Exists() && !_file.AppendContent("null"))
             {
                 LOG_FATAL("DataManager initialization error, create data manager file failed: %s", filepath.c_str());
                 exit(DATA_MANAGER_INIT_ERROR);
             }
+            size_t shard_count = std::max(Config::GetInstance()->GetDataManagerShardCount(), 1);
+            _shards.reserve(shard_count);
+            for (size_t i = 0; i < shard_count; i++)
+                _shards.push_back(std::make_unique<DataManagerShard>());
             LoadFromFile();
+            size_t record_count = _journal.Replay([this](const std::string &record)
+                                                  { ApplyJournalRecord(record); });
+            LOG_INFO("DataManager replayed %zu journal record", record_count);
+            if (!BackupPathResolver::MigrateFlatLayout())
+            {
+                LOG_FATAL("DataManager initialization error, migrate backup directory to sharded layout failed");
+                exit(DATA_MANAGER_INIT_ERROR);
+            }
+            if (!BackupPathResolver::ClearUploadingDir() || !BackupPathResolver::ClearMigratingDirs())
+            {
+                LOG_FATAL("DataManager initialization error, clear uploading or migrating directory failed");
+                exit(DATA_MANAGER_INIT_ERROR);
+            }
             VerifyFileLegality();
-            _file_storage_thread = std::thread(&DataManager::FileStorageThread, this); // 启动异步文件存储线程
-            LOG_INFO("DataManager initialized successfully, loaded %zu file", _hash.size());
+            RecoverDedupStore();
+            RecoverPackStore();
+            for (auto &shard : _shards)
+                for (auto &[filename, node] : shard->_hash)
+                    shard->_published.Set(filename, node);
+            if (!_journal.Open())
+            {
+                LOG_FATAL("DataManager initialization error, open metadata journal failed");
+                exit(DATA_MANAGER_INIT_ERROR);
+            }
+            // 启动后先生成一次检查点，把快照、重放的日志和校验时的修正合并成新的快照
+            _is_dirty = true;
+            _file_storage_thread = std::thread(&DataManager::FileStorageThread, this); // 启动异步检查点线程
+            size_t file_count = 0;
+            for (auto &shard : _shards)
+                file_count += shard->_hash.size();
+            LOG_INFO("DataManager initialized successfully, loaded %zu file in %zu shard", file_count, _shards.size());
         }
 
         // 从文件中加载数据管理器备份的文件属性信息，初始化时调用
@@ -377,7 +752,22 @@ namespace cloud_backup
                     node->_info._filename = info._filename;
                     node->_info._size = info._size;
                     node->_info._time = info._time;
-                    _hash[info._filename] = node;
+                    if (item["storage"].asString() == "dedup")
+                        node->_info._storage = FileStorageType::DEDUP;
+                    else if (item["storage"].asString() == "frames")
+                        node->_info._storage = FileStorageType::FRAMES;
+                    else if (item["storage"].asString() == "packed")
+                    {
+                        node->_info._storage = FileStorageType::PACKED;
+                        node->_info._pack_id = item["pack"].asUInt();
+                        node->_info._pack_offset = item["offset"].asInt64();
+                    }
+                    node->_info._digest._crc32c = item["crc32c"].asUInt();
+                    node->_info._digest._sha256 = item["sha256"].asString();
+                    if (item["tier"].asString() == "cold")
+                        node->_info._tier = StorageTier::COLD;
+                    node->_last_access = item["atime"].asInt64();
+                    GetShard(info._filename)._hash[info._filename] = node;
                 }
             }
             LOG_INFO("DataManager LoadFromFile Succeed");
@@ -385,65 +775,302 @@ namespace cloud_backup
         //  验证文件的合法性，确保程序在上次退出前保存的文件信息与磁盘上存储的文件都是合法的
         void VerifyFileLegality()
         {
-            std::string backup_file_dir = Config::GetInstance()->GetBackupFileDir();
-            std::vector<FileUtil> files;
-            if (FileUtil(backup_file_dir).ScanDirectory(&files) == false)
+            std::vector<StorageTier> tiers{StorageTier::HOT};
+            if (BackupPathResolver::TieringEnabled())
+                tiers.push_back(StorageTier::COLD);
+            else
             {
-                LOG_ERROR("DataManager initialization error, ScanDirectory failed");
-                return;
+                // 取消冷存储层的配置前需要先把冷存储层的文件迁回，否则这些文件的记录会被当作丢失而删除
+                for (auto &shard : _shards)
+                    for (auto &[filename, node] : shard->_hash)
+                        if (node->_info._tier == StorageTier::COLD)
+                        {
+                            LOG_FATAL("DataManager initialization error, file:%s is in cold storage but cold_storage_dir is not configured", filename.c_str());
+                            exit(DATA_MANAGER_INIT_ERROR);
+                        }
             }
-            std::unordered_set<std::string> backup_files;
-            for (auto &file : files)
+            std::unordered_map<std::string, std::vector<StorageTier>> backup_files; // 文件名到其所在的存储层的映射
+            for (StorageTier tier : tiers)
             {
-                std::string filename = file.GetFileName();
-                if (_hash.find(filename) == _hash.end())
+                std::vector<FileUtil> files;
+                if (BackupPathResolver::ScanFiles(&files, tier) == false)
                 {
-                    LOG_WARN("DataManager file verification error, file not found in DataManager: %s", filename.c_str());
-                    if (file.RemoveRegularFile() == false) // 如果文件不在DataManager中管理，则删除该文件
-                        LOG_WARN("DataManager file verification error, file:%s RemoveRegularFile failed", filename.c_str());
+                    LOG_ERROR("DataManager initialization error, ScanFiles failed");
+                    return;
+                }
+                for (auto &file : files)
+                {
+                    std::string filename = file.GetFileName();
+                    DataManagerShard &shard = GetShard(filename);
+                    auto it = shard._hash.find(filename);
+                    // 包文件存储的文件不应该出现在备份目录中，可能是替换为包文件存储时没能删除的旧文件
+                    if (it == shard._hash.end() || it->second->_info._storage == FileStorageType::PACKED)
+                    {
+                        LOG_WARN("DataManager file verification error, file not found in DataManager: %s", filename.c_str());
+                        if (file.RemoveRegularFile() == false) // 如果文件不在DataManager中管理，则删除该文件
+                            LOG_WARN("DataManager file verification error, file:%s RemoveRegularFile failed", filename.c_str());
+                    }
+                    else
+                        backup_files[filename].push_back(tier);
                 }
-                else
-                    backup_files.insert(filename);
             }
-            // 删除不存在的文件的记录
+            // 删除不存在的文件的记录，迁移存储层中途退出时文件可能同时存在于两层，或者只存在于记录之外的那一层
+            // 以记录的存储层为准删除另一层中多余的一份，记录的层中没有时改用另一层中的文件，包文件存储的文件由RecoverPackStore检查
             std::vector<std::string> not_backeup_files;
-            for (auto &[filename, node] : _hash)
-            {
-                if (backup_files.find(filename) == backup_files.end())
+            for (auto &shard : _shards)
+                for (auto &[filename, node] : shard->_hash)
                 {
-                    LOG_WARN("DataManager file verification error, file not found in backup directory: %s", filename.c_str());
-                    not_backeup_files.push_back(filename);
+                    if (node->_info._storage == FileStorageType::PACKED)
+                        continue;
+                    auto it = backup_files.find(filename);
+                    if (it == backup_files.end())
+                    {
+                        LOG_WARN("DataManager file verification error, file not found in backup directory: %s", filename.c_str());
+                        not_backeup_files.push_back(filename);
+                        continue;
+                    }
+                    if (std::find(it->second.begin(), it->second.end(), node->_info._tier) == it->second.end())
+                    {
+                        LOG_WARN("DataManager file verification error, file:%s not found in its storage tier, use the copy in the other tier", filename.c_str());
+                        node->_info._tier = it->second[0];
+                        _is_dirty = true;
+                    }
+                    for (StorageTier tier : it->second)
+                        if (tier != node->_info._tier && FileUtil(BackupPathResolver::FilePath(filename, tier)).RemoveRegularFile() == false)
+                            LOG_WARN("DataManager file verification error, file:%s RemoveRegularFile failed", filename.c_str());
                 }
-            }
             for (auto &filename : not_backeup_files)
             {
-                _hash.erase(filename);
+                GetShard(filename)._hash.erase(filename);
                 _is_dirty = true;
             }
             LOG_INFO("DataManager VerifyFileLegality Succeed");
         }
-        // 异步文件存储线程执行的函数
+        // 获取文件的校验信息，已经在上传时计算过的直接使用，否则读取整个文件计算
+        static bool GetDigest(const std::string &filepath, const FileDigest *digest, FileDigest *out)
+        {
+            if (digest != nullptr)
+            {
+                *out = *digest;
+                return true;
+            }
+            if (!DigestUtil::ComputeFile(filepath, out))
+            {
+                LOG_ERROR("compute digest of file:%s failed", filepath.c_str());
+                return false;
+            }
+            return true;
+        }
+        // 按配置转换filepath处文件的存储方式: 开启去重存储时切分成块存入块目录，原地只留下文件清单
+        // 否则开启静态压缩时分帧压缩后原地替换，两者都失败或不划算时按原样保存，返回文件最终的存储方式
+        static FileStorageType ConvertStorage(const std::string &filepath)
+        {
+            if (Config::GetInstance()->GetDedupEnable() && DedupStore::GetInstance()->StoreFile(filepath))
+                return FileStorageType::DEDUP;
+            if (Config::GetInstance()->GetCompressAtRestEnable() && FrameStore::CompressFile(filepath))
+                return FileStorageType::FRAMES;
+            return FileStorageType::PLAIN;
+        }
+        // 开启包文件存储且文件足够小时把filepath处的文件追加到包文件中并等待落盘，成功后删除filepath，并在info中记录存储方式和位置
+        // 返回false时filepath保持不变，由调用者按其他存储方式保存
+        static bool PackFile(const std::string &filepath, BackupInfoNode *info)
+        {
+            if (!PackStore::ShouldPack(info->_size) ||
+                !PackStore::GetInstance()->AppendFile(info->_filename, filepath, info->_size, &info->_pack_id, &info->_pack_offset))
+                return false;
+            unlink(filepath.c_str());
+            info->_storage = FileStorageType::PACKED;
+            return true;
+        }
+        // 等待文件内容落盘，去重存储的文件还需要等待其引用的块文件落盘，失败返回false
+        static bool SyncStoredFile(const std::string &filepath, FileStorageType storage)
+        {
+            std::vector<std::string> paths{filepath};
+            if (storage == FileStorageType::DEDUP && !DedupStore::GetInstance()->GetChunkPaths(filepath, &paths))
+                return false;
+            return GroupCommitter::GetInstance()->Sync(paths);
+        }
+        // 等待临时文件的内容落盘后将其改名移入备份目录，再等待改名落盘，保证备份目录中出现的文件总是完整的
+        // 大文件落盘后已没有脏页，按配置丢弃其页缓存，失败时文件仍然留在uploading_path处
+        static bool CommitFile(const std::string &filename, const std::string &uploading_path, int64_t filesize, FileStorageType storage)
+        {
+            if (!SyncStoredFile(uploading_path, storage))
+            {
+                LOG_ERROR("commit file:%s error, sync content failed", filename.c_str());
+                return false;
+            }
+            if (LargeFileIO::ModeFor(filesize) != LargeFileIOMode::BUFFERED)
+                LargeFileIO::DropFileCache(uploading_path);
+            std::string filepath = BackupPathResolver::FilePath(filename);
+            if (!BackupPathResolver::PrepareFilePath(filename) || rename(uploading_path.c_str(), filepath.c_str()) == -1)
+            {
+                LOG_ERROR("commit file:%s error, rename error:%d message:%s", filename.c_str(), errno, strerror(errno));
+                return false;
+            }
+            if (!GroupCommitter::GetInstance()->Sync({filepath}))
+            {
+                LOG_ERROR("commit file:%s error, sync rename failed", filename.c_str());
+                rename(filepath.c_str(), uploading_path.c_str());
+                return false;
+            }
+            return true;
+        }
+        // 根据所有去重存储文件的清单恢复块的引用计数，即使当前关闭了去重存储，之前去重存储的文件也需要能够读取
+        void RecoverDedupStore()
+        {
+            std::vector<std::string> manifest_paths;
+            for (auto &shard : _shards)
+                for (auto &[filename, node] : shard->_hash)
+                    if (node != nullptr && node->_info._storage == FileStorageType::DEDUP)
+                        manifest_paths.push_back(BackupPathResolver::FilePath(filename, node->_info._tier));
+            if (!manifest_paths.empty() || Config::GetInstance()->GetDedupEnable())
+                DedupStore::GetInstance()->Recover(manifest_paths);
+        }
+        // 根据所有包文件存储的文件的索引统计包文件中存活的记录，删除记录已经丢失的文件的索引
+        void RecoverPackStore()
+        {
+            std::vector<PackRecord> records;
+            for (auto &shard : _shards)
+                for (auto &[filename, node] : shard->_hash)
+                    if (node != nullptr && node->_info._storage == FileStorageType::PACKED)
+                        records.push_back({filename, node->_info._pack_id, node->_info._pack_offset, node->_info._size});
+            if (records.empty() && !Config::GetInstance()->GetPackEnable())
+                return;
+            std::vector<std::string> lost;
+            PackStore::GetInstance()->Recover(records, &lost);
+            for (auto &filename : lost)
+            {
+                LOG_WARN("DataManager file verification error, record of file:%s not found in pack store", filename.c_str());
+                GetShard(filename)._hash.erase(filename);
+                _is_dirty = true;
+            }
+        }
+        // 日志记录的内容:
+        //   'P' <文件名> <uint64 大小> <uint64 上传时间> <uint8 存储方式> <uint32 CRC32C> <SHA-256> <uint8 存储层> <uint32 包文件编号> <uint64 包文件偏移> <uint64 最近下载时间>
+        //       文件加入、替换或迁移后的完整备份信息，重放时覆盖同名文件的记录
+        //   'D' <文件名>  删除文件的记录
+        // 以下两个函数需要持有文件所在分片的写锁时调用，同一文件的记录按修改的顺序追加到日志文件，调用者释放锁后通过_journal.Sync()等待落盘
+        // 追加失败时请求一次检查点，由快照保存当前的状态，返回false
+        bool JournalPut(const DataManagerNode &node)
+        {
+            JournalRecordWriter writer;
+            writer.PutUint('P', 1);
+            writer.PutString(node._info._filename);
+            writer.PutUint(node._info._size, 8);
+            writer.PutUint(node._info._time, 8);
+            writer.PutUint(static_cast<uint8_t>(node._info._storage), 1);
+            writer.PutUint(node._info._digest._crc32c, 4);
+            writer.PutString(node._info._digest._sha256);
+            writer.PutUint(static_cast<uint8_t>(node._info._tier), 1);
+            writer.PutUint(node._info._pack_id, 4);
+            writer.PutUint(node._info._pack_offset, 8);
+            writer.PutUint(node._last_access, 8);
+            return AppendJournal(writer.Data());
+        }
+        bool JournalDelete(const std::string &filename)
+        {
+            JournalRecordWriter writer;
+            writer.PutUint('D', 1);
+            writer.PutString(filename);
+            return AppendJournal(writer.Data());
+        }
+        // 日志文件超过metadata_checkpoint_size时请求一次检查点
+        bool AppendJournal(const std::string &record)
+        {
+            int64_t journal_size = _journal.Append(record);
+            if (journal_size < 0 || journal_size >= Config::GetInstance()->GetMetadataCheckpointSize())
+                RequestCheckpoint();
+            return journal_size >= 0;
+        }
+        // 唤醒检查点线程生成一次检查点
+        void RequestCheckpoint()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_file_storage_mutex);
+                _is_dirty = true;
+            }
+            _file_storage_cond.notify_all();
+        }
+        // 重放一条日志记录，初始化时调用
+        void ApplyJournalRecord(const std::string &record)
+        {
+            JournalRecordReader reader(record);
+            uint64_t type, size, time, storage, crc32c, tier, pack_id, pack_offset, last_access;
+            std::string filename;
+            if (!reader.GetUint(1, &type) || !reader.GetString(&filename) || filename.empty())
+            {
+                LOG_WARN("DataManager initialization error, invalid journal record");
+                return;
+            }
+            if (type == 'D')
+            {
+                GetShard(filename)._hash.erase(filename);
+                return;
+            }
+            DataManagerNode::ptr node(new DataManagerNode);
+            if (type != 'P' || !reader.GetUint(8, &size) || !reader.GetUint(8, &time) || !reader.GetUint(1, &storage) ||
+                !reader.GetUint(4, &crc32c) || !reader.GetString(&node->_info._digest._sha256) || !reader.GetUint(1, &tier) ||
+                !reader.GetUint(4, &pack_id) || !reader.GetUint(8, &pack_offset) || !reader.GetUint(8, &last_access))
+            {
+                LOG_WARN("DataManager initialization error, invalid journal record of file:%s", filename.c_str());
+                return;
+            }
+            node->_info._filename = filename;
+            node->_info._size = size;
+            node->_info._time = time;
+            node->_info._storage = static_cast<FileStorageType>(storage);
+            node->_info._digest._crc32c = crc32c;
+            node->_info._tier = static_cast<StorageTier>(tier);
+            node->_info._pack_id = pack_id;
+            node->_info._pack_offset = pack_offset;
+            node->_last_access = last_access;
+            GetShard(filename)._hash[filename] = node;
+        }
+        // 异步检查点线程执行的函数: 先切换到新的日志文件，再把当前所有文件的备份信息写成新的快照，快照改名生效后删除旧的日志文件
+        // 切换之后的修改都在新的日志文件中，快照是否包含这些修改都不影响重放的结果
+        // 切换之前追加的记录都是在分片的写锁下写入的，之后逐个分片加读锁收集节点时一定能看到这些修改，不需要同时锁住所有分片
         void FileStorageThread()
         {
             while (1)
             {
-                Json::Value root;
                 {
-                    std::shared_lock<std::shared_mutex> read_lock(_rwlock);
-                    _file_storage_cond.wait(read_lock, [&]()
+                    std::unique_lock<std::mutex> lock(_file_storage_mutex);
+                    _file_storage_cond.wait(lock, [&]()
                                             { return _is_dirty; });
-                    for (const auto &[filename, node] : _hash)
+                    _is_dirty = false;
+                }
+                uint64_t old_journal_id = 0;
+                bool is_rotated = _journal.Rotate(&old_journal_id);
+                std::vector<DataManagerNode::ptr> nodes;
+                GetAllFileInfoNodes(&nodes);
+                // 节点在加入后不再修改，生成快照时不需要持有锁
+                Json::Value root;
+                for (const auto &node : nodes)
+                {
+                    Json::Value item;
+                    item["filename"] = node->_info._filename;
+                    item["size"] = static_cast<Json::Int64>(node->_info._size);
+                    item["time"] = static_cast<Json::Int64>(node->_info._time);
+                    if (node->_info._storage == FileStorageType::DEDUP)
+                        item["storage"] = "dedup";
+                    else if (node->_info._storage == FileStorageType::FRAMES)
+                        item["storage"] = "frames";
+                    else if (node->_info._storage == FileStorageType::PACKED)
                     {
-                        if (IsValidFile(filename) == true)
-                        {
-                            Json::Value item;
-                            item["filename"] = node->_info._filename;
-                            item["size"] = static_cast<Json::Int64>(node->_info._size);
-                            item["time"] = static_cast<Json::Int64>(node->_info._time);
-                            root.append(item);
-                        }
+                        item["storage"] = "packed";
+                        item["pack"] = node->_info._pack_id;
+                        item["offset"] = static_cast<Json::Int64>(node->_info._pack_offset);
                     }
-                    _is_dirty = false;
+                    if (!node->_info._digest._sha256.empty())
+                    {
+                        item["crc32c"] = node->_info._digest._crc32c;
+                        item["sha256"] = node->_info._digest._sha256;
+                    }
+                    if (node->_info._tier == StorageTier::COLD)
+                        item["tier"] = "cold";
+                    if (node->_last_access != 0)
+                        item["atime"] = static_cast<Json::Int64>(node->_last_access);
+                    root.append(item);
                 }
                 std::string infos_str;
                 if (!JsonUtil::Serialize(root, &infos_str))
@@ -451,27 +1078,45 @@ namespace cloud_backup
                     LOG_WARN("Storage error, serialize to JSON failed");
                     continue;
                 }
-                if (!_file.Clear())
+                // 快照先写入临时文件并落盘，再原子地替换旧的快照，中途异常退出时旧的快照和日志仍然完整
+                FileUtil tmp_file(_file.GetFilePath() + ".tmp");
+                if ((tmp_file.Exists() && !tmp_file.Clear()) || !tmp_file.AppendContent(infos_str) ||
+                    !GroupCommitter::GetInstance()->Sync({tmp_file.GetFilePath()}))
                 {
-                    LOG_WARN("Storage error, clear file failed: %s", _file.GetFilePath().c_str());
+                    LOG_WARN("Storage error, write to file failed: %s", tmp_file.GetFilePath().c_str());
                     continue;
                 }
-                if (!_file.AppendContent(infos_str))
+                if (rename(tmp_file.GetFilePath().c_str(), _file.GetFilePath().c_str()) == -1 || !GroupCommitter::GetInstance()->Sync({_file.GetFilePath()}))
                 {
-                    LOG_WARN("Storage error, write to file failed: %s", _file.GetFilePath().c_str());
+                    LOG_WARN("Storage error, replace file failed: %s", _file.GetFilePath().c_str());
                     continue;
                 }
+                if (is_rotated)
+                    _journal.RemoveUpTo(old_journal_id);
             }
         }
-        // 检查文件是否有效，若文件在DataManager中注册过且已上传成功则返回true，否则返回false
-        bool IsValidFile(const std::string &filename)
+        // 标记节点不再是文件的当前版本，等待已在Guard内按该节点打开文件或读取内容的读者退出，之后按该节点打开文件都会失败
+        // 读者在Guard内不加任何锁，持有分片的写锁时调用也不会死锁
+        static void RetireNode(const DataManagerNode::ptr &node)
+        {
+            node->_is_retired = true;
+            EpochReclaimer::Synchronize();
+        }
+        // 获取文件名所在的分片
+        DataManagerShard &GetShard(const std::string &filename)
+        {
+            return *_shards[std::hash<std::string>()(filename) % _shards.size()];
+        }
+        // 检查文件是否有效，若文件在DataManager中注册过且已上传成功则返回true，否则返回false，需要持有分片的锁时调用
+        bool IsValidFile(DataManagerShard &shard, const std::string &filename)
         {
-            if (_hash.find(filename) == _hash.end())
+            auto it = shard._hash.find(filename);
+            if (it == shard._hash.end())
             {
                 LOG_WARN("<%s> is not valid file, file not found", filename.c_str());
                 return false;
             }
-            if (_hash[filename] == nullptr)
+            if (it->second == nullptr)
             {
                 LOG_WARN("<%s> is not valid file, file not uploaded yet", filename.c_str());
                 return false;
@@ -489,14 +1134,19 @@ namespace cloud_backup
         }
 
     private:
-        FileUtil _file;                                              // 将文件属性持久化存储的文件
-        std::unordered_map<std::string, DataManagerNode::ptr> _hash; // hash表，用于通过文件名快速的访问到文件属性信息，同时也是LRU中的hash
-        std::shared_mutex _rwlock;                                   // 读写锁，保证多线程环境下对_hash的安全访问
+        FileUtil _file;                                        // 将文件属性持久化存储的文件
+        std::vector<std::unique_ptr<DataManagerShard>> _shards; // 按文件名哈希划分的分片，初始化后数量不再变化
+        std::atomic<uint64_t> _version = 0;                    // 文件备份信息的版本号，在分片的写锁下递增
+        const time_t _load_time = time(nullptr);               // DataManager的加载时间
 
-        bool _is_dirty = false;                         // 标记数据管理器中的文件备份信息是否需要存储到文件中，若有修改则设置为true
-        std::condition_variable_any _file_storage_cond; // 条件变量，异步的文件存储线程在不满足条件时就在该条件变量下等待
-        std::thread _file_storage_thread;               // 异步的文件存储线程
+        MetadataJournal _journal;                   // 记录每次修改的追加写日志，_file是日志之前的快照
+        bool _is_dirty = false;                     // 标记是否需要生成检查点，日志过大或最近下载时间需要保存时设置为true
+        std::mutex _file_storage_mutex;             // 保护_is_dirty
+        std::condition_variable _file_storage_cond; // 条件变量，异步的检查点线程在不满足条件时就在该条件变量下等待
+        std::thread _file_storage_thread;           // 异步的检查点线程
 
+        // 所有分片共用一个LRU，热点文件之间的淘汰与它们被分到哪个分片无关，查找文件不加锁，只有读写缓存内容时才需要链表锁
+        // 在分片的写锁下修改节点时可以再获取链表锁，反之不行
         DataManagerList _list;  // LRU中的双向链表
         std::mutex _list_mutex; // 保护链表线程安全的互斥锁
     };
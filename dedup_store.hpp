@@ -0,0 +1,457 @@
+#ifndef CLOUD_BACKUP_DEDUP_STORE_HPP
+#define CLOUD_BACKUP_DEDUP_STORE_HPP
+
+#include <mutex>
+#include <deque>
+#include <algorithm>
+#include <random>
+#include <condition_variable>
+#include <unordered_map>
+#include "util.hpp"
+#include "config.hpp"
+#include "fd_cache.hpp"
+
+namespace cloud_backup
+{
+    // 基于Gear滚动哈希的内容定义分块器(FastCDC)，块边界只由附近的内容决定，文件中间插入或删除数据只会影响附近的块
+    // 期望块大小之前使用更严格的掩码、之后使用更宽松的掩码，使块大小集中在期望值附近
+    class GearChunker
+    {
+    public:
+        GearChunker(size_t min_size, size_t avg_size, size_t max_size)
+            : _min_size(min_size), _avg_size(avg_size), _max_size(max_size)
+        {
+            int bits = 0;
+            while ((1ULL << (bits + 1)) <= avg_size)
+                bits++;
+            // Gear哈希的高位受最近64字节的影响最充分，掩码取高位
+            _mask_small = ~0ULL << (64 - (bits + 1));
+            _mask_large = ~0ULL << (64 - (bits - 1));
+        }
+        size_t MaxSize() { return _max_size; }
+        // 在[data, data+len)中查找第一个块的长度，len小于最大块大小时调用者需要保证数据已经到达文件末尾
+        size_t Cut(const char *data, size_t len)
+        {
+            if (len <= _min_size)
+                return len;
+            size_t normal_size = std::min(_avg_size, len);
+            size_t limit = std::min(_max_size, len);
+            const uint64_t *gear = GearTable();
+            uint64_t hash = 0;
+            size_t i = _min_size;
+            for (; i < normal_size; i++)
+            {
+                hash = (hash << 1) + gear[static_cast<uint8_t>(data[i])];
+                if ((hash & _mask_small) == 0)
+                    return i + 1;
+            }
+            for (; i < limit; i++)
+            {
+                hash = (hash << 1) + gear[static_cast<uint8_t>(data[i])];
+                if ((hash & _mask_large) == 0)
+                    return i + 1;
+            }
+            return limit;
+        }
+
+    private:
+        // Gear表由固定种子生成，保证重启前后切出的块边界一致
+        static const uint64_t *GearTable()
+        {
+            static const std::vector<uint64_t> table = []()
+            {
+                std::vector<uint64_t> values(256);
+                std::mt19937_64 engine(0x63627364656475ULL);
+                for (auto &value : values)
+                    value = engine();
+                return values;
+            }();
+            return table.data();
+        }
+
+        size_t _min_size;
+        size_t _avg_size;
+        size_t _max_size;
+        uint64_t _mask_small; // 未达到期望块大小时使用的掩码，比特数更多，更难命中
+        uint64_t _mask_large; // 超过期望块大小后使用的掩码，比特数更少，更容易命中
+    };
+
+    // 去重存储的文件清单，文件内容按顺序由若干个块拼接而成
+    struct DedupManifest
+    {
+        using ptr = std::shared_ptr<DedupManifest>;
+        struct Chunk
+        {
+            std::string _hash; // 块内容的SHA-256摘要，也是块在块目录中的文件名
+            int64_t _offset;   // 块在文件中的起始位置
+            int64_t _size;
+        };
+        int64_t _size = 0;
+        std::vector<Chunk> _chunks;
+    };
+
+    // 内容定义分块的去重存储单例类，相同内容的块在块目录中只保存一份，并记录被多少个文件清单引用
+    // 引用计数只保存在内存中，启动时由DataManager传入所有清单重新统计，没有被引用的块由后台线程回收
+    class DedupStore
+    {
+    public:
+        using ptr = std::shared_ptr<DedupStore>;
+        static const int READ_BLOCK_SIZE = 4 * 1024 * 1024; // 分块时每次从文件中读取的字节数
+
+        ~DedupStore()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _is_stop = true;
+            }
+            _reclaim_cond.notify_all();
+            _reclaim_thread.join();
+        }
+        static DedupStore::ptr GetInstance()
+        {
+            static DedupStore::ptr store(new DedupStore());
+            if (store == nullptr)
+                LOG_FATAL("create DedupStore object fail");
+            return store;
+        }
+
+        // 将filepath处的完整文件切分成块存入块目录，并用文件清单原地替换该文件，失败时文件保持不变并返回false
+        bool StoreFile(const std::string &filepath)
+        {
+            int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+            {
+                LOG_ERROR("DedupStore StoreFile error, open file:%s error:%d message:%s", filepath.c_str(), errno, strerror(errno));
+                return false;
+            }
+            GearChunker chunker(Config::GetInstance()->GetDedupMinChunkSize(), Config::GetInstance()->GetDedupAvgChunkSize(),
+                                Config::GetInstance()->GetDedupMaxChunkSize());
+            std::vector<std::string> hashes;
+            std::string manifest;
+            std::string buffer;
+            size_t pos = 0;
+            int64_t file_size = 0, new_bytes = 0;
+            bool is_eof = false, ret = true;
+            while (ret)
+            {
+                // 保证缓冲区中至少有一个最大块的数据，除非已经读到文件末尾
+                if (!is_eof && buffer.size() - pos < chunker.MaxSize())
+                {
+                    buffer.erase(0, pos);
+                    pos = 0;
+                    size_t old_size = buffer.size();
+                    buffer.resize(old_size + READ_BLOCK_SIZE);
+                    ssize_t read_bytes = read(fd, buffer.data() + old_size, READ_BLOCK_SIZE);
+                    if (read_bytes < 0 && errno == EINTR)
+                    {
+                        buffer.resize(old_size);
+                        continue;
+                    }
+                    if (read_bytes < 0)
+                    {
+                        LOG_ERROR("DedupStore StoreFile error, read file:%s error:%d message:%s", filepath.c_str(), errno, strerror(errno));
+                        ret = false;
+                        break;
+                    }
+                    buffer.resize(old_size + read_bytes);
+                    is_eof = read_bytes == 0;
+                    continue;
+                }
+                if (pos == buffer.size())
+                    break;
+                size_t chunk_size = chunker.Cut(buffer.data() + pos, buffer.size() - pos);
+                std::string hash = HashUtil::Sha256Hex(buffer.data() + pos, chunk_size);
+                bool is_new = false;
+                if (hash.empty() || !PutChunk(hash, buffer.data() + pos, chunk_size, &is_new))
+                {
+                    ret = false;
+                    break;
+                }
+                hashes.push_back(hash);
+                manifest += hash + ' ' + std::to_string(chunk_size) + '\n';
+                if (is_new)
+                    new_bytes += chunk_size;
+                file_size += chunk_size;
+                pos += chunk_size;
+            }
+            close(fd);
+            // 清单先写入原文件旁边的临时文件，再原子地替换原文件，块目录可以在其他文件系统中
+            std::string tmp_path = filepath + ".manifest.tmp";
+            manifest = MANIFEST_MAGIC + std::to_string(file_size) + '\n' + manifest;
+            if (ret && (!WriteNewFile(tmp_path, manifest.data(), manifest.size()) || rename(tmp_path.c_str(), filepath.c_str()) == -1))
+            {
+                LOG_ERROR("DedupStore StoreFile error, replace file:%s with manifest failed", filepath.c_str());
+                unlink(tmp_path.c_str());
+                ret = false;
+            }
+            if (!ret)
+            {
+                ReleaseChunks(hashes);
+                return false;
+            }
+            LOG_INFO("DedupStore stored file:%s size:%lld chunks:%zu new bytes:%lld",
+                     filepath.c_str(), (long long)file_size, hashes.size(), (long long)new_bytes);
+            return true;
+        }
+        // 释放文件清单引用的所有块，引用计数归零的块交给后台线程回收，失败返回false
+        bool ReleaseFile(const std::string &filepath)
+        {
+            DedupManifest::ptr manifest = LoadManifest(filepath);
+            if (manifest == nullptr)
+                return false;
+            ReleaseManifest(manifest);
+            return true;
+        }
+        // 释放已加载的文件清单引用的所有块，用于文件清单本身已经被替换或删除的情况
+        void ReleaseManifest(const DedupManifest::ptr &manifest)
+        {
+            std::vector<std::string> hashes;
+            hashes.reserve(manifest->_chunks.size());
+            for (auto &chunk : manifest->_chunks)
+                hashes.push_back(chunk._hash);
+            ReleaseChunks(hashes);
+        }
+        // 获取文件清单引用的所有块文件的路径，用于等待这些块落盘，读取清单失败返回false
+        bool GetChunkPaths(const std::string &filepath, std::vector<std::string> *paths)
+        {
+            DedupManifest::ptr manifest = LoadManifest(filepath);
+            if (manifest == nullptr)
+                return false;
+            for (auto &chunk : manifest->_chunks)
+                paths->push_back(ChunkPath(chunk._hash));
+            return true;
+        }
+        // 读取并解析文件清单，失败返回nullptr
+        DedupManifest::ptr LoadManifest(const std::string &filepath)
+        {
+            std::string content;
+            if (!FileUtil(filepath).GetContent(&content) || content.compare(0, MANIFEST_MAGIC.size(), MANIFEST_MAGIC) != 0)
+            {
+                LOG_ERROR("DedupStore LoadManifest error, invalid manifest:%s", filepath.c_str());
+                return nullptr;
+            }
+            DedupManifest::ptr manifest = std::make_shared<DedupManifest>();
+            size_t line_end = content.find('\n');
+            int64_t declared_size = atoll(content.substr(MANIFEST_MAGIC.size(), line_end - MANIFEST_MAGIC.size()).c_str());
+            for (size_t pos = line_end + 1; line_end != std::string::npos && pos < content.size(); pos = line_end + 1)
+            {
+                line_end = content.find('\n', pos);
+                size_t space_pos = content.find(' ', pos);
+                if (line_end == std::string::npos || space_pos == std::string::npos || space_pos > line_end)
+                    break;
+                DedupManifest::Chunk chunk;
+                chunk._hash = content.substr(pos, space_pos - pos);
+                chunk._offset = manifest->_size;
+                chunk._size = atoll(content.substr(space_pos + 1, line_end - space_pos - 1).c_str());
+                manifest->_size += chunk._size;
+                manifest->_chunks.push_back(std::move(chunk));
+            }
+            if (manifest->_size != declared_size)
+            {
+                LOG_ERROR("DedupStore LoadManifest error, manifest:%s is truncated", filepath.c_str());
+                return nullptr;
+            }
+            return manifest;
+        }
+        // 读取文件中[pos, pos+len)的内容，超出文件末尾的部分被忽略，失败返回false
+        bool Read(const DedupManifest::ptr &manifest, int64_t pos, int64_t len, std::string *out)
+        {
+            out->clear();
+            int64_t end = std::min(pos + len, manifest->_size);
+            auto it = std::upper_bound(manifest->_chunks.begin(), manifest->_chunks.end(), pos,
+                                       [](int64_t value, const DedupManifest::Chunk &chunk)
+                                       { return value < chunk._offset; });
+            if (it != manifest->_chunks.begin())
+                --it;
+            for (; it != manifest->_chunks.end() && pos < end; ++it)
+            {
+                int64_t read_size = std::min(end, it->_offset + it->_size) - pos;
+                CachedFd::ptr chunk_file = FdCache::GetInstance()->Open(ChunkPath(it->_hash));
+                size_t out_size = out->size();
+                out->resize(out_size + read_size);
+                if (chunk_file == nullptr || !chunk_file->ReadAt(out->data() + out_size, read_size, pos - it->_offset))
+                {
+                    LOG_ERROR("DedupStore Read error, read chunk:%s failed", it->_hash.c_str());
+                    return false;
+                }
+                pos += read_size;
+            }
+            return true;
+        }
+        // 启动时根据所有去重文件的清单重新统计块的引用计数，并回收没有被任何清单引用的块
+        void Recover(const std::vector<std::string> &manifest_paths)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (auto &path : manifest_paths)
+            {
+                DedupManifest::ptr manifest = LoadManifest(path);
+                if (manifest == nullptr)
+                    continue;
+                for (auto &chunk : manifest->_chunks)
+                {
+                    auto it = _refs.find(chunk._hash);
+                    if (it != _refs.end())
+                        it->second++;
+                    else
+                        LOG_ERROR("DedupStore Recover error, chunk:%s referenced by %s is missing", chunk._hash.c_str(), path.c_str());
+                }
+            }
+            for (auto &[hash, count] : _refs)
+                if (count == 0)
+                    _reclaim_queue.push_back(hash);
+            LOG_INFO("DedupStore recovered %zu chunk, %zu unreferenced", _refs.size(), _reclaim_queue.size());
+            _reclaim_cond.notify_all();
+        }
+
+    private:
+        DedupStore() : _chunk_dir(Config::GetInstance()->GetDedupChunkDir())
+        {
+            if (_chunk_dir.back() != '/')
+                _chunk_dir += '/';
+            for (int i = 0; i < 256; i++)
+            {
+                unsigned char prefix = i;
+                if (!FileUtil(_chunk_dir + HashUtil::HexEncode(&prefix, 1)).CreateDirectories())
+                    LOG_ERROR("DedupStore initialization error, create chunk dir failed: %s", _chunk_dir.c_str());
+            }
+            ScanChunks();
+            _reclaim_thread = std::thread(&DedupStore::ReclaimThread, this);
+        }
+        DedupStore(const DedupStore &) = delete;
+        DedupStore &operator=(const DedupStore &) = delete;
+
+        // 块按摘要的前两个字符分散到256个子目录中，避免单个目录下的文件过多
+        std::string ChunkPath(const std::string &hash) { return _chunk_dir + hash.substr(0, 2) + '/' + hash; }
+        // 引用一个块，块不存在时先写入临时文件再改名，*is_new返回是否新写入了块，失败返回false
+        bool PutChunk(const std::string &hash, const char *data, size_t len, bool *is_new)
+        {
+            *is_new = false;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = _refs.find(hash);
+                if (it != _refs.end())
+                {
+                    it->second++;
+                    return true;
+                }
+            }
+            // 写入块文件时不持有锁，并发写入同一个块时只有先完成改名的一方生效
+            std::string chunk_path = ChunkPath(hash);
+            std::string tmp_path = chunk_path + '.' + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+            if (!WriteNewFile(tmp_path, data, len))
+            {
+                unlink(tmp_path.c_str());
+                return false;
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _refs.find(hash);
+            if (it != _refs.end())
+            {
+                it->second++;
+                unlink(tmp_path.c_str());
+                return true;
+            }
+            if (rename(tmp_path.c_str(), chunk_path.c_str()) == -1)
+            {
+                LOG_ERROR("DedupStore PutChunk error, rename chunk:%s error:%d message:%s", hash.c_str(), errno, strerror(errno));
+                unlink(tmp_path.c_str());
+                return false;
+            }
+            _refs[hash] = 1;
+            *is_new = true;
+            return true;
+        }
+        void ReleaseChunks(const std::vector<std::string> &hashes)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (auto &hash : hashes)
+            {
+                auto it = _refs.find(hash);
+                if (it != _refs.end() && it->second > 0 && --it->second == 0)
+                    _reclaim_queue.push_back(hash);
+            }
+            if (!_reclaim_queue.empty())
+                _reclaim_cond.notify_all();
+        }
+        static bool WriteNewFile(const std::string &filepath, const char *data, size_t len)
+        {
+            int fd = open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd == -1)
+            {
+                LOG_ERROR("DedupStore write file:%s error:%d message:%s", filepath.c_str(), errno, strerror(errno));
+                return false;
+            }
+            while (len > 0)
+            {
+                ssize_t write_bytes = write(fd, data, len);
+                if (write_bytes < 0 && errno == EINTR)
+                    continue;
+                if (write_bytes < 0)
+                {
+                    LOG_ERROR("DedupStore write file:%s error:%d message:%s", filepath.c_str(), errno, strerror(errno));
+                    close(fd);
+                    return false;
+                }
+                data += write_bytes;
+                len -= write_bytes;
+            }
+            return close(fd) == 0;
+        }
+        // 初始化时登记块目录中已有的块(引用计数为0，等待Recover统计)，并删除上次异常退出时残留的临时文件
+        void ScanChunks()
+        {
+            std::vector<FileUtil> files;
+            if (FileUtil(_chunk_dir).ScanDirectory(&files))
+                for (auto &file : files)
+                    file.RemoveRegularFile();
+            for (auto &entry : fs::directory_iterator(_chunk_dir))
+            {
+                if (!entry.is_directory() || FileUtil(entry.path().string()).ScanDirectory(&files) == false)
+                    continue;
+                for (auto &file : files)
+                {
+                    std::string name = file.GetFileName();
+                    if (name.size() == 64 && name.find('.') == std::string::npos)
+                        _refs[name] = 0;
+                    else
+                        file.RemoveRegularFile();
+                }
+            }
+        }
+        // 后台线程删除引用计数归零的块，删除前在锁内再次确认块没有被重新引用
+        void ReclaimThread()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_is_stop)
+            {
+                _reclaim_cond.wait(lock, [&]()
+                                   { return _is_stop || !_reclaim_queue.empty(); });
+                while (!_reclaim_queue.empty())
+                {
+                    std::string hash = std::move(_reclaim_queue.front());
+                    _reclaim_queue.pop_front();
+                    auto it = _refs.find(hash);
+                    if (it == _refs.end() || it->second != 0)
+                        continue;
+                    if (unlink(ChunkPath(hash).c_str()) == -1 && errno != ENOENT)
+                        LOG_WARN("DedupStore reclaim chunk:%s error:%d message:%s", hash.c_str(), errno, strerror(errno));
+                    FdCache::GetInstance()->Invalidate(ChunkPath(hash));
+                    _refs.erase(it);
+                }
+            }
+        }
+
+    private:
+        inline static const std::string MANIFEST_MAGIC = "cloud_backup_dedup_manifest v1 ";
+
+        std::string _chunk_dir;
+        std::unordered_map<std::string, int64_t> _refs; // 块的摘要到引用计数的映射，包含块目录中的所有块
+        std::deque<std::string> _reclaim_queue;         // 引用计数归零、等待回收的块
+        std::mutex _mutex;                              // 保护_refs和_reclaim_queue
+        bool _is_stop = false;
+        std::condition_variable _reclaim_cond;
+        std::thread _reclaim_thread;
+    };
+}
+
+#endif
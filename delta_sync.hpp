@@ -0,0 +1,226 @@
+#ifndef CLOUD_BACKUP_DELTA_SYNC_HPP
+#define CLOUD_BACKUP_DELTA_SYNC_HPP
+
+#include <atomic>
+#include "response_generator.hpp"
+#include "stored_file_reader.hpp"
+#include "file_writer.hpp"
+#include "digest.hpp"
+
+namespace cloud_backup
+{
+    // rsync的弱校验和: a为块内所有字节之和，b为每个字节乘以其到块尾的距离之和，均取低16位，校验和为(b << 16) | a
+    // 客户端在新文件上逐字节滑动窗口时可以O(1)更新: 移出字节x、移入字节y后 a = a - x + y，b = b - len * x + a
+    class RollingChecksum
+    {
+    public:
+        static uint32_t Compute(const char *data, size_t len)
+        {
+            uint32_t a = 0, b = 0;
+            for (size_t i = 0; i < len; i++)
+            {
+                a += static_cast<uint8_t>(data[i]);
+                b += (len - i) * static_cast<uint8_t>(data[i]);
+            }
+            return (b & 0xffff) << 16 | (a & 0xffff);
+        }
+    };
+
+    // 生成一个已备份文件的块签名: {"filename":...,"size":...,"block_size":...,"blocks":[[弱校验和,"SHA-256"],...]}
+    // 文件按block_size切分，最后一块可能不足block_size，签名逐块计算，不需要一次读入整个文件
+    class SignatureGenerator : public ResponseGenerator
+    {
+    public:
+        static constexpr int64_t READ_SIZE = 1024 * 1024; // 每次从文件中读取的字节数，按块大小向下取整
+
+        SignatureGenerator(const BackupInfoNode &info, StoredFileReader::ptr reader, int64_t block_size)
+            : _info(info), _reader(std::move(reader)), _block_size(block_size) {}
+
+        bool Generate(std::string *out, size_t max_size) override
+        {
+            if (_pos == -1)
+            {
+                out->append("{\"filename\":");
+                JsonUtil::AppendQuotedString(_info._filename, out);
+                out->append(",\"size\":" + std::to_string(_info._size) + ",\"block_size\":" + std::to_string(_block_size) + ",\"blocks\":[");
+                _pos = 0;
+            }
+            while (_pos < _info._size && out->size() < max_size)
+            {
+                std::string content;
+                int64_t read_size = std::max(READ_SIZE / _block_size, (int64_t)1) * _block_size;
+                if (!_reader->Read(_pos, read_size, &content) || content.empty())
+                {
+                    // 响应头已经发出，只能截断body让客户端发现签名不完整
+                    LOG_ERROR("SignatureGenerator error, read file:%s failed", _info._filename.c_str());
+                    _pos = _info._size;
+                    return true;
+                }
+                for (size_t i = 0; i < content.size(); i += _block_size)
+                {
+                    size_t len = std::min<size_t>(_block_size, content.size() - i);
+                    if (_pos + i > 0)
+                        out->push_back(',');
+                    out->append("[" + std::to_string(RollingChecksum::Compute(content.data() + i, len)) + ",\"" +
+                                HashUtil::Sha256Hex(content.data() + i, len) + "\"]");
+                }
+                _pos += content.size();
+            }
+            if (_pos < _info._size)
+                return false;
+            out->append("]}");
+            return true;
+        }
+
+    private:
+        BackupInfoNode _info;
+        StoredFileReader::ptr _reader;
+        int64_t _block_size;
+        int64_t _pos = -1; // 下一个要计算签名的块的位置，为-1时还未生成开头部分
+    };
+
+    // 根据旧版本文件和增量指令重建新版本文件，指令流可以分多次传入，结果写入暂存目录中的临时文件
+    // 增量指令的格式(整数均为小端序):
+    //   'C' <uint64 起始块号> <uint32 块数>  从旧文件中复制连续的若干块，最后一块可能不足block_size
+    //   'L' <uint32 长度> <数据>             直接写入一段新数据
+    class DeltaApplier
+    {
+    public:
+        static constexpr int64_t COPY_READ_SIZE = 1024 * 1024;       // 复制旧文件内容时每次读取的字节数
+        static constexpr int64_t MIN_BLOCK_SIZE = 512;               // 允许的最小块大小，块越小签名越大
+        static constexpr int64_t MAX_BLOCK_SIZE = 64 * 1024 * 1024; // 允许的最大块大小
+
+        DeltaApplier(StoredFileReader::ptr base_reader, int64_t base_size, int64_t block_size, int64_t target_size)
+            : _base_reader(std::move(base_reader)), _base_size(base_size), _block_size(block_size), _target_size(target_size) {}
+        ~DeltaApplier()
+        {
+            _writer.Close();
+            if (!_staging_path.empty())
+                unlink(_staging_path.c_str());
+        }
+        // 在暂存目录中创建临时文件，失败返回false
+        bool Open()
+        {
+            static std::atomic<uint64_t> counter = 0;
+            std::string staging_dir = Config::GetInstance()->GetUploadStagingDir();
+            if (staging_dir.back() != '/')
+                staging_dir += '/';
+            _staging_path = staging_dir + "delta-" + std::to_string(getpid()) + '-' + std::to_string(++counter) + ".tmp";
+            if (!_writer.Open(_staging_path) || !_writer.Preallocate(_target_size))
+                return false;
+            _writer.SetCachePolicy(_target_size);
+            return true;
+        }
+        // 解析并执行一段增量指令，指令格式错误、结果超出目标大小或写入失败时返回false
+        bool Feed(const char *data, size_t len)
+        {
+            while (len > 0)
+            {
+                if (_literal_remain > 0)
+                {
+                    size_t write_size = std::min<int64_t>(len, _literal_remain);
+                    if (!Output(data, write_size))
+                        return false;
+                    _literal_remain -= write_size;
+                    data += write_size;
+                    len -= write_size;
+                    continue;
+                }
+                _instruction.push_back(*data++);
+                len--;
+                size_t need_size = _instruction[0] == 'C' ? 13 : _instruction[0] == 'L' ? 5 : 0;
+                if (need_size == 0)
+                {
+                    LOG_WARN("DeltaApplier error, unknown instruction:%d", _instruction[0]);
+                    return false;
+                }
+                if (_instruction.size() < need_size)
+                    continue;
+                if (_instruction[0] == 'L')
+                    _literal_remain = ParseUint(_instruction.data() + 1, 4);
+                else if (!Copy(ParseUint(_instruction.data() + 1, 8), ParseUint(_instruction.data() + 9, 4)))
+                    return false;
+                _instruction.clear();
+            }
+            return true;
+        }
+        // 指令全部传入后调用，结果必须正好是目标大小，成功后临时文件由调用者通过StagingPath移走
+        bool Finish()
+        {
+            if (!_instruction.empty() || _literal_remain > 0 || _writer.Size() != _target_size)
+            {
+                LOG_WARN("DeltaApplier error, delta is incomplete, size:%lld expected:%lld", (long long)_writer.Size(), (long long)_target_size);
+                return false;
+            }
+            return _writer.Close();
+        }
+        const std::string &StagingPath() { return _staging_path; }
+        // 获取重建出的新文件的校验信息，需要在Finish成功后调用，失败返回false
+        bool Digest(FileDigest *digest) { return _digest.Finish(digest); }
+        // 临时文件已被移走，析构时不再删除
+        void Release() { _staging_path.clear(); }
+        // 失败原因是读写文件出错时返回错误码，增量指令本身有误时返回0
+        int LastError() { return _errno != 0 ? _errno : _writer.LastError(); }
+
+    private:
+        DeltaApplier(const DeltaApplier &) = delete;
+        DeltaApplier &operator=(const DeltaApplier &) = delete;
+
+        static uint64_t ParseUint(const char *data, int len)
+        {
+            uint64_t value = 0;
+            for (int i = len - 1; i >= 0; i--)
+                value = value << 8 | static_cast<uint8_t>(data[i]);
+            return value;
+        }
+        bool Output(const char *data, size_t len)
+        {
+            if (_writer.Size() + (int64_t)len > _target_size)
+            {
+                LOG_WARN("DeltaApplier error, result exceeds target size:%lld", (long long)_target_size);
+                return false;
+            }
+            _digest.Update(data, len);
+            return _writer.Write(data, len);
+        }
+        bool Copy(uint64_t start_block, uint64_t block_count)
+        {
+            uint64_t total_blocks = (_base_size + _block_size - 1) / _block_size;
+            if (block_count == 0 || start_block >= total_blocks || block_count > total_blocks - start_block)
+            {
+                LOG_WARN("DeltaApplier error, copy blocks [%llu, +%llu) out of range", (unsigned long long)start_block, (unsigned long long)block_count);
+                return false;
+            }
+            int64_t pos = start_block * _block_size;
+            int64_t end = std::min<int64_t>((start_block + block_count) * _block_size, _base_size);
+            std::string content;
+            while (pos < end)
+            {
+                if (!_base_reader->Read(pos, std::min(COPY_READ_SIZE, end - pos), &content) || content.empty())
+                {
+                    LOG_ERROR("DeltaApplier error, read base file failed");
+                    _errno = EIO;
+                    return false;
+                }
+                if (!Output(content.data(), content.size()))
+                    return false;
+                pos += content.size();
+            }
+            return true;
+        }
+
+    private:
+        StoredFileReader::ptr _base_reader;
+        int64_t _base_size;
+        int64_t _block_size;
+        int64_t _target_size;
+        std::string _staging_path;
+        FileWriter _writer;
+        StreamDigest _digest;
+        std::string _instruction;    // 当前正在接收的指令头部
+        int64_t _literal_remain = 0; // 当前'L'指令还未收到的数据字节数
+        int _errno = 0;
+    };
+}
+
+#endif
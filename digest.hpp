@@ -0,0 +1,193 @@
+#ifndef CLOUD_BACKUP_DIGEST_HPP
+#define CLOUD_BACKUP_DIGEST_HPP
+
+#include "util.hpp"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace cloud_backup
+{
+    // 文件内容的校验信息，sha256为空表示文件在开始记录校验信息之前就已上传，没有校验信息
+    struct FileDigest
+    {
+        uint32_t _crc32c = 0;
+        std::string _sha256; // 64个字符的小写十六进制字符串
+    };
+
+    // CRC32C(Castagnoli多项式)，CPU支持SSE4.2时使用crc32指令每次处理8字节，否则使用查表法
+    class Crc32cUtil
+    {
+    public:
+        // 在crc的基础上继续计算[data, data+len)，crc初始为0，分段计算的结果与一次计算整段数据相同
+        static uint32_t Extend(uint32_t crc, const char *data, size_t len)
+        {
+#if defined(__x86_64__)
+            static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+            if (has_sse42)
+                return ExtendHardware(crc, data, len);
+#endif
+            return ExtendSoftware(crc, data, len);
+        }
+
+    private:
+#if defined(__x86_64__)
+        __attribute__((target("sse4.2"))) static uint32_t ExtendHardware(uint32_t crc, const char *data, size_t len)
+        {
+            uint64_t value = ~crc;
+            for (; len > 0 && reinterpret_cast<uintptr_t>(data) % 8 != 0; len--)
+                value = _mm_crc32_u8(value, *data++);
+            for (; len >= 8; len -= 8, data += 8)
+            {
+                uint64_t word;
+                memcpy(&word, data, 8);
+                value = _mm_crc32_u64(value, word);
+            }
+            for (; len > 0; len--)
+                value = _mm_crc32_u8(value, *data++);
+            return ~static_cast<uint32_t>(value);
+        }
+#endif
+        static uint32_t ExtendSoftware(uint32_t crc, const char *data, size_t len)
+        {
+            static const std::vector<uint32_t> table = []()
+            {
+                std::vector<uint32_t> values(256);
+                for (uint32_t i = 0; i < 256; i++)
+                {
+                    uint32_t value = i;
+                    for (int bit = 0; bit < 8; bit++)
+                        value = (value >> 1) ^ (value & 1 ? 0x82f63b78 : 0);
+                    values[i] = value;
+                }
+                return values;
+            }();
+            crc = ~crc;
+            for (size_t i = 0; i < len; i++)
+                crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+            return ~crc;
+        }
+    };
+
+    // 边接收边计算文件内容的CRC32C和SHA-256，SHA-256由OpenSSL计算，会自动使用CPU的SHA扩展指令
+    class StreamDigest
+    {
+    public:
+        StreamDigest() : _sha256_ctx(EVP_MD_CTX_new())
+        {
+            if (_sha256_ctx == nullptr || EVP_DigestInit_ex(_sha256_ctx, EVP_sha256(), nullptr) != 1)
+            {
+                LOG_ERROR("StreamDigest error, EVP_DigestInit_ex failed");
+                _is_valid = false;
+            }
+        }
+        ~StreamDigest() { EVP_MD_CTX_free(_sha256_ctx); }
+        void Update(const char *data, size_t len)
+        {
+            _crc32c = Crc32cUtil::Extend(_crc32c, data, len);
+            if (_is_valid && EVP_DigestUpdate(_sha256_ctx, data, len) != 1)
+            {
+                LOG_ERROR("StreamDigest error, EVP_DigestUpdate failed");
+                _is_valid = false;
+            }
+        }
+        // 结束计算并输出结果，之后不能再调用Update，失败返回false
+        bool Finish(FileDigest *digest)
+        {
+            unsigned char sha256[EVP_MAX_MD_SIZE];
+            unsigned int sha256_len = 0;
+            if (!_is_valid || EVP_DigestFinal_ex(_sha256_ctx, sha256, &sha256_len) != 1)
+                return false;
+            _is_valid = false;
+            digest->_crc32c = _crc32c;
+            digest->_sha256 = HashUtil::HexEncode(sha256, sha256_len);
+            return true;
+        }
+
+    private:
+        StreamDigest(const StreamDigest &) = delete;
+        StreamDigest &operator=(const StreamDigest &) = delete;
+
+        EVP_MD_CTX *_sha256_ctx;
+        uint32_t _crc32c = 0;
+        bool _is_valid = true;
+    };
+
+    class DigestUtil
+    {
+    public:
+        static const size_t READ_BLOCK_SIZE = 4 * 1024 * 1024; // 读取文件计算校验信息时每次读取的字节数
+
+        // 读取整个文件计算校验信息，用于无法在接收时按顺序计算的上传(可续传上传、分片上传)，失败返回false
+        static bool ComputeFile(const std::string &filepath, FileDigest *digest)
+        {
+            int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+            {
+                LOG_ERROR("DigestUtil ComputeFile error, open file:%s error:%d message:%s", filepath.c_str(), errno, strerror(errno));
+                return false;
+            }
+            StreamDigest stream_digest;
+            std::string buffer(READ_BLOCK_SIZE, '\0');
+            while (true)
+            {
+                ssize_t read_bytes = read(fd, buffer.data(), buffer.size());
+                if (read_bytes < 0 && errno == EINTR)
+                    continue;
+                if (read_bytes < 0)
+                {
+                    LOG_ERROR("DigestUtil ComputeFile error, read file:%s error:%d message:%s", filepath.c_str(), errno, strerror(errno));
+                    close(fd);
+                    return false;
+                }
+                if (read_bytes == 0)
+                    break;
+                stream_digest.Update(buffer.data(), read_bytes);
+            }
+            close(fd);
+            return stream_digest.Finish(digest);
+        }
+        // CRC32C按大端序的4个字节表示
+        static std::string Crc32cBytes(uint32_t crc32c)
+        {
+            std::string bytes(4, '\0');
+            for (int i = 0; i < 4; i++)
+                bytes[i] = static_cast<char>(crc32c >> (24 - 8 * i) & 0xff);
+            return bytes;
+        }
+        static std::string Crc32cHex(uint32_t crc32c)
+        {
+            std::string bytes = Crc32cBytes(crc32c);
+            return HashUtil::HexEncode(reinterpret_cast<const unsigned char *>(bytes.data()), bytes.size());
+        }
+        // 十六进制字符串转换为原始字节，格式错误时返回空串
+        static std::string HexDecode(const std::string &hex)
+        {
+            std::string bytes;
+            if (hex.size() % 2 != 0)
+                return bytes;
+            for (size_t i = 0; i < hex.size(); i += 2)
+            {
+                int high = HexValue(hex[i]), low = HexValue(hex[i + 1]);
+                if (high < 0 || low < 0)
+                    return "";
+                bytes.push_back(static_cast<char>(high << 4 | low));
+            }
+            return bytes;
+        }
+
+    private:
+        static int HexValue(char ch)
+        {
+            if (ch >= '0' && ch <= '9')
+                return ch - '0';
+            if (ch >= 'a' && ch <= 'f')
+                return ch - 'a' + 10;
+            if (ch >= 'A' && ch <= 'F')
+                return ch - 'A' + 10;
+            return -1;
+        }
+    };
+}
+
+#endif
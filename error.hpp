@@ -16,6 +16,7 @@ enum
     EPOLL_CREATE_ERROR,      // 创建epoll失败
     INIT_PIPE_ERROR,         // 初始化管道失败
     SERVER_START_ERROR,      // 服务器启动失败
+    ROUTER_INIT_ERROR,       // 路由表初始化失败
 };
 
 #endif
\ No newline at end of file
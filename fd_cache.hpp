@@ -0,0 +1,116 @@
+#ifndef CLOUD_BACKUP_FD_CACHE_HPP
+#define CLOUD_BACKUP_FD_CACHE_HPP
+
+#include <list>
+#include "util.hpp"
+#include "config.hpp"
+
+namespace cloud_backup
+{
+    // 缓存中的一个只读文件描述符，最后一个使用者释放后才关闭，被淘汰或失效的描述符不影响正在使用它的读取
+    struct CachedFd
+    {
+        using ptr = std::shared_ptr<const CachedFd>;
+        CachedFd(int fd) : _fd(fd) {}
+        ~CachedFd() { close(_fd); }
+        CachedFd(const CachedFd &) = delete;
+        CachedFd &operator=(const CachedFd &) = delete;
+        // 从pos处读取正好len字节，遇到文件末尾或读取出错时返回false
+        bool ReadAt(char *data, size_t len, int64_t pos) const
+        {
+            while (len > 0)
+            {
+                ssize_t read_bytes = pread(_fd, data, len, pos);
+                if (read_bytes < 0 && errno == EINTR)
+                    continue;
+                if (read_bytes <= 0)
+                {
+                    LOG_ERROR("CachedFd read error:%d message:%s", read_bytes < 0 ? errno : 0, read_bytes < 0 ? strerror(errno) : "unexpected end of file");
+                    return false;
+                }
+                data += read_bytes;
+                len -= read_bytes;
+                pos += read_bytes;
+            }
+            return true;
+        }
+
+        const int _fd;
+    };
+
+    // 按路径缓存以只读方式打开的文件描述符，容量有限，按LRU淘汰，读取时直接pread而不需要每次open/stat/close
+    // 缓存的路径只能指向不会原地修改的文件，路径上的文件被删除或被rename覆盖后必须调用Invalidate使对应的描述符失效
+    class FdCache
+    {
+    public:
+        using ptr = std::shared_ptr<FdCache>;
+        static FdCache::ptr GetInstance()
+        {
+            static FdCache::ptr cache(new FdCache());
+            if (cache == nullptr)
+                LOG_FATAL("create FdCache object fail");
+            return cache;
+        }
+
+        // 获取path的只读描述符，缓存中没有时打开并加入缓存，失败返回nullptr
+        CachedFd::ptr Open(const std::string &path)
+        {
+            uint64_t generation;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = _index.find(path);
+                if (it != _index.end())
+                {
+                    _lru.splice(_lru.begin(), _lru, it->second);
+                    return it->second->second;
+                }
+                generation = _generation;
+            }
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+            {
+                LOG_ERROR("FdCache Open error, open file:%s error:%d message:%s", path.c_str(), errno, strerror(errno));
+                return nullptr;
+            }
+            CachedFd::ptr cached_fd = std::make_shared<const CachedFd>(fd);
+            std::unique_lock<std::mutex> lock(_mutex);
+            // 打开期间有路径失效时不加入缓存，避免把已被删除或替换的旧文件放进缓存
+            if (_capacity == 0 || generation != _generation || _index.count(path) != 0)
+                return cached_fd;
+            _lru.emplace_front(path, cached_fd);
+            _index[path] = _lru.begin();
+            if (_lru.size() > _capacity)
+            {
+                _index.erase(_lru.back().first);
+                _lru.pop_back();
+            }
+            return cached_fd;
+        }
+        // 使path对应的缓存失效，之后的Open会重新打开路径上的文件
+        void Invalidate(const std::string &path)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _generation++;
+            auto it = _index.find(path);
+            if (it == _index.end())
+                return;
+            _lru.erase(it->second);
+            _index.erase(it);
+        }
+
+    private:
+        FdCache() : _capacity(Config::GetInstance()->GetFdCacheCapacity()) {}
+        FdCache(const FdCache &) = delete;
+        FdCache &operator=(const FdCache &) = delete;
+
+    private:
+        using Entry = std::pair<std::string, CachedFd::ptr>;
+        size_t _capacity;                                                   // 最多缓存的描述符数量，为0时不缓存
+        std::list<Entry> _lru;                                              // 按最近使用排序，头部为最近使用
+        std::unordered_map<std::string, std::list<Entry>::iterator> _index; // 路径到链表节点的映射
+        uint64_t _generation = 0;                                           // 每次Invalidate递增
+        std::mutex _mutex;
+    };
+}
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef CLOUD_BACKUP_FILE_WRITER_HPP
+#define CLOUD_BACKUP_FILE_WRITER_HPP
+
+#include "large_file_io.hpp"
+
+namespace cloud_backup
+{
+    // 顺序写入一个文件的写入器，直接使用文件描述符写入，数据先拼入对齐的大块缓冲区，攒满一整块后再一次性写出
+    // 每次写入的数据块大小和文件偏移都是WRITE_BUFFER_SIZE的整数倍(最后一块除外)，避免网络数据零碎地触发大量小写入
+    // 大文件可以通过SetCachePolicy改为O_DIRECT写入或边写边丢弃页缓存
+    class FileWriter
+    {
+    public:
+        static const size_t WRITE_BUFFER_SIZE = 1024 * 1024; // 写缓冲区大小，也是每次写入磁盘的数据块大小
+        static const size_t WRITE_ALIGNMENT = 4096;          // 写缓冲区的内存对齐字节数
+
+        FileWriter() {}
+        ~FileWriter()
+        {
+            if (_fd != -1)
+                close(_fd);
+            free(_buffer);
+        }
+        // 打开文件，文件不存在时创建，append为true时在文件末尾追加，否则清空文件，失败返回false
+        bool Open(const std::string &filepath, bool append = false)
+        {
+            if (!OpenFile(filepath, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC)))
+                return false;
+            _is_append = append;
+            struct stat st;
+            _file_pos = append && fstat(_fd, &st) == 0 ? st.st_size : 0;
+            return true;
+        }
+        // 打开已存在的文件，从offset处开始按位置写入(pwrite)，不改变文件中其他位置的数据，多个写入器可以并发写同一文件的不同区域，失败返回false
+        bool OpenAt(const std::string &filepath, int64_t offset)
+        {
+            if (!OpenFile(filepath, O_WRONLY | O_CLOEXEC))
+                return false;
+            _is_positional = true;
+            _file_pos = offset;
+            return true;
+        }
+        // 从当前写入位置开始为接下来的len字节预先分配磁盘空间，减少文件碎片，磁盘空间不足时返回false
+        bool Preallocate(int64_t len)
+        {
+            if (_fd == -1)
+                return false;
+            if (!LargeFileIO::Preallocate(_fd, _file_pos, len))
+            {
+                _errno = errno;
+                return false;
+            }
+            return true;
+        }
+        // 按文件的预期总大小选择写入方式，需要在Open/OpenAt之后、写入数据之前调用
+        // O_DIRECT要求写入位置对齐，追加写入或起始位置不对齐时退回为边写边丢弃页缓存
+        void SetCachePolicy(int64_t file_size)
+        {
+            _mode = LargeFileIO::ModeFor(file_size);
+            if (_mode == LargeFileIOMode::DIRECT &&
+                (_is_append || _file_pos % LargeFileIO::DIRECT_IO_ALIGNMENT != 0 || !LargeFileIO::SetDirectIO(_fd, true)))
+                _mode = LargeFileIOMode::FADVISE;
+            _cache_window_start = _file_pos;
+        }
+        // 写入[data, data+len)，缓冲区为空时整块的数据直接写出不经过拷贝，失败返回false
+        bool Write(const char *data, size_t len)
+        {
+            if (_fd == -1)
+                return false;
+            _size += len;
+            while (len > 0)
+            {
+                if (_buffer_size == 0 && len >= WRITE_BUFFER_SIZE && _mode != LargeFileIOMode::DIRECT)
+                {
+                    size_t direct_size = len - len % WRITE_BUFFER_SIZE;
+                    if (!WriteAll(data, direct_size))
+                        return false;
+                    data += direct_size;
+                    len -= direct_size;
+                    continue;
+                }
+                size_t copy_size = std::min(len, WRITE_BUFFER_SIZE - _buffer_size);
+                memcpy(_buffer + _buffer_size, data, copy_size);
+                _buffer_size += copy_size;
+                data += copy_size;
+                len -= copy_size;
+                if (_buffer_size == WRITE_BUFFER_SIZE)
+                {
+                    if (!WriteAll(_buffer, _buffer_size))
+                        return false;
+                    _buffer_size = 0;
+                }
+            }
+            return true;
+        }
+        // 写出缓冲区中剩余的数据并将文件数据刷到磁盘上，失败返回false
+        bool Sync()
+        {
+            if (_fd == -1)
+                return false;
+            if (!FlushBuffer())
+                return false;
+            if (fdatasync(_fd) == -1)
+            {
+                _errno = errno;
+                LOG_ERROR("FileWriter Sync error, fdatasync error:%d message:%s", _errno, strerror(_errno));
+                return false;
+            }
+            return true;
+        }
+        // 写出缓冲区中剩余的数据并关闭文件，失败返回false
+        bool Close()
+        {
+            if (_fd == -1)
+                return false;
+            bool ret = FlushBuffer();
+            if (close(_fd) == -1 && ret)
+            {
+                _errno = errno;
+                LOG_ERROR("FileWriter Close error, close error:%d message:%s", _errno, strerror(_errno));
+                ret = false;
+            }
+            _fd = -1;
+            return ret;
+        }
+        // 已经写入的总字节数(包括还在缓冲区中的数据)
+        int64_t Size() { return _size; }
+        // 最近一次失败的错误码，可用于区分磁盘空间不足等错误
+        int LastError() { return _errno; }
+
+    private:
+        FileWriter(const FileWriter &) = delete;
+        FileWriter &operator=(const FileWriter &) = delete;
+
+        bool OpenFile(const std::string &filepath, int flags)
+        {
+            if (posix_memalign(reinterpret_cast<void **>(&_buffer), WRITE_ALIGNMENT, WRITE_BUFFER_SIZE) != 0)
+            {
+                _buffer = nullptr;
+                _errno = ENOMEM;
+                LOG_ERROR("FileWriter Open error, alloc write buffer failed");
+                return false;
+            }
+            _fd = open(filepath.c_str(), flags, 0644);
+            if (_fd == -1)
+            {
+                _errno = errno;
+                LOG_ERROR("FileWriter Open error, open file:%s error:%d message:%s", filepath.c_str(), _errno, strerror(_errno));
+                return false;
+            }
+            return true;
+        }
+        // 写出缓冲区中剩余的数据，O_DIRECT下不足对齐长度的尾部改为普通写入
+        bool FlushBuffer()
+        {
+            if (_mode == LargeFileIOMode::DIRECT && _buffer_size % LargeFileIO::DIRECT_IO_ALIGNMENT != 0)
+            {
+                LargeFileIO::SetDirectIO(_fd, false);
+                _mode = LargeFileIOMode::FADVISE;
+            }
+            bool ret = WriteAll(_buffer, _buffer_size);
+            _buffer_size = 0;
+            return ret;
+        }
+        bool WriteAll(const char *data, size_t len)
+        {
+            while (len > 0)
+            {
+                ssize_t write_bytes = _is_positional ? pwrite(_fd, data, len, _file_pos) : write(_fd, data, len);
+                if (write_bytes < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    _errno = errno;
+                    LOG_ERROR("FileWriter write error:%d message:%s", _errno, strerror(_errno));
+                    return false;
+                }
+                data += write_bytes;
+                len -= write_bytes;
+                _file_pos += write_bytes;
+            }
+            if (_mode == LargeFileIOMode::FADVISE)
+                ReleaseCache();
+            return true;
+        }
+        // 每写满一个窗口就开始异步写回该窗口，并等待上一个窗口写回后丢弃其页缓存，页缓存中最多保留两个窗口的数据
+        void ReleaseCache()
+        {
+            if (_file_pos - _cache_window_start < LargeFileIO::DROP_CACHE_WINDOW)
+                return;
+            LargeFileIO::StartWriteback(_fd, _cache_window_start, _file_pos - _cache_window_start);
+            if (_cache_prev_start != -1)
+                LargeFileIO::WritebackAndDropCache(_fd, _cache_prev_start, _cache_window_start - _cache_prev_start);
+            _cache_prev_start = _cache_window_start;
+            _cache_window_start = _file_pos;
+        }
+
+    private:
+        int _fd = -1;
+        char *_buffer = nullptr;
+        size_t _buffer_size = 0;                           // 写缓冲区中已有的数据量
+        bool _is_positional = false;                       // 是否按位置写入(pwrite)
+        bool _is_append = false;                           // 是否以追加方式打开
+        int64_t _file_pos = 0;                             // 下一次写入磁盘的文件偏移
+        LargeFileIOMode _mode = LargeFileIOMode::BUFFERED; // 写入方式，由SetCachePolicy设置
+        int64_t _cache_window_start = 0;                   // 还未开始写回的数据的起始偏移
+        int64_t _cache_prev_start = -1;                    // 已开始写回、等待丢弃页缓存的窗口的起始偏移
+        int64_t _size = 0;
+        int _errno = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef CLOUD_BACKUP_FRAME_STORE_HPP
+#define CLOUD_BACKUP_FRAME_STORE_HPP
+
+#include <zlib.h>
+#include "util.hpp"
+#include "config.hpp"
+#include "fd_cache.hpp"
+
+namespace cloud_backup
+{
+    // 分帧压缩文件的帧索引，读取时根据逻辑偏移直接定位到所在的帧，不需要从头解压
+    struct FrameIndex
+    {
+        using ptr = std::shared_ptr<FrameIndex>;
+        CachedFd::ptr _file;              // 打开的压缩文件，文件在读取过程中被删除也不影响已打开的描述符
+        int _fd = -1;                     // _file中的描述符
+        int64_t _size = 0;                // 文件的逻辑大小(解压后的大小)
+        int64_t _frame_size = 0;          // 每帧解压后的大小，最后一帧可能更小
+        std::vector<int64_t> _frame_ends; // 每一帧在压缩文件中的结束位置，第一帧从文件头之后开始
+    };
+
+    // 静态压缩存储: 文件按固定大小切分成帧，每帧独立地用zlib压缩，文件末尾附带帧索引
+    // 文件格式: [文件头: 魔数 | 帧大小 | 逻辑大小][帧0][帧1]...[帧索引: 每帧的结束位置][尾部: 帧索引位置 | 魔数]
+    // 压缩后没有变小的帧按原样保存，存储长度等于解压后长度的帧即为未压缩的帧
+    class FrameStore
+    {
+    public:
+        static constexpr char MAGIC[8] = {'C', 'B', 'F', 'R', 'A', 'M', 'E', '1'};
+        static const size_t HEADER_SIZE = sizeof(MAGIC) + 2 * sizeof(int64_t);
+        static const size_t TRAILER_SIZE = sizeof(int64_t) + sizeof(MAGIC);
+
+        // 将filepath处的完整文件分帧压缩后原地替换，压缩后总大小没有变小时保持原文件不变并返回false
+        static bool CompressFile(const std::string &filepath)
+        {
+            int64_t frame_size = Config::GetInstance()->GetCompressAtRestFrameSize();
+            int level = Config::GetInstance()->GetCompressLevel();
+            int64_t file_size = FileUtil(filepath).GetFileSize();
+            if (file_size <= 0 || frame_size <= 0)
+                return false;
+            int in_fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (in_fd == -1)
+            {
+                LOG_ERROR("FrameStore CompressFile error, open file:%s error:%d message:%s", filepath.c_str(), errno, strerror(errno));
+                return false;
+            }
+            std::string tmp_path = TmpFilePath(filepath);
+            int out_fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (out_fd == -1)
+            {
+                LOG_ERROR("FrameStore CompressFile error, open file:%s error:%d message:%s", tmp_path.c_str(), errno, strerror(errno));
+                close(in_fd);
+                return false;
+            }
+            std::string header(MAGIC, sizeof(MAGIC));
+            AppendInt64(frame_size, &header);
+            AppendInt64(file_size, &header);
+            bool ret = WriteAll(out_fd, header.data(), header.size());
+            std::vector<int64_t> frame_ends;
+            int64_t out_pos = header.size();
+            std::string frame(frame_size, '\0');
+            std::string compressed(compressBound(frame_size), '\0');
+            for (int64_t pos = 0; ret && pos < file_size; pos += frame_size)
+            {
+                size_t raw_size = std::min(frame_size, file_size - pos);
+                if (!ReadAt(in_fd, frame.data(), raw_size, pos))
+                {
+                    ret = false;
+                    break;
+                }
+                uLongf compressed_size = compressed.size();
+                const char *out_data = frame.data();
+                size_t out_size = raw_size;
+                if (compress2(reinterpret_cast<Bytef *>(compressed.data()), &compressed_size, reinterpret_cast<const Bytef *>(frame.data()), raw_size, level) == Z_OK &&
+                    compressed_size < raw_size)
+                {
+                    out_data = compressed.data();
+                    out_size = compressed_size;
+                }
+                ret = WriteAll(out_fd, out_data, out_size);
+                out_pos += out_size;
+                frame_ends.push_back(out_pos);
+            }
+            close(in_fd);
+            std::string index;
+            for (int64_t frame_end : frame_ends)
+                AppendInt64(frame_end, &index);
+            AppendInt64(out_pos, &index);
+            index.append(MAGIC, sizeof(MAGIC));
+            ret = ret && WriteAll(out_fd, index.data(), index.size());
+            ret = close(out_fd) == 0 && ret;
+            if (!ret || out_pos + (int64_t)index.size() >= file_size)
+            {
+                if (ret)
+                    LOG_INFO("FrameStore skip compressing file:%s, compressed size is not smaller", filepath.c_str());
+                unlink(tmp_path.c_str());
+                return false;
+            }
+            if (rename(tmp_path.c_str(), filepath.c_str()) == -1)
+            {
+                LOG_ERROR("FrameStore CompressFile error, rename file:%s error:%d message:%s", filepath.c_str(), errno, strerror(errno));
+                unlink(tmp_path.c_str());
+                return false;
+            }
+            LOG_INFO("FrameStore compressed file:%s size:%lld stored size:%lld frames:%zu",
+                     filepath.c_str(), (long long)file_size, (long long)(out_pos + index.size()), frame_ends.size());
+            return true;
+        }
+        // 打开分帧压缩文件并读取帧索引，失败返回nullptr
+        static FrameIndex::ptr LoadIndex(const std::string &filepath)
+        {
+            FrameIndex::ptr index = std::make_shared<FrameIndex>();
+            index->_file = FdCache::GetInstance()->Open(filepath);
+            index->_fd = index->_file == nullptr ? -1 : index->_file->_fd;
+            struct stat st;
+            if (index->_fd == -1 || fstat(index->_fd, &st) == -1 || st.st_size < (off_t)(HEADER_SIZE + TRAILER_SIZE))
+            {
+                LOG_ERROR("FrameStore LoadIndex error, open file:%s failed", filepath.c_str());
+                return nullptr;
+            }
+            char header[HEADER_SIZE], trailer[TRAILER_SIZE];
+            if (!ReadAt(index->_fd, header, HEADER_SIZE, 0) || !ReadAt(index->_fd, trailer, TRAILER_SIZE, st.st_size - TRAILER_SIZE) ||
+                memcmp(header, MAGIC, sizeof(MAGIC)) != 0 || memcmp(trailer + sizeof(int64_t), MAGIC, sizeof(MAGIC)) != 0)
+            {
+                LOG_ERROR("FrameStore LoadIndex error, file:%s is not a frame file", filepath.c_str());
+                return nullptr;
+            }
+            index->_frame_size = ParseInt64(header + sizeof(MAGIC));
+            index->_size = ParseInt64(header + sizeof(MAGIC) + sizeof(int64_t));
+            int64_t index_pos = ParseInt64(trailer);
+            int64_t frame_count = index->_frame_size > 0 && index->_size >= 0 ? (index->_size + index->_frame_size - 1) / index->_frame_size : -1;
+            if (frame_count < 0 || frame_count > st.st_size / (int64_t)sizeof(int64_t) || index_pos < (int64_t)HEADER_SIZE ||
+                index_pos + frame_count * (int64_t)sizeof(int64_t) + (int64_t)TRAILER_SIZE != st.st_size)
+            {
+                LOG_ERROR("FrameStore LoadIndex error, file:%s has a corrupted index", filepath.c_str());
+                return nullptr;
+            }
+            std::string index_data(frame_count * sizeof(int64_t), '\0');
+            if (!ReadAt(index->_fd, index_data.data(), index_data.size(), index_pos))
+                return nullptr;
+            // 每帧的存储长度不能超过其解压后的长度(没有变小的帧按原样保存)，帧的结束位置递增且不超过帧索引的位置
+            int64_t frame_start = HEADER_SIZE;
+            for (int64_t i = 0; i < frame_count; i++)
+            {
+                int64_t frame_end = ParseInt64(index_data.data() + i * sizeof(int64_t));
+                int64_t raw_size = std::min(index->_frame_size, index->_size - i * index->_frame_size);
+                if (frame_end <= frame_start || frame_end - frame_start > raw_size || frame_end > index_pos)
+                {
+                    LOG_ERROR("FrameStore LoadIndex error, file:%s has a corrupted index", filepath.c_str());
+                    return nullptr;
+                }
+                index->_frame_ends.push_back(frame_end);
+                frame_start = frame_end;
+            }
+            return index;
+        }
+        // 读取逻辑位置[pos, pos+len)的内容，只解压涉及到的帧，超出文件末尾的部分被忽略，失败返回false
+        static bool Read(const FrameIndex::ptr &index, int64_t pos, int64_t len, std::string *out)
+        {
+            out->clear();
+            int64_t end = std::min(pos + len, index->_size);
+            std::string stored, frame;
+            while (pos < end)
+            {
+                size_t frame_no = pos / index->_frame_size;
+                int64_t frame_start = frame_no * index->_frame_size;
+                int64_t raw_size = std::min(index->_frame_size, index->_size - frame_start);
+                int64_t stored_start = frame_no == 0 ? HEADER_SIZE : index->_frame_ends[frame_no - 1];
+                int64_t stored_size = index->_frame_ends[frame_no] - stored_start;
+                stored.resize(stored_size);
+                if (!ReadAt(index->_fd, stored.data(), stored_size, stored_start))
+                    return false;
+                const std::string *content = &stored;
+                if (stored_size != raw_size)
+                {
+                    frame.resize(raw_size);
+                    uLongf frame_size = raw_size;
+                    if (uncompress(reinterpret_cast<Bytef *>(frame.data()), &frame_size, reinterpret_cast<const Bytef *>(stored.data()), stored_size) != Z_OK ||
+                        (int64_t)frame_size != raw_size)
+                    {
+                        LOG_ERROR("FrameStore Read error, frame:%zu is corrupted", frame_no);
+                        return false;
+                    }
+                    content = &frame;
+                }
+                int64_t copy_size = std::min(end, frame_start + raw_size) - pos;
+                out->append(content->data() + (pos - frame_start), copy_size);
+                pos += copy_size;
+            }
+            return true;
+        }
+
+    private:
+        // 压缩过程中的临时文件放在原文件旁边，保证改名替换原文件时在同一个文件系统中
+        static std::string TmpFilePath(const std::string &filepath) { return filepath + ".frames.tmp"; }
+        // 整数按小端序保存
+        static void AppendInt64(int64_t value, std::string *out)
+        {
+            for (int i = 0; i < 8; i++)
+                out->push_back(static_cast<char>(static_cast<uint64_t>(value) >> (8 * i) & 0xff));
+        }
+        static int64_t ParseInt64(const char *data)
+        {
+            uint64_t value = 0;
+            for (int i = 7; i >= 0; i--)
+                value = value << 8 | static_cast<uint8_t>(data[i]);
+            return static_cast<int64_t>(value);
+        }
+        static bool ReadAt(int fd, char *data, size_t len, int64_t pos)
+        {
+            while (len > 0)
+            {
+                ssize_t read_bytes = pread(fd, data, len, pos);
+                if (read_bytes < 0 && errno == EINTR)
+                    continue;
+                if (read_bytes <= 0)
+                {
+                    LOG_ERROR("FrameStore read error:%d message:%s", read_bytes < 0 ? errno : 0, read_bytes < 0 ? strerror(errno) : "unexpected end of file");
+                    return false;
+                }
+                data += read_bytes;
+                len -= read_bytes;
+                pos += read_bytes;
+            }
+            return true;
+        }
+        static bool WriteAll(int fd, const char *data, size_t len)
+        {
+            while (len > 0)
+            {
+                ssize_t write_bytes = write(fd, data, len);
+                if (write_bytes < 0 && errno == EINTR)
+                    continue;
+                if (write_bytes < 0)
+                {
+                    LOG_ERROR("FrameStore write error:%d message:%s", errno, strerror(errno));
+                    return false;
+                }
+                data += write_bytes;
+                len -= write_bytes;
+            }
+            return true;
+        }
+    };
+}
+
+#endif
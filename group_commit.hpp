@@ -0,0 +1,150 @@
+#ifndef CLOUD_BACKUP_GROUP_COMMIT_HPP
+#define CLOUD_BACKUP_GROUP_COMMIT_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <set>
+#include "util.hpp"
+#include "config.hpp"
+
+namespace cloud_backup
+{
+    // 组提交: 文件内容由调用者在自己的线程中fdatasync，并发的fdatasync由文件系统合并到同一次日志提交中，一个大文件不会阻塞其他文件
+    // 使改名和创建落盘的目录fsync交给后台线程合并，第一个请求到达后提交线程再等待一个提交窗口(或攒够一批)，批内每个目录只fsync一次
+    class GroupCommitter
+    {
+    public:
+        using ptr = std::shared_ptr<GroupCommitter>;
+        ~GroupCommitter()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _is_stop = true;
+            }
+            _commit_cond.notify_all();
+            _commit_thread.join();
+        }
+        static GroupCommitter::ptr GetInstance()
+        {
+            static GroupCommitter::ptr committer(new GroupCommitter());
+            if (committer == nullptr)
+                LOG_FATAL("create GroupCommitter object fail");
+            return committer;
+        }
+
+        // 阻塞直到paths都完成了一次在本次调用之后开始的同步: 普通文件在调用线程中同步其内容，再等待所在目录的同步，此时文件已写入的内容和改名到该路径都已落盘
+        // 目录只同步目录本身，此时其中已完成的创建、改名和删除都已落盘，失败返回false，调用者不能认为文件已经持久化
+        bool Sync(const std::vector<std::string> &paths)
+        {
+            auto request = std::make_shared<SyncRequest>();
+            bool is_ok = true;
+            for (auto &path : paths)
+            {
+                struct stat st;
+                if (stat(path.c_str(), &st) == -1)
+                {
+                    LOG_ERROR("GroupCommitter error, stat path:%s error:%d message:%s", path.c_str(), errno, strerror(errno));
+                    is_ok = false;
+                }
+                else if (S_ISDIR(st.st_mode))
+                    request->_dirs.insert(path);
+                else
+                {
+                    is_ok = SyncPath(path, false) && is_ok;
+                    request->_dirs.insert(FileUtil::file_dir(path));
+                }
+            }
+            if (!is_ok)
+                return false;
+            std::unique_lock<std::mutex> lock(_mutex);
+            _pending.push_back(request);
+            _commit_cond.notify_all();
+            _done_cond.wait(lock, [&]()
+                            { return request->_is_done; });
+            return request->_is_ok;
+        }
+
+    private:
+        struct SyncRequest
+        {
+            std::set<std::string> _dirs; // 需要fsync的目录
+            bool _is_done = false;
+            bool _is_ok = false;
+        };
+
+        GroupCommitter() : _commit_latency(Config::GetInstance()->GetDurableCommitLatencyMs()),
+                           _max_batch(std::max<size_t>(Config::GetInstance()->GetDurableCommitMaxBatch(), 1))
+        {
+            _commit_thread = std::thread(&GroupCommitter::CommitThread, this);
+        }
+        GroupCommitter(const GroupCommitter &) = delete;
+        GroupCommitter &operator=(const GroupCommitter &) = delete;
+
+        void CommitThread()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_is_stop || !_pending.empty())
+            {
+                _commit_cond.wait(lock, [&]()
+                                  { return _is_stop || !_pending.empty(); });
+                if (_pending.empty())
+                    continue;
+                _commit_cond.wait_for(lock, _commit_latency, [&]()
+                                      { return _is_stop || _pending.size() >= _max_batch; });
+                std::vector<std::shared_ptr<SyncRequest>> batch;
+                while (!_pending.empty() && batch.size() < _max_batch)
+                {
+                    batch.push_back(std::move(_pending.front()));
+                    _pending.pop_front();
+                }
+                lock.unlock();
+                CommitBatch(batch);
+                lock.lock();
+                for (auto &request : batch)
+                    request->_is_done = true;
+                _done_cond.notify_all();
+            }
+        }
+        // 合并一批请求涉及的目录，每个目录fsync一次，只有涉及的目录全部成功的请求才算成功
+        void CommitBatch(const std::vector<std::shared_ptr<SyncRequest>> &batch)
+        {
+            std::map<std::string, bool> results; // 目录到同步结果的映射
+            for (auto &request : batch)
+                for (auto &dir : request->_dirs)
+                    results.emplace(dir, false);
+            for (auto &[dir, result] : results)
+                result = SyncPath(dir, true);
+            for (auto &request : batch)
+            {
+                request->_is_ok = true;
+                for (auto &dir : request->_dirs)
+                    request->_is_ok = request->_is_ok && results[dir];
+            }
+            LOG_DEBUG("GroupCommitter committed %zu request on %zu directory", batch.size(), results.size());
+        }
+        // 文件只同步内容和读取内容所需的元数据(fdatasync)，目录同步其中的目录项(fsync)，失败返回false
+        static bool SyncPath(const std::string &path, bool is_dir)
+        {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | (is_dir ? O_DIRECTORY : 0));
+            bool ret = fd != -1 && (is_dir ? fsync(fd) : fdatasync(fd)) == 0;
+            if (!ret)
+                LOG_ERROR("GroupCommitter error, sync path:%s error:%d message:%s", path.c_str(), errno, strerror(errno));
+            if (fd != -1)
+                close(fd);
+            return ret;
+        }
+
+    private:
+        std::chrono::milliseconds _commit_latency; // 提交窗口，第一个请求到达后最多再等待这么久来合并后续请求
+        size_t _max_batch;                         // 一批最多合并的请求数，攒够后不再等待提交窗口结束
+        std::deque<std::shared_ptr<SyncRequest>> _pending;
+        std::mutex _mutex;
+        bool _is_stop = false;
+        std::condition_variable _commit_cond; // 提交线程等待新请求
+        std::condition_variable _done_cond;   // 调用Sync的线程等待所在的批次完成
+        std::thread _commit_thread;
+    };
+}
+
+#endif
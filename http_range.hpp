@@ -0,0 +1,159 @@
+#ifndef CLOUD_BACKUP_HTTP_RANGE_HPP
+#define CLOUD_BACKUP_HTTP_RANGE_HPP
+
+#include <atomic>
+#include <charconv>
+#include <vector>
+#include <algorithm>
+#include "util.hpp"
+
+namespace cloud_backup
+{
+    // 文件中的一个字节区间[_start, _end)
+    struct ByteRange
+    {
+        int64_t _start;
+        int64_t _end;
+    };
+
+    // 按RFC 7233处理Range请求头的工具类
+    class HTTPRangeUtil
+    {
+    public:
+        static const size_t MAX_RANGE_COUNT = 64; // 单个请求允许的最大区间数，超过后忽略Range按完整文件响应
+
+        enum class ParseResult
+        {
+            IGNORE,        // Range请求头格式错误或不支持，应忽略Range按完整文件响应
+            SATISFIABLE,   // 至少有一个区间可满足，ranges中为排序合并后的区间
+            UNSATISFIABLE, // 所有区间都不可满足，应响应416
+        };
+
+        // 解析Range请求头的值，支持"bytes=a-b"、"bytes=a-"、"bytes=-n"以及用逗号分隔的多个区间
+        // 可满足的区间会被截断到文件大小以内，并按起始位置排序，重叠或相邻的区间会被合并
+        static ParseResult Parse(const std::string &value, int64_t file_size, std::vector<ByteRange> *ranges)
+        {
+            ranges->clear();
+            std::string_view spec(value);
+            TrimSpace(&spec);
+            if (spec.substr(0, 6) != "bytes=")
+                return ParseResult::IGNORE;
+            spec.remove_prefix(6);
+            size_t spec_count = 0;
+            while (!spec.empty())
+            {
+                size_t comma_pos = spec.find(',');
+                std::string_view item = spec.substr(0, comma_pos);
+                spec.remove_prefix(comma_pos == std::string_view::npos ? spec.size() : comma_pos + 1);
+                TrimSpace(&item);
+                if (item.empty())
+                    continue;
+                if (++spec_count > MAX_RANGE_COUNT)
+                    return ParseResult::IGNORE;
+                size_t dash_pos = item.find('-');
+                if (dash_pos == std::string_view::npos)
+                    return ParseResult::IGNORE;
+                std::string_view first = item.substr(0, dash_pos);
+                std::string_view last = item.substr(dash_pos + 1);
+                int64_t start = 0, end = 0;
+                if (first.empty())
+                {
+                    // 后缀区间"-n"表示文件的最后n个字节
+                    int64_t suffix_len = 0;
+                    if (!ParseNumber(last, &suffix_len))
+                        return ParseResult::IGNORE;
+                    if (suffix_len == 0 || file_size == 0)
+                        continue;
+                    start = std::max<int64_t>(0, file_size - suffix_len);
+                    end = file_size;
+                }
+                else
+                {
+                    if (!ParseNumber(first, &start))
+                        return ParseResult::IGNORE;
+                    end = file_size;
+                    if (!last.empty())
+                    {
+                        int64_t last_pos = 0;
+                        if (!ParseNumber(last, &last_pos) || last_pos < start)
+                            return ParseResult::IGNORE;
+                        // last_pos可能是int64_t的最大值，先与文件末尾比较，避免加1溢出
+                        end = last_pos >= file_size - 1 ? file_size : last_pos + 1;
+                    }
+                    if (start >= file_size)
+                        continue;
+                }
+                ranges->push_back({start, end});
+            }
+            if (spec_count == 0)
+                return ParseResult::IGNORE;
+            if (ranges->empty())
+                return ParseResult::UNSATISFIABLE;
+            std::sort(ranges->begin(), ranges->end(), [](const ByteRange &a, const ByteRange &b)
+                      { return a._start < b._start; });
+            size_t merged = 0;
+            for (size_t i = 1; i < ranges->size(); i++)
+            {
+                if ((*ranges)[i]._start <= (*ranges)[merged]._end)
+                    (*ranges)[merged]._end = std::max((*ranges)[merged]._end, (*ranges)[i]._end);
+                else
+                    (*ranges)[++merged] = (*ranges)[i];
+            }
+            ranges->resize(merged + 1);
+            return ParseResult::SATISFIABLE;
+        }
+        // 生成Content-Range的值"bytes a-b/size"
+        static std::string ContentRange(const ByteRange &range, int64_t file_size)
+        {
+            return "bytes " + std::to_string(range._start) + '-' + std::to_string(range._end - 1) + '/' + std::to_string(file_size);
+        }
+        // 生成multipart/byteranges响应使用的分隔符
+        static std::string NewBoundary()
+        {
+            static std::atomic<uint64_t> counter = 0;
+            uint64_t seed = (static_cast<uint64_t>(time(nullptr)) << 20) ^ counter.fetch_add(1);
+            seed ^= seed >> 33;
+            seed *= 0xff51afd7ed558ccdULL;
+            seed ^= seed >> 33;
+            char hex[17];
+            snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)seed);
+            return std::string("CloudBackup") + hex;
+        }
+        // multipart/byteranges中每个区间之前的分段头
+        static std::string PartHeader(const std::string &boundary, const std::string &content_type, const ByteRange &range, int64_t file_size)
+        {
+            return "\r\n--" + boundary + "\r\nContent-Type: " + content_type + "\r\nContent-Range: " + ContentRange(range, file_size) + "\r\n\r\n";
+        }
+        // multipart/byteranges的结束分隔符
+        static std::string CloseDelimiter(const std::string &boundary)
+        {
+            return "\r\n--" + boundary + "--\r\n";
+        }
+        // 计算multipart/byteranges响应body的总长度
+        static int64_t MultipartLength(const std::string &boundary, const std::string &content_type, const std::vector<ByteRange> &ranges, int64_t file_size)
+        {
+            int64_t length = CloseDelimiter(boundary).size();
+            for (auto &range : ranges)
+                length += PartHeader(boundary, content_type, range, file_size).size() + (range._end - range._start);
+            return length;
+        }
+
+    private:
+        static void TrimSpace(std::string_view *str)
+        {
+            while (!str->empty() && (str->front() == ' ' || str->front() == '\t'))
+                str->remove_prefix(1);
+            while (!str->empty() && (str->back() == ' ' || str->back() == '\t'))
+                str->remove_suffix(1);
+        }
+        static bool ParseNumber(std::string_view str, int64_t *value)
+        {
+            if (str.empty())
+                return false;
+            auto result = std::from_chars(str.data(), str.data() + str.size(), *value);
+            return result.ec == std::errc() && result.ptr == str.data() + str.size() && *value >= 0;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef CLOUD_BACKUP_HTTP_RESPONSE_HPP
+#define CLOUD_BACKUP_HTTP_RESPONSE_HPP
+
+#include <array>
+#include <charconv>
+#include <string_view>
+#include "output_buffer.hpp"
+
+namespace cloud_backup
+{
+    // 根据状态码返回状态描述，不支持的状态码返回空串
+    constexpr std::string_view HTTPStatusDescribe(int status_code)
+    {
+        switch (status_code)
+        {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 207: return "Multi-Status";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 410: return "Gone";
+        case 411: return "Length Required";
+        case 412: return "Precondition Failed";
+        case 413: return "Payload Too Large";
+        case 415: return "Unsupported Media Type";
+        case 416: return "Range Not Satisfiable";
+        case 417: return "Expectation Failed";
+        case 500: return "Internal Server Error";
+        case 507: return "Insufficient Storage";
+        default: return "";
+        }
+    }
+
+    // 获取预先生成好的完整状态行"HTTP/1.x code describe\r\n"，返回的字符串为静态存储，可以直接引用发送
+    // http_minor只支持0和1，不支持的状态码按500处理
+    inline std::string_view HTTPStatusLine(int http_minor, int status_code)
+    {
+        static const std::array<std::array<std::string, 600>, 2> lines = []()
+        {
+            std::array<std::array<std::string, 600>, 2> lines;
+            for (int minor = 0; minor < 2; minor++)
+            {
+                for (int code = 100; code < 600; code++)
+                {
+                    std::string_view describe = HTTPStatusDescribe(code);
+                    if (!describe.empty())
+                        lines[minor][code] = "HTTP/1." + std::to_string(minor) + ' ' + std::to_string(code) + ' ' + std::string(describe) + "\r\n";
+                }
+            }
+            return lines;
+        }();
+        if (status_code < 100 || status_code >= 600 || lines[0][status_code].empty())
+            status_code = 500;
+        return lines[http_minor == 0 ? 0 : 1][status_code];
+    }
+
+    // 将时间格式化为HTTP-date(RFC 7231中的IMF-fixdate格式)，如"Sun, 06 Nov 1994 08:49:37 GMT"
+    inline std::string HTTPDateFormat(time_t t)
+    {
+        static const char *week_days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+        static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+        struct tm tm_value;
+        gmtime_r(&t, &tm_value);
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%s, %02d %s %04d %02d:%02d:%02d GMT", week_days[tm_value.tm_wday], tm_value.tm_mday,
+                 months[tm_value.tm_mon], tm_value.tm_year + 1900, tm_value.tm_hour, tm_value.tm_min, tm_value.tm_sec);
+        return buffer;
+    }
+    // 解析IMF-fixdate格式的HTTP-date，失败返回false
+    inline bool HTTPDateParse(const std::string &str, time_t *t)
+    {
+        static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+        char week_day[4] = {0}, month[4] = {0};
+        struct tm tm_value = {};
+        if (sscanf(str.c_str(), "%3s, %d %3s %d %d:%d:%d GMT", week_day, &tm_value.tm_mday, month,
+                   &tm_value.tm_year, &tm_value.tm_hour, &tm_value.tm_min, &tm_value.tm_sec) != 7)
+            return false;
+        tm_value.tm_mon = -1;
+        for (int i = 0; i < 12; i++)
+            if (strcmp(month, months[i]) == 0)
+                tm_value.tm_mon = i;
+        if (tm_value.tm_mon == -1)
+            return false;
+        tm_value.tm_year -= 1900;
+        *t = timegm(&tm_value);
+        return *t != -1;
+    }
+    // 判断If-None-Match/If-Match等请求头中的实体标签列表是否包含etag，使用弱比较(忽略"W/"前缀)，"*"匹配任意实体标签
+    inline bool HTTPETagListMatch(const std::string &etag_list, std::string_view etag)
+    {
+        if (etag.substr(0, 2) == "W/")
+            etag.remove_prefix(2);
+        std::string_view list(etag_list);
+        while (!list.empty())
+        {
+            size_t comma_pos = list.find(',');
+            std::string_view item = list.substr(0, comma_pos);
+            list.remove_prefix(comma_pos == std::string_view::npos ? list.size() : comma_pos + 1);
+            while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+                item.remove_prefix(1);
+            while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+                item.remove_suffix(1);
+            if (item.substr(0, 2) == "W/")
+                item.remove_prefix(2);
+            if (item == "*" || item == etag)
+                return true;
+        }
+        return false;
+    }
+
+    // 按chunked传输编码将一段数据作为一个chunk追加到发送缓冲区中，空数据不生成chunk(长度为0的chunk表示body结束)
+    inline void HTTPAppendChunk(OutputBuffer *out, std::string &&chunk)
+    {
+        if (chunk.empty())
+            return;
+        char chunk_header[24];
+        int header_len = snprintf(chunk_header, sizeof(chunk_header), "%zx\r\n", chunk.size());
+        out->Append(std::string(chunk_header, header_len));
+        out->Append(std::move(chunk));
+        out->AppendStatic("\r\n");
+    }
+    // 追加chunked传输编码的结束块，body到此结束
+    inline void HTTPAppendLastChunk(OutputBuffer *out)
+    {
+        out->AppendStatic("0\r\n\r\n");
+    }
+
+    // 将响应头逐行追加到调用者提供的缓冲区中，数字使用std::to_chars格式化，缓冲区容量足够时整个过程不申请堆内存
+    class HTTPHeaderBuilder
+    {
+    public:
+        explicit HTTPHeaderBuilder(std::string *buffer) : _buffer(buffer) {}
+
+        void Add(std::string_view key, std::string_view value)
+        {
+            _buffer->append(key);
+            _buffer->append(": ", 2);
+            _buffer->append(value);
+            _buffer->append("\r\n", 2);
+        }
+        void Add(std::string_view key, int64_t value)
+        {
+            char digits[24];
+            auto result = std::to_chars(digits, digits + sizeof(digits), value);
+            Add(key, std::string_view(digits, result.ptr - digits));
+        }
+        // 追加空行，结束响应头
+        void End() { _buffer->append("\r\n", 2); }
+
+    private:
+        std::string *_buffer;
+    };
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef CLOUD_BACKUP_LARGE_FILE_IO_HPP
+#define CLOUD_BACKUP_LARGE_FILE_IO_HPP
+
+#include "util.hpp"
+#include "config.hpp"
+
+namespace cloud_backup
+{
+    // 文件的读写方式，达到大文件阈值的文件按配置绕过页缓存，避免一次大文件传输把小文件的热点缓存挤出去
+    enum class LargeFileIOMode
+    {
+        BUFFERED, // 普通的带缓存读写
+        FADVISE,  // 带缓存读写，数据写回磁盘或读取完成后通过posix_fadvise(DONTNEED)丢弃对应的页缓存
+        DIRECT,   // 通过O_DIRECT在对齐的缓冲区上直接读写磁盘，不对齐的部分退回带缓存读写
+    };
+
+    class LargeFileIO
+    {
+    public:
+        static const size_t DIRECT_IO_ALIGNMENT = 4096;          // O_DIRECT要求的内存地址、文件偏移和长度的对齐字节数
+        static const int64_t DROP_CACHE_WINDOW = 8 * 1024 * 1024; // 写入时每攒够这么多数据就写回并丢弃上一段的页缓存
+
+        // 根据文件的(预期)总大小选择读写方式，大小未知(<0)或未达到阈值时使用普通读写
+        static LargeFileIOMode ModeFor(int64_t file_size)
+        {
+            int64_t threshold = Config::GetInstance()->GetLargeFileThreshold();
+            if (file_size < 0 || threshold <= 0 || file_size < threshold)
+                return LargeFileIOMode::BUFFERED;
+            const std::string &mode = Config::GetInstance()->GetLargeFileIOMode();
+            if (mode == "direct")
+                return LargeFileIOMode::DIRECT;
+            if (mode == "fadvise")
+                return LargeFileIOMode::FADVISE;
+            return LargeFileIOMode::BUFFERED;
+        }
+        // 为[offset, offset+len)预先分配连续的磁盘空间，不改变文件大小，文件系统不支持时忽略
+        // 磁盘空间不足时返回false并设置errno，调用者可以提前拒绝上传而不是写到一半失败
+        static bool Preallocate(int fd, int64_t offset, int64_t len)
+        {
+            if (len <= 0)
+                return true;
+            int ret;
+            do
+                ret = fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, len);
+            while (ret == -1 && errno == EINTR);
+            if (ret == 0 || errno == EOPNOTSUPP || errno == ENOSYS)
+                return true;
+            LOG_WARN("LargeFileIO Preallocate error, fallocate len:%lld error:%d message:%s", (long long)len, errno, strerror(errno));
+            return false;
+        }
+        // 为文件描述符开启或关闭O_DIRECT，文件系统不支持时返回false
+        static bool SetDirectIO(int fd, bool enable)
+        {
+            int flags = fcntl(fd, F_GETFL);
+            if (flags == -1 || fcntl(fd, F_SETFL, enable ? flags | O_DIRECT : flags & ~O_DIRECT) == -1)
+            {
+                LOG_INFO("LargeFileIO SetDirectIO:%d error:%d message:%s", enable, errno, strerror(errno));
+                return false;
+            }
+            return true;
+        }
+        // 丢弃[offset, offset+len)的页缓存，len为0表示到文件末尾，脏页不会被丢弃，需要先写回磁盘
+        static void DropCache(int fd, int64_t offset, int64_t len)
+        {
+            int ret = posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+            if (ret != 0)
+                LOG_DEBUG("LargeFileIO DropCache error:%d message:%s", ret, strerror(ret));
+        }
+        // 等待[offset, offset+len)写回磁盘后丢弃其页缓存
+        static void WritebackAndDropCache(int fd, int64_t offset, int64_t len)
+        {
+            if (sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) == -1)
+                LOG_DEBUG("LargeFileIO sync_file_range error:%d message:%s", errno, strerror(errno));
+            DropCache(fd, offset, len);
+        }
+        // 开始异步写回[offset, offset+len)，不等待完成
+        static void StartWriteback(int fd, int64_t offset, int64_t len)
+        {
+            if (sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE) == -1)
+                LOG_DEBUG("LargeFileIO sync_file_range error:%d message:%s", errno, strerror(errno));
+        }
+        // 丢弃整个文件的页缓存，用于文件已经落盘之后(此时已没有脏页)
+        static void DropFileCache(const std::string &filepath)
+        {
+            int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+                return;
+            DropCache(fd, 0, 0);
+            close(fd);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef CLOUD_BACKUP_METADATA_JOURNAL_HPP
+#define CLOUD_BACKUP_METADATA_JOURNAL_HPP
+
+#include <mutex>
+#include <functional>
+#include "util.hpp"
+#include "digest.hpp"
+#include "group_commit.hpp"
+
+namespace cloud_backup
+{
+    // 日志记录内容的编码，整数均为小端序，字符串以uint32的长度开头
+    class JournalRecordWriter
+    {
+    public:
+        void PutUint(uint64_t value, int len)
+        {
+            for (int i = 0; i < len; i++)
+                _data.push_back(static_cast<char>(value >> (i * 8) & 0xff));
+        }
+        void PutString(const std::string &value)
+        {
+            PutUint(value.size(), 4);
+            _data.append(value);
+        }
+        const std::string &Data() { return _data; }
+
+    private:
+        std::string _data;
+    };
+
+    // 日志记录内容的解码，读取超出记录末尾时返回false
+    class JournalRecordReader
+    {
+    public:
+        JournalRecordReader(const std::string &data) : _data(data) {}
+        bool GetUint(int len, uint64_t *value)
+        {
+            if (_pos + len > _data.size())
+                return false;
+            *value = 0;
+            for (int i = len - 1; i >= 0; i--)
+                *value = *value << 8 | static_cast<uint8_t>(_data[_pos + i]);
+            _pos += len;
+            return true;
+        }
+        bool GetString(std::string *value)
+        {
+            uint64_t len;
+            if (!GetUint(4, &len) || _pos + len > _data.size())
+                return false;
+            value->assign(_data, _pos, len);
+            _pos += len;
+            return true;
+        }
+
+    private:
+        const std::string &_data;
+        size_t _pos = 0;
+    };
+
+    // 元数据的追加写日志: 每次修改只追加一条记录，记录的格式为 <uint32 内容长度> <uint32 内容的CRC32C> <内容>
+    // 日志按编号分成多个文件(<快照文件路径>.journal.<编号>)，检查点切换到新的日志文件后把之前的状态写成快照，快照生效后删除旧的日志文件
+    // 启动时在快照的基础上按编号顺序重放所有日志文件，记录的内容必须是幂等的，检查点中途退出时重放已包含在快照中的记录不影响结果
+    class MetadataJournal
+    {
+    public:
+        static const size_t RECORD_HEADER_SIZE = 8;
+
+        MetadataJournal(const std::string &snapshot_path) : _prefix(FileUtil(snapshot_path).GetFileName() + ".journal."),
+                                                            _dir(FileUtil::file_dir(snapshot_path)) {}
+        ~MetadataJournal()
+        {
+            if (_fd != -1)
+                close(_fd);
+        }
+
+        // 按编号顺序读取所有日志文件中的记录并交给handler，文件末尾不完整或校验失败的记录(异常退出时没有写完)及其之后的内容被忽略
+        // 需要在Open之前调用，返回重放的记录数
+        size_t Replay(const std::function<void(const std::string &record)> &handler)
+        {
+            size_t count = 0;
+            for (uint64_t journal_id : ScanJournals())
+            {
+                std::string content;
+                if (!FileUtil(JournalPath(journal_id)).GetContent(&content))
+                {
+                    LOG_ERROR("MetadataJournal Replay error, read journal:%llu failed", (unsigned long long)journal_id);
+                    continue;
+                }
+                size_t pos = 0;
+                while (content.size() - pos >= RECORD_HEADER_SIZE)
+                {
+                    uint64_t len = 0, crc32c = 0;
+                    std::string header = content.substr(pos, RECORD_HEADER_SIZE);
+                    JournalRecordReader reader(header);
+                    reader.GetUint(4, &len);
+                    reader.GetUint(4, &crc32c);
+                    if (content.size() - pos - RECORD_HEADER_SIZE < len ||
+                        Crc32cUtil::Extend(0, content.data() + pos + RECORD_HEADER_SIZE, len) != crc32c)
+                        break;
+                    handler(content.substr(pos + RECORD_HEADER_SIZE, len));
+                    pos += RECORD_HEADER_SIZE + len;
+                    count++;
+                }
+                if (pos != content.size())
+                    LOG_WARN("MetadataJournal Replay, ignored %zu byte of incomplete record in journal:%llu", content.size() - pos, (unsigned long long)journal_id);
+            }
+            return count;
+        }
+        // 在所有已有的日志文件之后创建新的日志文件，之后的记录都追加到新文件中，失败返回false
+        bool Open()
+        {
+            std::vector<uint64_t> journal_ids = ScanJournals();
+            std::unique_lock<std::mutex> lock(_mutex);
+            _journal_id = journal_ids.empty() ? 0 : journal_ids.back();
+            return OpenNext();
+        }
+        // 追加一条记录，不等待落盘，返回追加后当前日志文件的大小，失败返回-1
+        int64_t Append(const std::string &record)
+        {
+            JournalRecordWriter writer;
+            writer.PutUint(record.size(), 4);
+            writer.PutUint(Crc32cUtil::Extend(0, record.data(), record.size()), 4);
+            std::string data = writer.Data() + record;
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (size_t written = 0; written < data.size();)
+            {
+                ssize_t write_bytes = pwrite(_fd, data.data() + written, data.size() - written, _size + written);
+                if (write_bytes < 0 && errno == EINTR)
+                    continue;
+                if (write_bytes < 0)
+                {
+                    // 不推进文件大小，残留的部分内容会被下一条记录覆盖
+                    LOG_ERROR("MetadataJournal Append error, write journal error:%d message:%s", errno, strerror(errno));
+                    return -1;
+                }
+                written += write_bytes;
+            }
+            _size += data.size();
+            return _size;
+        }
+        // 等待已追加的记录落盘，多个线程的等待由组提交合并，失败返回false
+        // 只需要同步当前的日志文件，之前的日志文件在切换时已经落盘
+        bool Sync()
+        {
+            std::string journal_path;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                journal_path = JournalPath(_journal_id);
+            }
+            if (!GroupCommitter::GetInstance()->Sync({journal_path}))
+            {
+                LOG_ERROR("MetadataJournal Sync error, sync journal failed");
+                return false;
+            }
+            return true;
+        }
+        // 切换到新的日志文件，*old_journal_id返回之前的日志文件编号，之前的记录都已包含在之后生成的快照中，失败返回false
+        bool Rotate(uint64_t *old_journal_id)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            *old_journal_id = _journal_id;
+            return OpenNext();
+        }
+        // 快照生效后删除编号不超过journal_id的日志文件
+        void RemoveUpTo(uint64_t journal_id)
+        {
+            for (uint64_t id : ScanJournals())
+                if (id <= journal_id && unlink(JournalPath(id).c_str()) == -1)
+                    LOG_WARN("MetadataJournal remove journal:%llu error:%d message:%s", (unsigned long long)id, errno, strerror(errno));
+        }
+
+    private:
+        MetadataJournal(const MetadataJournal &) = delete;
+        MetadataJournal &operator=(const MetadataJournal &) = delete;
+
+        std::string JournalPath(uint64_t journal_id) { return _dir + _prefix + std::to_string(journal_id); }
+        // 获取所有日志文件的编号，从小到大排列
+        std::vector<uint64_t> ScanJournals()
+        {
+            std::vector<uint64_t> journal_ids;
+            std::vector<FileUtil> files;
+            if (!FileUtil(_dir).ScanDirectory(&files))
+                return journal_ids;
+            for (auto &file : files)
+            {
+                std::string name = file.GetFileName();
+                if (name.compare(0, _prefix.size(), _prefix) == 0 && name.size() > _prefix.size() && isdigit(name[_prefix.size()]))
+                    journal_ids.push_back(strtoull(name.c_str() + _prefix.size(), nullptr, 10));
+            }
+            std::sort(journal_ids.begin(), journal_ids.end());
+            return journal_ids;
+        }
+        // 切换前先让当前日志文件落盘，追加后还没等到Sync的记录不会因为切换而丢失，需要持有_mutex时调用
+        bool OpenNext()
+        {
+            if (_fd != -1 && fdatasync(_fd) == -1)
+            {
+                LOG_ERROR("MetadataJournal error, sync journal:%llu error:%d message:%s", (unsigned long long)_journal_id, errno, strerror(errno));
+                return false;
+            }
+            std::string journal_path = JournalPath(_journal_id + 1);
+            int fd = open(journal_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd == -1)
+            {
+                LOG_ERROR("MetadataJournal error, create journal:%s error:%d message:%s", journal_path.c_str(), errno, strerror(errno));
+                return false;
+            }
+            if (_fd != -1)
+                close(_fd);
+            _fd = fd;
+            _journal_id++;
+            _size = 0;
+            return true;
+        }
+
+    private:
+        std::string _prefix;      // 日志文件名去掉编号后的部分
+        std::string _dir;         // 日志文件所在的目录，与快照文件相同
+        uint64_t _journal_id = 0; // 当前追加的日志文件编号
+        int _fd = -1;
+        int64_t _size = 0;        // 当前日志文件中已追加的字节数
+        std::mutex _mutex;        // 保护当前日志文件
+    };
+}
+
+#endif
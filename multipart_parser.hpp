@@ -0,0 +1,250 @@
+#ifndef CLOUD_BACKUP_MULTIPART_PARSER_HPP
+#define CLOUD_BACKUP_MULTIPART_PARSER_HPP
+
+#include <array>
+#include <functional>
+#include "util.hpp"
+
+namespace cloud_backup
+{
+    // multipart/form-data的流式解析器，以状态机的方式对到来的body数据只扫描一遍
+    // 分隔符"\r\n--boundary"使用Boyer-Moore-Horspool算法查找，跨越两次输入的不完整分隔符保存在_lookbehind中
+    // 文件内容以指针+长度的形式直接指向输入数据交给回调，不做拷贝(只有被_lookbehind暂存又确认不是分隔符的少量字节例外)
+    class MultipartParser
+    {
+    public:
+        // 收到一个part的完整头部(不含结尾的空行)，返回false表示头部格式错误，解析器进入错误状态
+        using part_begin_cb_t = std::function<bool(const std::string &)>;
+        // 收到当前part的一段内容
+        using part_data_cb_t = std::function<void(const char *, size_t)>;
+        // 当前part的内容已经全部到达
+        using part_end_cb_t = std::function<void()>;
+
+        static const size_t MAX_PART_HEADER_SIZE = 16 * 1024; // 单个part头部的最大长度
+
+        MultipartParser() {}
+        ~MultipartParser() {}
+
+        // 使用body中的boundary(不含前导"--")初始化解析器，并设置各个回调
+        void Init(const std::string &boundary, part_begin_cb_t on_part_begin, part_data_cb_t on_part_data, part_end_cb_t on_part_end)
+        {
+            Reset();
+            _delimiter = "\r\n--" + boundary;
+            for (auto &skip : _skip_table)
+                skip = _delimiter.size();
+            for (size_t i = 0; i + 1 < _delimiter.size(); i++)
+                _skip_table[(unsigned char)_delimiter[i]] = _delimiter.size() - 1 - i;
+            // 第一个分隔符前面可以没有"\r\n"，这里假装已经收到了"\r\n"，使其与后续的分隔符统一处理
+            _lookbehind = "\r\n";
+            _on_part_begin = std::move(on_part_begin);
+            _on_part_data = std::move(on_part_data);
+            _on_part_end = std::move(on_part_end);
+        }
+        // 清空解析器的所有状态
+        void Reset()
+        {
+            _state = State::PREAMBLE;
+            _delimiter.clear();
+            _lookbehind.clear();
+            _part_header.clear();
+            _on_part_begin = nullptr;
+            _on_part_data = nullptr;
+            _on_part_end = nullptr;
+        }
+        // 解析新到来的一段body数据，body格式错误时返回false，此后的数据都不再解析
+        bool Execute(const char *data, size_t len)
+        {
+            const char *cur = data;
+            const char *end = data + len;
+            while (cur < end && _state != State::ERROR && _state != State::FINISHED)
+            {
+                switch (_state)
+                {
+                case State::PREAMBLE:
+                case State::PART_BODY:
+                    ScanBody(cur, end);
+                    break;
+                case State::AFTER_DELIMITER:
+                    ScanAfterDelimiter(cur, end);
+                    break;
+                case State::AFTER_DELIMITER_LF:
+                    if (*cur++ != '\n')
+                        SetError("missing LF after boundary");
+                    else
+                    {
+                        _part_header = "\r\n";
+                        _state = State::PART_HEADER;
+                    }
+                    break;
+                case State::CLOSE_DELIMITER:
+                    if (*cur++ != '-')
+                        SetError("invalid close boundary");
+                    else
+                        _state = State::FINISHED;
+                    break;
+                case State::PART_HEADER:
+                    ScanPartHeader(cur, end);
+                    break;
+                default:
+                    break;
+                }
+            }
+            return _state != State::ERROR;
+        }
+        // 是否已经收到了结束分隔符"--boundary--"
+        bool IsFinished() { return _state == State::FINISHED; }
+        // 当前是否正处于某个part的内容中
+        bool InPartBody() { return _state == State::PART_BODY; }
+
+    private:
+        enum class State
+        {
+            PREAMBLE,           // 第一个分隔符之前的数据，全部丢弃
+            AFTER_DELIMITER,    // 刚匹配完分隔符，等待"\r\n"或"--"
+            AFTER_DELIMITER_LF, // 分隔符后已收到'\r'，等待'\n'
+            CLOSE_DELIMITER,    // 分隔符后已收到'-'，等待第二个'-'
+            PART_HEADER,        // 正在接收part的头部
+            PART_BODY,          // 正在接收part的内容
+            FINISHED,           // 已收到结束分隔符，后续数据全部丢弃
+            ERROR,              // 格式错误
+        };
+
+        void SetError(const char *reason)
+        {
+            LOG_WARN("MultipartParser error, %s", reason);
+            _state = State::ERROR;
+        }
+        void EmitData(const char *data, size_t len)
+        {
+            if (_state == State::PART_BODY && len > 0 && _on_part_data)
+                _on_part_data(data, len);
+        }
+        // 分隔符已完整匹配
+        void OnDelimiter()
+        {
+            if (_state == State::PART_BODY && _on_part_end)
+                _on_part_end();
+            _state = State::AFTER_DELIMITER;
+        }
+        // 在[data, end)中查找分隔符，找到返回其起始位置，否则返回nullptr
+        const char *SearchDelimiter(const char *data, const char *end)
+        {
+            const size_t dlen = _delimiter.size();
+            const char *pattern = _delimiter.c_str();
+            const unsigned char last = pattern[dlen - 1];
+            const char *pos = data;
+            while (end - pos >= (ptrdiff_t)dlen)
+            {
+                unsigned char ch = pos[dlen - 1];
+                if (ch == last && memcmp(pos, pattern, dlen - 1) == 0)
+                    return pos;
+                pos += _skip_table[ch];
+            }
+            return nullptr;
+        }
+        // 处理PREAMBLE和PART_BODY状态下的数据，二者唯一的区别是PREAMBLE下的数据不交给回调
+        void ScanBody(const char *&cur, const char *end)
+        {
+            const size_t dlen = _delimiter.size();
+            // 先尝试用上次残留的不完整分隔符与本次数据拼接匹配
+            while (!_lookbehind.empty())
+            {
+                size_t matched = _lookbehind.size();
+                size_t need = std::min<size_t>(dlen - matched, end - cur);
+                if (memcmp(_delimiter.c_str() + matched, cur, need) == 0)
+                {
+                    cur += need;
+                    if (matched + need < dlen)
+                    {
+                        _lookbehind.append(cur - need, need);
+                        return;
+                    }
+                    _lookbehind.clear();
+                    OnDelimiter();
+                    return;
+                }
+                // 匹配失败，丢弃_lookbehind中不可能成为分隔符开头的前缀部分，将其作为内容交出
+                size_t shift = 1;
+                while (shift < matched && memcmp(_lookbehind.c_str() + shift, _delimiter.c_str(), matched - shift) != 0)
+                    shift++;
+                EmitData(_lookbehind.c_str(), shift);
+                _lookbehind.erase(0, shift);
+            }
+            const char *pos = SearchDelimiter(cur, end);
+            if (pos != nullptr)
+            {
+                EmitData(cur, pos - cur);
+                cur = pos + dlen;
+                OnDelimiter();
+                return;
+            }
+            // 没有完整的分隔符，检查结尾处是否有可能是分隔符开头的部分，有则暂存到_lookbehind中
+            const char *tail = end - std::min<size_t>(dlen - 1, end - cur);
+            while ((tail = (const char *)memchr(tail, '\r', end - tail)) != nullptr)
+            {
+                if (memcmp(tail, _delimiter.c_str(), end - tail) == 0)
+                    break;
+                tail++;
+            }
+            if (tail == nullptr)
+                tail = end;
+            EmitData(cur, tail - cur);
+            _lookbehind.assign(tail, end - tail);
+            cur = end;
+        }
+        // 分隔符之后要么是"\r\n"开始一个新的part，要么是"--"表示body结束，允许中间夹杂空白符
+        void ScanAfterDelimiter(const char *&cur, const char *end)
+        {
+            while (cur < end)
+            {
+                char ch = *cur++;
+                if (ch == ' ' || ch == '\t')
+                    continue;
+                if (ch == '\r')
+                    _state = State::AFTER_DELIMITER_LF;
+                else if (ch == '-')
+                    _state = State::CLOSE_DELIMITER;
+                else
+                    SetError("invalid character after boundary");
+                return;
+            }
+        }
+        // 接收part头部直到空行，头部完整后交给回调并进入PART_BODY状态
+        // _part_header以分隔符后的"\r\n"开头，因此头部为空时也能统一按"\r\n\r\n"查找结尾
+        void ScanPartHeader(const char *&cur, const char *end)
+        {
+            size_t old_size = _part_header.size();
+            _part_header.append(cur, end - cur);
+            size_t pos = _part_header.find("\r\n\r\n", old_size < 3 ? 0 : old_size - 3);
+            if (pos == std::string::npos)
+            {
+                cur = end;
+                if (_part_header.size() > MAX_PART_HEADER_SIZE)
+                    SetError("part header too large");
+                return;
+            }
+            cur = end - (_part_header.size() - pos - 4);
+            // 头部为空时"\r\n\r\n"出现在开头，pos为0，此时按没有任何头部字段的part交给回调
+            _part_header.resize(pos);
+            if (_on_part_begin && !_on_part_begin(pos < 2 ? std::string() : _part_header.substr(2)))
+            {
+                SetError("invalid part header");
+                return;
+            }
+            _part_header.clear();
+            _state = State::PART_BODY;
+        }
+
+    private:
+        State _state = State::PREAMBLE;
+        std::string _delimiter;                  // 完整的分隔符"\r\n--boundary"
+        std::array<size_t, 256> _skip_table;     // Boyer-Moore-Horspool的坏字符跳转表
+        std::string _lookbehind;                 // 上次数据结尾处可能是分隔符开头的部分
+        std::string _part_header;                // 正在接收的part头部
+        part_begin_cb_t _on_part_begin = nullptr;
+        part_data_cb_t _on_part_data = nullptr;
+        part_end_cb_t _on_part_end = nullptr;
+    };
+}
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef CLOUD_BACKUP_MULTIPART_UPLOAD_HPP
+#define CLOUD_BACKUP_MULTIPART_UPLOAD_HPP
+
+#include <set>
+#include <random>
+#include "data_manager.hpp"
+#include "file_writer.hpp"
+
+namespace cloud_backup
+{
+    // 一次分片上传，文件按固定的分片大小切分，第n片(从1开始)写入数据文件中(n-1)*part_size处，最后一片可以更小
+    // 暂存目录中"<id>.upload"保存上传信息，"<id>.data"为预先设置好大小的数据文件，"<id>.parts"为已完成分片的日志
+    struct MultipartUpload
+    {
+        using ptr = std::shared_ptr<MultipartUpload>;
+        std::string _id;
+        std::string _filename; // 上传完成后在备份目录中的文件名，创建上传时已在DataManager中注册
+        int64_t _size = 0;
+        int64_t _part_size = 0;
+        int _part_count = 0;
+        std::set<int> _done_parts;    // 数据已刷到磁盘并记录进日志的分片
+        std::set<int> _writing_parts; // 正在写入的分片，同一分片同一时刻只允许一个请求写入
+
+        // 第part_number片在数据文件中的偏移和长度
+        int64_t PartOffset(int part_number) const { return (part_number - 1) * _part_size; }
+        int64_t PartLength(int part_number) const { return std::min(_part_size, _size - PartOffset(part_number)); }
+    };
+
+    // 管理所有分片上传的单例类，各分片可以通过多个连接并发上传，每个分片以pwrite写入数据文件中自己的区域
+    // 分片数据fdatasync之后才在日志中追加一条完成记录，服务器崩溃重启后按日志恢复，日志中没有的分片需要重新上传
+    class MultipartUploadManager
+    {
+    public:
+        using ptr = std::shared_ptr<MultipartUploadManager>;
+        ~MultipartUploadManager() {}
+        static MultipartUploadManager::ptr GetInstance()
+        {
+            static MultipartUploadManager::ptr manager(new MultipartUploadManager());
+            if (manager == nullptr)
+                LOG_FATAL("create MultipartUploadManager object fail");
+            return manager;
+        }
+
+        // 为已在DataManager中注册的文件名创建分片上传，数据文件会预先分配磁盘空间并设置为文件的总大小，失败返回nullptr
+        MultipartUpload::ptr Create(const std::string &filename, int64_t size, int64_t part_size)
+        {
+            MultipartUpload::ptr upload = std::make_shared<MultipartUpload>();
+            upload->_id = NewUploadId();
+            upload->_filename = filename;
+            upload->_size = size;
+            upload->_part_size = part_size;
+            upload->_part_count = size == 0 ? 0 : (size + part_size - 1) / part_size;
+            int fd = open(DataFilePath(upload->_id).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            bool ret = fd != -1 && LargeFileIO::Preallocate(fd, 0, size) && ftruncate(fd, size) == 0;
+            if (fd != -1)
+                close(fd);
+            if (!ret || !SaveUpload(*upload))
+            {
+                LOG_ERROR("MultipartUploadManager Create error, create data file failed, filename:%s", filename.c_str());
+                RemoveUploadFiles(upload->_id);
+                return nullptr;
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            _uploads[upload->_id] = upload;
+            return upload;
+        }
+        MultipartUpload::ptr Get(const std::string &id)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _uploads.find(id);
+            return it == _uploads.end() ? nullptr : it->second;
+        }
+        // 获取已完成的分片编号
+        void GetDoneParts(const MultipartUpload::ptr &upload, std::vector<int> *parts)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            parts->assign(upload->_done_parts.begin(), upload->_done_parts.end());
+        }
+        // 开始写入一个分片，分片正在被其他请求写入或上传已结束时返回false
+        // 重新上传已完成的分片时先在日志中撤销其完成记录，写入过程中崩溃不会把写了一半的数据当作已完成
+        bool BeginPart(const MultipartUpload::ptr &upload, int part_number)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_uploads.count(upload->_id) == 0 || upload->_writing_parts.count(part_number))
+                return false;
+            if (upload->_done_parts.count(part_number))
+            {
+                if (!AppendPartRecord(upload->_id, '-', part_number))
+                    return false;
+                upload->_done_parts.erase(part_number);
+            }
+            upload->_writing_parts.insert(part_number);
+            return true;
+        }
+        // 结束一个分片的写入，success表示分片数据已完整写入并刷到磁盘上，此时记录分片完成，失败返回false
+        bool EndPart(const MultipartUpload::ptr &upload, int part_number, bool success)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            upload->_writing_parts.erase(part_number);
+            if (!success)
+                return true;
+            if (!AppendPartRecord(upload->_id, '+', part_number))
+                return false;
+            upload->_done_parts.insert(part_number);
+            return true;
+        }
+        // 所有分片都已完成且没有正在写入的分片时，将数据文件移到上传临时路径并Insert进DataManager，否则返回false
+        // Insert需要计算校验信息并等待落盘，在释放_mutex之后进行，不阻塞其他分片上传；Insert失败时注销文件名并删除临时文件
+        bool Complete(const MultipartUpload::ptr &upload)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_uploads.count(upload->_id) == 0 || !upload->_writing_parts.empty() ||
+                    (int)upload->_done_parts.size() != upload->_part_count)
+                    return false;
+                if (rename(DataFilePath(upload->_id).c_str(), BackupPathResolver::UploadingPath(upload->_filename).c_str()) == -1)
+                {
+                    LOG_ERROR("MultipartUploadManager Complete error, rename error:%d message:%s", errno, strerror(errno));
+                    return false;
+                }
+                RemoveUploadFiles(upload->_id);
+                _uploads.erase(upload->_id);
+            }
+            if (!DataManager::GetInstance()->Insert(upload->_filename, upload->_size))
+            {
+                LOG_ERROR("MultipartUploadManager Complete error, Insert fail, filename:%s", upload->_filename.c_str());
+                DataManager::GetInstance()->Deregister(upload->_filename);
+                return false;
+            }
+            LOG_INFO("multipart upload:%s completed, filename:%s", upload->_id.c_str(), upload->_filename.c_str());
+            return true;
+        }
+        // 放弃一次分片上传，删除所有暂存数据并注销文件名，上传不存在或还有分片正在写入时返回false
+        bool Abort(const std::string &id)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _uploads.find(id);
+            if (it == _uploads.end() || !it->second->_writing_parts.empty())
+                return false;
+            RemoveUploadFiles(id);
+            if (!DataManager::GetInstance()->Deregister(it->second->_filename))
+                LOG_ERROR("MultipartUploadManager Abort error, Deregister fail, filename:%s", it->second->_filename.c_str());
+            _uploads.erase(it);
+            return true;
+        }
+        std::string DataFilePath(const std::string &id) { return _staging_dir + id + ".data"; }
+
+    private:
+        MultipartUploadManager() : _staging_dir(Config::GetInstance()->GetUploadStagingDir())
+        {
+            if (_staging_dir.back() != '/')
+                _staging_dir += '/';
+            _staging_dir += "multipart/";
+            if (!FileUtil(_staging_dir).CreateDirectories())
+                LOG_ERROR("MultipartUploadManager initialization error, create staging dir failed: %s", _staging_dir.c_str());
+            LoadUploads();
+            LOG_INFO("MultipartUploadManager initialized successfully, loaded %zu upload", _uploads.size());
+        }
+        MultipartUploadManager(const MultipartUploadManager &) = delete;
+        MultipartUploadManager &operator=(const MultipartUploadManager &) = delete;
+
+        static std::string NewUploadId()
+        {
+            static std::mutex random_mutex;
+            static std::mt19937_64 random_engine(std::random_device{}());
+            uint64_t high, low;
+            {
+                std::unique_lock<std::mutex> lock(random_mutex);
+                high = random_engine();
+                low = random_engine();
+            }
+            char id[33];
+            snprintf(id, sizeof(id), "%016llx%016llx", (unsigned long long)high, (unsigned long long)low);
+            return id;
+        }
+        std::string InfoFilePath(const std::string &id) { return _staging_dir + id + ".upload"; }
+        std::string PartsFilePath(const std::string &id) { return _staging_dir + id + ".parts"; }
+        // 上传信息创建后不再修改，写入临时文件后rename，保证信息文件存在时一定是完整的
+        bool SaveUpload(const MultipartUpload &upload)
+        {
+            Json::Value root;
+            root["id"] = upload._id;
+            root["filename"] = upload._filename;
+            root["size"] = (Json::Int64)upload._size;
+            root["part_size"] = (Json::Int64)upload._part_size;
+            std::string content;
+            if (!JsonUtil::Serialize(root, &content))
+                return false;
+            std::string tmp_path = InfoFilePath(upload._id) + ".tmp";
+            if (!FileUtil(tmp_path).AppendContent(content))
+                return false;
+            if (rename(tmp_path.c_str(), InfoFilePath(upload._id).c_str()) == -1)
+            {
+                LOG_ERROR("MultipartUploadManager SaveUpload error, rename error:%d message:%s", errno, strerror(errno));
+                return false;
+            }
+            return true;
+        }
+        // 在分片日志中追加一条记录"+n"(分片完成)或"-n"(撤销完成)并刷到磁盘上
+        bool AppendPartRecord(const std::string &id, char op, int part_number)
+        {
+            std::string record = op + std::to_string(part_number) + '\n';
+            int fd = open(PartsFilePath(id).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd == -1)
+            {
+                LOG_ERROR("MultipartUploadManager AppendPartRecord error, open error:%d message:%s", errno, strerror(errno));
+                return false;
+            }
+            bool ret = write(fd, record.c_str(), record.size()) == (ssize_t)record.size() && fdatasync(fd) == 0;
+            if (!ret)
+                LOG_ERROR("MultipartUploadManager AppendPartRecord error, write error:%d message:%s", errno, strerror(errno));
+            close(fd);
+            return ret;
+        }
+        void RemoveUploadFiles(const std::string &id)
+        {
+            unlink(DataFilePath(id).c_str());
+            unlink(PartsFilePath(id).c_str());
+            unlink(InfoFilePath(id).c_str());
+        }
+        // 初始化时按上传信息和分片日志恢复所有未完成的分片上传并重新注册其文件名，无法恢复的上传和残留文件都会被删除
+        void LoadUploads()
+        {
+            std::vector<FileUtil> files;
+            if (!FileUtil(_staging_dir).ScanDirectory(&files))
+                return;
+            for (auto &file : files)
+            {
+                std::string name = file.GetFileName();
+                if (name.size() <= 7 || name.substr(name.size() - 7) != ".upload")
+                    continue;
+                std::string id = name.substr(0, name.size() - 7);
+                std::string content;
+                Json::Value root;
+                MultipartUpload::ptr upload = std::make_shared<MultipartUpload>();
+                if (file.GetContent(&content) && JsonUtil::Deserialize(content, &root))
+                {
+                    upload->_id = root["id"].asString();
+                    upload->_filename = root["filename"].asString();
+                    upload->_size = root["size"].asInt64();
+                    upload->_part_size = root["part_size"].asInt64();
+                }
+                if (upload->_id != id || upload->_part_size <= 0 || FileUtil(DataFilePath(id)).GetFileSize() != upload->_size ||
+                    !DataManager::GetInstance()->Register(upload->_filename))
+                {
+                    LOG_WARN("MultipartUploadManager drop upload:%s", id.c_str());
+                    RemoveUploadFiles(id);
+                    continue;
+                }
+                upload->_part_count = upload->_size == 0 ? 0 : (upload->_size + upload->_part_size - 1) / upload->_part_size;
+                std::string records;
+                FileUtil parts_file(PartsFilePath(id));
+                if (parts_file.Exists() && parts_file.GetContent(&records))
+                {
+                    size_t pos = 0;
+                    while (pos < records.size())
+                    {
+                        size_t line_end = records.find('\n', pos);
+                        if (line_end == std::string::npos) // 最后一条记录没有写完整，视为不存在
+                            break;
+                        int part_number = atoi(records.c_str() + pos + 1);
+                        if (records[pos] == '+' && part_number >= 1 && part_number <= upload->_part_count)
+                            upload->_done_parts.insert(part_number);
+                        else if (records[pos] == '-')
+                            upload->_done_parts.erase(part_number);
+                        pos = line_end + 1;
+                    }
+                }
+                _uploads[id] = upload;
+            }
+            for (auto &file : files)
+            {
+                std::string name = file.GetFileName();
+                size_t dot_pos = name.find('.');
+                if (dot_pos == std::string::npos || _uploads.count(name.substr(0, dot_pos)) == 0)
+                    file.RemoveRegularFile();
+            }
+        }
+
+    private:
+        std::string _staging_dir;
+        std::unordered_map<std::string, MultipartUpload::ptr> _uploads;
+        std::mutex _mutex; // 保护_uploads以及其中每个上传的分片状态
+    };
+
+    // 一个分片的写入，数据按位置写入数据文件中该分片的区域，析构时若没有成功结束则放弃本次写入
+    class MultipartPartWriter
+    {
+    public:
+        MultipartPartWriter(MultipartUpload::ptr upload, int part_number)
+            : _upload(std::move(upload)), _part_number(part_number) {}
+        ~MultipartPartWriter()
+        {
+            if (!_is_ended)
+                MultipartUploadManager::GetInstance()->EndPart(_upload, _part_number, false);
+        }
+        bool Open()
+        {
+            if (!_writer.OpenAt(MultipartUploadManager::GetInstance()->DataFilePath(_upload->_id), _upload->PartOffset(_part_number)))
+                return false;
+            _writer.SetCachePolicy(_upload->_size);
+            return true;
+        }
+        // 写入数据，超出分片长度时返回false
+        bool Write(const char *data, size_t len)
+        {
+            if (_writer.Size() + (int64_t)len > _upload->PartLength(_part_number))
+            {
+                LOG_WARN("multipart upload:%s part:%d body exceeds part length", _upload->_id.c_str(), _part_number);
+                return false;
+            }
+            return _writer.Write(data, len);
+        }
+        // 分片数据写完后调用，数据长度正确且已刷到磁盘上时记录分片完成，否则返回false
+        bool End()
+        {
+            _is_ended = true;
+            bool success = _writer.Size() == _upload->PartLength(_part_number) && _writer.Sync() && _writer.Close();
+            if (!success)
+                LOG_WARN("multipart upload:%s part:%d write incomplete", _upload->_id.c_str(), _part_number);
+            return MultipartUploadManager::GetInstance()->EndPart(_upload, _part_number, success) && success;
+        }
+        int LastError() { return _writer.LastError(); }
+
+    private:
+        MultipartUpload::ptr _upload;
+        int _part_number;
+        FileWriter _writer;
+        bool _is_ended = false;
+    };
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef CLOUD_BACKUP_OUTPUT_BUFFER_HPP
+#define CLOUD_BACKUP_OUTPUT_BUFFER_HPP
+
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <string_view>
+#include <sys/uio.h>
+#include "util.hpp"
+
+namespace cloud_backup
+{
+    // 发送缓冲区使用的字符串缓冲池单例类，用于复用构建响应头等小块数据的内存，避免每次响应都重新申请堆内存
+    class BufferPool
+    {
+    public:
+        static const size_t DEFAULT_BUFFER_CAPACITY = 4 * 1024; // 新建缓冲区的初始容量
+        static const size_t MAX_BUFFER_CAPACITY = 64 * 1024;    // 超过该容量的缓冲区不回收，避免缓冲池长期占用大块内存
+        static const size_t MAX_POOL_SIZE = 1024;               // 缓冲池中最多保留的缓冲区数量
+
+        static BufferPool &GetInstance()
+        {
+            static BufferPool pool;
+            return pool;
+        }
+        // 获取一个已清空的缓冲区，缓冲池为空时新建一个
+        std::string Acquire()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (!_buffers.empty())
+                {
+                    std::string buffer = std::move(_buffers.back());
+                    _buffers.pop_back();
+                    return buffer;
+                }
+            }
+            std::string buffer;
+            buffer.reserve(DEFAULT_BUFFER_CAPACITY);
+            return buffer;
+        }
+        // 将使用完的缓冲区归还给缓冲池
+        void Release(std::string &&buffer)
+        {
+            if (buffer.capacity() < DEFAULT_BUFFER_CAPACITY || buffer.capacity() > MAX_BUFFER_CAPACITY)
+                return;
+            buffer.clear();
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_buffers.size() < MAX_POOL_SIZE)
+                _buffers.push_back(std::move(buffer));
+        }
+
+    private:
+        BufferPool() {}
+        BufferPool(const BufferPool &) = delete;
+        BufferPool &operator=(const BufferPool &) = delete;
+
+        std::vector<std::string> _buffers;
+        std::mutex _mutex;
+    };
+
+    // 发送缓冲区中的一段数据，数据来源有三种:
+    // 自己持有的字符串(发送完后归还缓冲池)、共享的只读字符串中的一段(如LRU中缓存的文件内容)、静态存储的字符串(如预先生成的状态行)
+    class OutputSegment
+    {
+    public:
+        explicit OutputSegment(std::string &&owned) : _owned(std::move(owned)) {}
+        OutputSegment(std::shared_ptr<const std::string> shared, size_t offset, size_t len)
+            : _shared(std::move(shared)), _static_data(_shared->data() + offset), _len(len) {}
+        explicit OutputSegment(std::string_view static_data) : _static_data(static_data.data()), _len(static_data.size()) {}
+
+        const char *Data() const { return (_static_data != nullptr ? _static_data : _owned.data()) + _sent; }
+        size_t Size() const { return (_static_data != nullptr ? _len : _owned.size()) - _sent; }
+        // 标记该段数据又有len字节已经发送
+        void Consume(size_t len) { _sent += len; }
+        // 释放该段数据持有的资源
+        void Recycle()
+        {
+            if (_static_data == nullptr)
+                BufferPool::GetInstance().Release(std::move(_owned));
+        }
+
+    private:
+        std::string _owned;
+        std::shared_ptr<const std::string> _shared;
+        const char *_static_data = nullptr; // 共享或静态数据的起始位置，为nullptr时表示数据在_owned中
+        size_t _len = 0;
+        size_t _sent = 0;
+    };
+
+    // 连接的发送缓冲区，由若干段数据组成，发送时通过writev一次性写出多段数据，各段数据不需要拼接成一个大字符串
+    class OutputBuffer
+    {
+    public:
+        static const int MAX_IOVEC_COUNT = 64; // 单次writev最多写出的数据段数
+
+        void Append(std::string &&owned)
+        {
+            if (owned.empty())
+                return;
+            _size += owned.size();
+            _segments.emplace_back(std::move(owned));
+        }
+        void Append(std::shared_ptr<const std::string> shared, size_t offset, size_t len)
+        {
+            if (shared == nullptr || len == 0)
+                return;
+            _size += len;
+            _segments.emplace_back(std::move(shared), offset, len);
+        }
+        void AppendStatic(std::string_view static_data)
+        {
+            if (static_data.empty())
+                return;
+            _size += static_data.size();
+            _segments.emplace_back(static_data);
+        }
+        bool Empty() const { return _size == 0; }
+        size_t Size() const { return _size; }
+        // 将缓冲区中的数据通过writev写入fd，返回值与writev相同，已写出的数据会从缓冲区中移除
+        ssize_t WriteTo(int fd)
+        {
+            struct iovec iov[MAX_IOVEC_COUNT];
+            int iov_count = 0;
+            for (auto it = _segments.begin(); it != _segments.end() && iov_count < MAX_IOVEC_COUNT; ++it, ++iov_count)
+            {
+                iov[iov_count].iov_base = const_cast<char *>(it->Data());
+                iov[iov_count].iov_len = it->Size();
+            }
+            ssize_t write_bytes = writev(fd, iov, iov_count);
+            if (write_bytes > 0)
+                Consume(write_bytes);
+            return write_bytes;
+        }
+
+    private:
+        void Consume(size_t len)
+        {
+            _size -= len;
+            while (len > 0)
+            {
+                OutputSegment &front = _segments.front();
+                size_t n = std::min(len, front.Size());
+                front.Consume(n);
+                len -= n;
+                if (front.Size() == 0)
+                {
+                    front.Recycle();
+                    _segments.pop_front();
+                }
+            }
+        }
+
+    private:
+        std::deque<OutputSegment> _segments;
+        size_t _size = 0;
+    };
+}
+
+#endif
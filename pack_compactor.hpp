@@ -0,0 +1,135 @@
+#ifndef CLOUD_BACKUP_PACK_COMPACTOR_HPP
+#define CLOUD_BACKUP_PACK_COMPACTOR_HPP
+
+#include <condition_variable>
+#include "data_manager.hpp"
+
+namespace cloud_backup
+{
+    // 整理包文件的后台线程，只在开启pack_enable时启动
+    // 每隔pack_compact_interval秒把垃圾占比达到pack_compact_ratio的包文件中的存活记录复制到当前写入的包文件，再由DataManager::RelocatePacked切换索引
+    // 被整理的包文件在所有记录都切换后不再有存活记录，下一轮整理时连同其他没有存活记录的包文件一起删除
+    class PackCompactor
+    {
+    public:
+        using ptr = std::shared_ptr<PackCompactor>;
+
+        ~PackCompactor()
+        {
+            if (!_compact_thread.joinable())
+                return;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _is_stop = true;
+            }
+            _cond.notify_all();
+            _compact_thread.join();
+        }
+        static PackCompactor::ptr GetInstance()
+        {
+            static PackCompactor::ptr compactor(new PackCompactor());
+            if (compactor == nullptr)
+                LOG_FATAL("create PackCompactor object fail");
+            return compactor;
+        }
+
+    private:
+        PackCompactor()
+        {
+            if (!Config::GetInstance()->GetPackEnable())
+                return;
+            DataManager::GetInstance();
+            _compact_thread = std::thread(&PackCompactor::CompactThread, this);
+        }
+        PackCompactor(const PackCompactor &) = delete;
+        PackCompactor &operator=(const PackCompactor &) = delete;
+
+        void CompactThread()
+        {
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if (_cond.wait_for(lock, std::chrono::seconds(std::max(Config::GetInstance()->GetPackCompactInterval(), 1)), [&]()
+                                       { return _is_stop; }))
+                        return;
+                }
+                size_t removed = PackStore::GetInstance()->RemoveEmptyPacks();
+                if (removed > 0)
+                    LOG_INFO("PackCompactor removed %zu empty pack", removed);
+                for (uint32_t pack_id : PackStore::GetInstance()->CompactCandidates())
+                {
+                    if (IsStopped())
+                        return;
+                    CompactPack(pack_id);
+                }
+            }
+        }
+        // 把包文件中仍被引用的记录复制到当前写入的包文件，落盘后逐个切换索引，切换失败(文件已被删除或替换)的新记录立即释放
+        void CompactPack(uint32_t pack_id)
+        {
+            CachedFd::ptr pack = FdCache::GetInstance()->Open(PackStore::GetInstance()->PackPath(pack_id));
+            if (pack == nullptr)
+                return;
+            std::vector<DataManagerNode::ptr> nodes;
+            DataManager::GetInstance()->GetAllFileInfoNodes(&nodes);
+            struct MovedRecord
+            {
+                DataManagerNode::ptr _node;
+                uint32_t _pack_id;
+                int64_t _offset;
+            };
+            std::vector<MovedRecord> moved;
+            std::vector<uint32_t> new_pack_ids;
+            std::string content;
+            for (auto &node : nodes)
+            {
+                const BackupInfoNode &info = node->_info;
+                if (info._storage != FileStorageType::PACKED || info._pack_id != pack_id)
+                    continue;
+                if (IsStopped())
+                    break;
+                content.resize(info._size);
+                if (!pack->ReadAt(content.data(), content.size(), info._pack_offset))
+                {
+                    LOG_ERROR("PackCompactor error, read file:%s from pack:%u failed", info._filename.c_str(), pack_id);
+                    continue;
+                }
+                MovedRecord record{node, 0, 0};
+                if (!PackStore::GetInstance()->Append(info._filename, content, &record._pack_id, &record._offset))
+                    break;
+                if (new_pack_ids.empty() || new_pack_ids.back() != record._pack_id)
+                    new_pack_ids.push_back(record._pack_id);
+                moved.push_back(std::move(record));
+            }
+            if (!moved.empty() && !PackStore::GetInstance()->Sync(new_pack_ids))
+            {
+                for (auto &record : moved)
+                    PackStore::GetInstance()->Release(record._node->_info._filename, record._pack_id, record._node->_info._size);
+                return;
+            }
+            size_t count = 0;
+            for (auto &record : moved)
+            {
+                if (DataManager::GetInstance()->RelocatePacked(record._node, record._pack_id, record._offset))
+                    count++;
+                else
+                    PackStore::GetInstance()->Release(record._node->_info._filename, record._pack_id, record._node->_info._size);
+            }
+            LOG_INFO("PackCompactor compacted pack:%u, moved %zu record", pack_id, count);
+        }
+        bool IsStopped()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _is_stop;
+        }
+
+    private:
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        bool _is_stop = false;
+        std::thread _compact_thread;
+    };
+}
+
+#endif
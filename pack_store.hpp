@@ -0,0 +1,270 @@
+#ifndef CLOUD_BACKUP_PACK_STORE_HPP
+#define CLOUD_BACKUP_PACK_STORE_HPP
+
+#include <mutex>
+#include <map>
+#include "util.hpp"
+#include "config.hpp"
+#include "fd_cache.hpp"
+#include "group_commit.hpp"
+
+namespace cloud_backup
+{
+    // 包文件中的一条记录在索引中的信息，记录的内容长度就是文件大小
+    struct PackRecord
+    {
+        std::string _filename;
+        uint32_t _pack_id;
+        int64_t _offset; // 文件内容在包文件中的起始位置(不含记录头)
+        int64_t _size;
+    };
+
+    // 小文件的包文件存储单例类: 小于pack_max_file_size的文件作为一条记录追加到当前写入的包文件末尾，不再单独占用一个文件
+    // 记录的格式为 <"CBPK"> <uint32 文件名长度> <uint64 内容长度> <文件名> <内容>(整数均为小端序)，记录头只用于人工排查和恢复
+    // 文件到包文件位置的索引保存在DataManager的节点中并随其持久化，包文件只追加不修改，读取时直接通过FdCache中的描述符pread
+    // 只统计每个包文件中存活记录的字节数，删除或整理掉的记录成为垃圾，由PackCompactor把存活记录复制走后整个包文件一起删除
+    class PackStore
+    {
+    public:
+        using ptr = std::shared_ptr<PackStore>;
+        static const int64_t RECORD_HEADER_SIZE = 16;
+
+        ~PackStore()
+        {
+            if (_active_fd != -1)
+                close(_active_fd);
+        }
+        static PackStore::ptr GetInstance()
+        {
+            static PackStore::ptr store(new PackStore());
+            if (store == nullptr)
+                LOG_FATAL("create PackStore object fail");
+            return store;
+        }
+
+        // 开启包文件存储时小于pack_max_file_size的文件保存到包文件中
+        static bool ShouldPack(int64_t filesize)
+        {
+            return Config::GetInstance()->GetPackEnable() && filesize >= 0 && filesize < Config::GetInstance()->GetPackMaxFileSize();
+        }
+        std::string PackPath(uint32_t pack_id) { return _pack_dir + std::to_string(pack_id) + ".pack"; }
+
+        // 把filepath处的完整文件追加到包文件中并等待落盘，*pack_id和*offset返回内容在包文件中的位置，失败返回false
+        bool AppendFile(const std::string &filename, const std::string &filepath, int64_t filesize, uint32_t *pack_id, int64_t *offset)
+        {
+            std::string content;
+            if (!FileUtil(filepath).GetContent(&content) || (int64_t)content.size() != filesize)
+            {
+                LOG_ERROR("PackStore AppendFile error, read file:%s failed", filepath.c_str());
+                return false;
+            }
+            if (!Append(filename, content, pack_id, offset))
+                return false;
+            if (!Sync({*pack_id}))
+            {
+                Release(filename, *pack_id, filesize);
+                return false;
+            }
+            return true;
+        }
+        // 把一条记录追加到当前写入的包文件末尾，当前包文件达到pack_file_size时先换一个新的包文件，不等待落盘，失败返回false
+        bool Append(const std::string &filename, const std::string &content, uint32_t *pack_id, int64_t *offset)
+        {
+            std::string record;
+            record.reserve(RECORD_HEADER_SIZE + filename.size() + content.size());
+            record.append(RECORD_MAGIC);
+            AppendUint(filename.size(), 4, &record);
+            AppendUint(content.size(), 8, &record);
+            record.append(filename);
+            record.append(content);
+            std::unique_lock<std::mutex> lock(_mutex);
+            if ((_active_fd == -1 || _packs[_active_id]._size >= Config::GetInstance()->GetPackFileSize()) && !OpenNewPack())
+                return false;
+            PackInfo &pack = _packs[_active_id];
+            // 写入失败时不推进包文件大小，残留的部分内容会被下一条记录覆盖
+            for (size_t written = 0; written < record.size();)
+            {
+                ssize_t write_bytes = pwrite(_active_fd, record.data() + written, record.size() - written, pack._size + written);
+                if (write_bytes < 0 && errno == EINTR)
+                    continue;
+                if (write_bytes < 0)
+                {
+                    LOG_ERROR("PackStore Append error, write pack:%u error:%d message:%s", _active_id, errno, strerror(errno));
+                    return false;
+                }
+                written += write_bytes;
+            }
+            *pack_id = _active_id;
+            *offset = pack._size + RECORD_HEADER_SIZE + filename.size();
+            pack._size += record.size();
+            pack._live_bytes += record.size();
+            return true;
+        }
+        // 等待包文件中已追加的记录落盘，失败返回false
+        bool Sync(const std::vector<uint32_t> &pack_ids)
+        {
+            std::vector<std::string> paths;
+            for (uint32_t pack_id : pack_ids)
+                paths.push_back(PackPath(pack_id));
+            if (!GroupCommitter::GetInstance()->Sync(paths))
+            {
+                LOG_ERROR("PackStore Sync error, sync pack file failed");
+                return false;
+            }
+            return true;
+        }
+        // 文件不再引用其在包文件中的记录，不再有存活记录的包文件等到下一轮整理时删除(当前写入的包文件除外)
+        // 此时指向新位置的索引早已写入数据管理器文件，中途异常退出也不会留下指向已删除包文件的索引
+        void Release(const std::string &filename, uint32_t pack_id, int64_t size)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _packs.find(pack_id);
+            if (it == _packs.end())
+                return;
+            it->second._live_bytes -= RECORD_HEADER_SIZE + filename.size() + size;
+        }
+        // 启动时根据所有包文件存储的文件的索引统计每个包文件中存活记录的字节数，并删除没有存活记录的包文件
+        // 位置超出包文件范围(包文件丢失或被截断)的记录的文件名放入lost中，由调用者删除其索引
+        void Recover(const std::vector<PackRecord> &records, std::vector<std::string> *lost)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (auto &record : records)
+            {
+                auto it = _packs.find(record._pack_id);
+                int64_t record_size = RECORD_HEADER_SIZE + record._filename.size() + record._size;
+                if (it == _packs.end() || record._offset < (int64_t)(RECORD_HEADER_SIZE + record._filename.size()) ||
+                    record._offset + record._size > it->second._size)
+                {
+                    LOG_ERROR("PackStore Recover error, record of file:%s is out of pack:%u", record._filename.c_str(), record._pack_id);
+                    lost->push_back(record._filename);
+                    continue;
+                }
+                it->second._live_bytes += record_size;
+            }
+            lock.unlock();
+            size_t removed = RemoveEmptyPacks();
+            LOG_INFO("PackStore recovered %zu record, removed %zu empty pack", records.size() - lost->size(), removed);
+        }
+        // 删除不再有存活记录的包文件，返回删除的包文件数量，由整理线程定期调用
+        size_t RemoveEmptyPacks()
+        {
+            size_t removed = 0;
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (auto it = _packs.begin(); it != _packs.end();)
+            {
+                if (it->second._live_bytes > 0 || (_active_fd != -1 && it->first == _active_id))
+                {
+                    ++it;
+                    continue;
+                }
+                std::string pack_path = PackPath(it->first);
+                if (unlink(pack_path.c_str()) == -1 && errno != ENOENT)
+                    LOG_WARN("PackStore remove pack:%s error:%d message:%s", pack_path.c_str(), errno, strerror(errno));
+                FdCache::GetInstance()->Invalidate(pack_path);
+                it = _packs.erase(it);
+                removed++;
+            }
+            return removed;
+        }
+        // 获取垃圾占比达到pack_compact_ratio的包文件，按垃圾占比从高到低排列，不包括当前写入的包文件
+        std::vector<uint32_t> CompactCandidates()
+        {
+            double ratio = Config::GetInstance()->GetPackCompactRatio();
+            std::vector<std::pair<double, uint32_t>> candidates;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                for (auto &[pack_id, pack] : _packs)
+                {
+                    if ((_active_fd != -1 && pack_id == _active_id) || pack._size == 0 || pack._live_bytes <= 0)
+                        continue;
+                    double garbage = 1.0 - (double)pack._live_bytes / pack._size;
+                    if (garbage >= ratio)
+                        candidates.emplace_back(garbage, pack_id);
+                }
+            }
+            std::sort(candidates.begin(), candidates.end(), std::greater<>());
+            std::vector<uint32_t> pack_ids;
+            for (auto &candidate : candidates)
+                pack_ids.push_back(candidate.second);
+            return pack_ids;
+        }
+
+    private:
+        // 按小端序把value的低len字节追加到out
+        static void AppendUint(uint64_t value, int len, std::string *out)
+        {
+            for (int i = 0; i < len; i++)
+                out->push_back(static_cast<char>(value >> (i * 8) & 0xff));
+        }
+
+        PackStore() : _pack_dir(Config::GetInstance()->GetPackDir())
+        {
+            if (_pack_dir.back() != '/')
+                _pack_dir += '/';
+            if (!FileUtil(_pack_dir).CreateDirectories())
+                LOG_ERROR("PackStore initialization error, create pack dir failed: %s", _pack_dir.c_str());
+            ScanPacks();
+        }
+        PackStore(const PackStore &) = delete;
+        PackStore &operator=(const PackStore &) = delete;
+
+        // 初始化时登记包目录中已有的包文件(存活字节数为0，等待Recover统计)，删除其他文件
+        // 重启后总是写入新的包文件，上次写入的包文件末尾可能残留异常退出时没有写完的记录
+        void ScanPacks()
+        {
+            std::vector<FileUtil> files;
+            if (!FileUtil(_pack_dir).ScanDirectory(&files))
+                return;
+            for (auto &file : files)
+            {
+                std::string name = file.GetFileName();
+                char *end = nullptr;
+                unsigned long pack_id = strtoul(name.c_str(), &end, 10);
+                if (name.empty() || !isdigit(name[0]) || std::string(end) != ".pack")
+                {
+                    file.RemoveRegularFile();
+                    continue;
+                }
+                _packs[pack_id]._size = file.GetFileSize();
+                _next_id = std::max<uint32_t>(_next_id, pack_id + 1);
+            }
+        }
+        // 需要持有_mutex时调用
+        bool OpenNewPack()
+        {
+            uint32_t pack_id = _next_id;
+            std::string pack_path = PackPath(pack_id);
+            int fd = open(pack_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd == -1)
+            {
+                LOG_ERROR("PackStore error, create pack:%s error:%d message:%s", pack_path.c_str(), errno, strerror(errno));
+                return false;
+            }
+            if (_active_fd != -1)
+                close(_active_fd);
+            _active_fd = fd;
+            _active_id = pack_id;
+            _next_id = pack_id + 1;
+            _packs[pack_id] = PackInfo();
+            FdCache::GetInstance()->Invalidate(pack_path);
+            return true;
+        }
+
+    private:
+        inline static const std::string RECORD_MAGIC = "CBPK";
+
+        struct PackInfo
+        {
+            int64_t _size = 0;       // 包文件中已写入的字节数
+            int64_t _live_bytes = 0; // 仍被文件引用的记录(含记录头)的字节数
+        };
+        std::string _pack_dir;
+        std::map<uint32_t, PackInfo> _packs; // 包文件编号到包文件信息的映射，包含包目录中的所有包文件
+        uint32_t _active_id = 0;             // 当前写入的包文件编号，_active_fd为-1时还没有打开过包文件
+        uint32_t _next_id = 0;               // 下一个新的包文件的编号，大于包目录中已有的所有编号
+        int _active_fd = -1;
+        std::mutex _mutex;                   // 保护_packs和当前写入的包文件
+    };
+}
+
+#endif
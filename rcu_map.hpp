@@ -0,0 +1,291 @@
+#ifndef CLOUD_BACKUP_RCU_MAP_HPP
+#define CLOUD_BACKUP_RCU_MAP_HPP
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cloud_backup
+{
+    // 基于epoch的内存回收: 读者进入临界区时在自己的槽中登记当前的全局epoch，退出时清除，读取期间不修改任何共享的缓存行
+    // 写者把对象从数据结构中摘除后交给Retire，等到所有登记的epoch都大于对象被摘除时的epoch，即摘除之前进入的读者都已退出，才真正释放
+    // 每个线程第一次进入临界区时占用一个槽，线程退出后槽可以被其他线程复用，槽本身不会释放
+    class EpochReclaimer
+    {
+    private:
+        static const uint64_t IDLE_EPOCH = 0;
+
+        // 每个槽独占一条缓存行，读者只写自己的槽
+        struct alignas(64) Slot
+        {
+            std::atomic<uint64_t> _epoch = IDLE_EPOCH;
+            std::atomic<bool> _in_use = false;
+            Slot *_next = nullptr;
+        };
+        struct ThreadSlot
+        {
+            Slot *_slot = nullptr;
+            int _depth = 0;
+            ~ThreadSlot()
+            {
+                _slot->_epoch.store(IDLE_EPOCH, std::memory_order_release);
+                _slot->_in_use.store(false, std::memory_order_release);
+            }
+        };
+        struct RetiredObject
+        {
+            void *_ptr;
+            void (*_deleter)(void *);
+            uint64_t _epoch; // 对象被摘除时的全局epoch
+        };
+
+    public:
+        static const size_t RECLAIM_THRESHOLD = 64; // 等待释放的对象达到该数量时尝试回收一次
+
+        // 读者临界区，在其生命周期内读取到的对象不会被释放，允许嵌套
+        class Guard
+        {
+        public:
+            Guard() : _local(LocalSlot())
+            {
+                if (_local._depth++ == 0)
+                {
+                    _local._slot->_epoch.store(_global_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+                    // 保证登记epoch先于之后对数据结构的读取被写者看到
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                }
+            }
+            ~Guard()
+            {
+                if (--_local._depth == 0)
+                    _local._slot->_epoch.store(IDLE_EPOCH, std::memory_order_release);
+            }
+
+        private:
+            Guard(const Guard &) = delete;
+            Guard &operator=(const Guard &) = delete;
+
+            ThreadSlot &_local;
+        };
+
+        // 延迟释放已从数据结构中摘除的对象，deleter在确认没有读者还能访问到ptr后被调用
+        static void Retire(void *ptr, void (*deleter)(void *))
+        {
+            std::unique_lock<std::mutex> lock(_retire_mutex);
+            _retired.push_back({ptr, deleter, _global_epoch.load(std::memory_order_relaxed)});
+            if (_retired.size() >= RECLAIM_THRESHOLD)
+                Reclaim();
+        }
+        // 等待调用之前已进入临界区的读者全部退出，写者在标记对象失效之后、销毁对象引用的外部资源(例如删除文件)之前调用
+        // 调用者不能持有Guard，读者在临界区内也不能等待调用者持有的锁
+        static void Synchronize()
+        {
+            uint64_t epoch;
+            {
+                std::unique_lock<std::mutex> lock(_retire_mutex);
+                epoch = _global_epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (Slot *slot = _slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->_next)
+            {
+                for (;;)
+                {
+                    uint64_t slot_epoch = slot->_epoch.load(std::memory_order_acquire);
+                    if (slot_epoch == IDLE_EPOCH || slot_epoch >= epoch)
+                        break;
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+        static ThreadSlot &LocalSlot()
+        {
+            thread_local ThreadSlot local{AcquireSlot()};
+            return local;
+        }
+        // 复用空闲的槽，没有时新建一个加入槽链表
+        static Slot *AcquireSlot()
+        {
+            for (Slot *slot = _slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->_next)
+            {
+                bool expected = false;
+                if (!slot->_in_use.load(std::memory_order_relaxed) && slot->_in_use.compare_exchange_strong(expected, true))
+                    return slot;
+            }
+            Slot *slot = new Slot();
+            slot->_in_use = true;
+            slot->_next = _slots.load(std::memory_order_relaxed);
+            while (!_slots.compare_exchange_weak(slot->_next, slot, std::memory_order_release, std::memory_order_relaxed))
+                ;
+            return slot;
+        }
+        // 推进全局epoch，释放所有早于最小登记epoch被摘除的对象，需要持有_retire_mutex时调用
+        // Retire和推进epoch都在_retire_mutex下进行，读者读到推进后的epoch时一定也能看到推进之前的所有摘除
+        static void Reclaim()
+        {
+            _global_epoch.fetch_add(1, std::memory_order_acq_rel);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            uint64_t min_epoch = UINT64_MAX;
+            for (Slot *slot = _slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->_next)
+            {
+                uint64_t epoch = slot->_epoch.load(std::memory_order_acquire);
+                if (epoch != IDLE_EPOCH)
+                    min_epoch = std::min(min_epoch, epoch);
+            }
+            size_t kept = 0;
+            for (auto &object : _retired)
+            {
+                if (object._epoch < min_epoch)
+                    object._deleter(object._ptr);
+                else
+                    _retired[kept++] = object;
+            }
+            _retired.resize(kept);
+        }
+
+    private:
+        inline static std::atomic<uint64_t> _global_epoch = 1;
+        inline static std::atomic<Slot *> _slots = nullptr; // 所有线程的槽组成的链表，只在头部插入
+        inline static std::mutex _retire_mutex;             // 保护_retired并串行化epoch的推进
+        inline static std::vector<RetiredObject> _retired;  // 等待释放的对象
+    };
+
+    // 以字符串为键的读写分离哈希表: 读取不加锁也不写共享内存，写入需要由调用者串行化(例如持有外部的写锁)
+    // 查找返回指向表中值的指针而不拷贝值(拷贝shared_ptr会修改所有读者共享的引用计数)，调用者需要在EpochReclaimer::Guard内查找和使用
+    // 采用链式哈希，写入只修改链表指针，被替换或删除的节点以及扩容后的旧桶数组通过EpochReclaimer延迟释放
+    // 节点发布后不再修改，值的更新通过替换整个节点完成，读者读到的值总是某一次写入的完整结果
+    template <typename Value>
+    class RcuMap
+    {
+    public:
+        static const size_t INITIAL_BUCKET_COUNT = 16;
+
+        RcuMap() : _table(new Table(INITIAL_BUCKET_COUNT)) {}
+        ~RcuMap() { DeleteTable(_table.load(std::memory_order_relaxed)); }
+
+        // 查找键对应的值，不存在时返回nullptr，可以与写入并发调用
+        // 调用者必须持有EpochReclaimer::Guard，返回的指针只在该Guard的生命周期内有效，需要更久地使用值时在Guard内拷贝
+        const Value *Find(const std::string &key) const
+        {
+            size_t hash = std::hash<std::string>()(key);
+            Table *table = _table.load(std::memory_order_acquire);
+            for (Entry *entry = table->Bucket(hash).load(std::memory_order_acquire); entry != nullptr; entry = entry->_next.load(std::memory_order_acquire))
+            {
+                if (entry->_hash == hash && entry->_key == key)
+                    return &entry->_value;
+            }
+            return nullptr;
+        }
+        // 插入或替换键对应的值，需要与其他写入串行调用
+        void Set(const std::string &key, Value value)
+        {
+            size_t hash = std::hash<std::string>()(key);
+            Table *table = _table.load(std::memory_order_relaxed);
+            std::atomic<Entry *> *link = FindLink(table, key, hash);
+            Entry *old_entry = link->load(std::memory_order_relaxed);
+            Entry *new_entry = new Entry{key, std::move(value), hash, nullptr};
+            new_entry->_next.store(old_entry == nullptr ? nullptr : old_entry->_next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            link->store(new_entry, std::memory_order_release);
+            if (old_entry != nullptr)
+            {
+                EpochReclaimer::Retire(old_entry, &DeleteEntry);
+                return;
+            }
+            if (++_size > table->_bucket_count)
+                Grow(table);
+        }
+        // 删除键，键不存在时返回false，需要与其他写入串行调用
+        bool Erase(const std::string &key)
+        {
+            size_t hash = std::hash<std::string>()(key);
+            std::atomic<Entry *> *link = FindLink(_table.load(std::memory_order_relaxed), key, hash);
+            Entry *entry = link->load(std::memory_order_relaxed);
+            if (entry == nullptr)
+                return false;
+            link->store(entry->_next.load(std::memory_order_relaxed), std::memory_order_release);
+            EpochReclaimer::Retire(entry, &DeleteEntry);
+            _size--;
+            return true;
+        }
+        size_t Size() const { return _size; }
+
+    private:
+        RcuMap(const RcuMap &) = delete;
+        RcuMap &operator=(const RcuMap &) = delete;
+
+        struct Entry
+        {
+            std::string _key;
+            Value _value;
+            size_t _hash;
+            std::atomic<Entry *> _next;
+        };
+        struct Table
+        {
+            size_t _bucket_count; // 总是2的幂
+            std::unique_ptr<std::atomic<Entry *>[]> _buckets;
+
+            Table(size_t bucket_count) : _bucket_count(bucket_count), _buckets(new std::atomic<Entry *>[bucket_count])
+            {
+                for (size_t i = 0; i < bucket_count; i++)
+                    _buckets[i].store(nullptr, std::memory_order_relaxed);
+            }
+            // 用乘法散列取哈希值的高位选择桶，避免外层按哈希值低位分片时同一分片中的键集中在少数桶中
+            std::atomic<Entry *> &Bucket(size_t hash) const
+            {
+                return _buckets[(hash * 0x9E3779B97F4A7C15ull) >> (64 - __builtin_ctzll(_bucket_count)) & (_bucket_count - 1)];
+            }
+        };
+
+        // 返回指向键所在节点的链接，键不存在时返回链表末尾的空链接
+        static std::atomic<Entry *> *FindLink(Table *table, const std::string &key, size_t hash)
+        {
+            std::atomic<Entry *> *link = &table->Bucket(hash);
+            for (Entry *entry = link->load(std::memory_order_relaxed); entry != nullptr; entry = link->load(std::memory_order_relaxed))
+            {
+                if (entry->_hash == hash && entry->_key == key)
+                    break;
+                link = &entry->_next;
+            }
+            return link;
+        }
+        // 桶数翻倍: 把所有节点复制到新的桶数组后一次性发布，旧桶数组和其中的节点留给还在读取的读者，稍后整体释放
+        void Grow(Table *table)
+        {
+            Table *new_table = new Table(table->_bucket_count * 2);
+            for (size_t i = 0; i < table->_bucket_count; i++)
+                for (Entry *entry = table->_buckets[i].load(std::memory_order_relaxed); entry != nullptr; entry = entry->_next.load(std::memory_order_relaxed))
+                {
+                    std::atomic<Entry *> &bucket = new_table->Bucket(entry->_hash);
+                    Entry *new_entry = new Entry{entry->_key, entry->_value, entry->_hash, nullptr};
+                    new_entry->_next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    bucket.store(new_entry, std::memory_order_relaxed);
+                }
+            _table.store(new_table, std::memory_order_release);
+            EpochReclaimer::Retire(table, &DeleteTable);
+        }
+        static void DeleteEntry(void *entry) { delete static_cast<Entry *>(entry); }
+        static void DeleteTable(void *ptr)
+        {
+            Table *table = static_cast<Table *>(ptr);
+            for (size_t i = 0; i < table->_bucket_count; i++)
+                for (Entry *entry = table->_buckets[i].load(std::memory_order_relaxed); entry != nullptr;)
+                {
+                    Entry *next = entry->_next.load(std::memory_order_relaxed);
+                    delete entry;
+                    entry = next;
+                }
+            delete table;
+        }
+
+    private:
+        std::atomic<Table *> _table;
+        size_t _size = 0; // 键的数量，只由写者访问
+    };
+}
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef CLOUD_BACKUP_READ_AHEAD_HPP
+#define CLOUD_BACKUP_READ_AHEAD_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include "stored_file_reader.hpp"
+#include "http_range.hpp"
+
+namespace cloud_backup
+{
+    // 执行下载预读的I/O线程，与处理请求的线程池分开，等待磁盘的线程不会占用处理请求的线程
+    class ReadAheadPool
+    {
+    public:
+        using ptr = std::shared_ptr<ReadAheadPool>;
+        ~ReadAheadPool()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _is_stop = true;
+            }
+            _cond.notify_all();
+            for (auto &worker_thread : _worker_threads)
+                worker_thread.join();
+        }
+        static ReadAheadPool::ptr GetInstance()
+        {
+            static ReadAheadPool::ptr pool(new ReadAheadPool(std::max<size_t>(Config::GetInstance()->GetReadAheadThreadsSize(), 1)));
+            if (pool == nullptr)
+                LOG_FATAL("create ReadAheadPool object fail");
+            return pool;
+        }
+
+        void Push(std::function<void()> job)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _jobs.push_back(std::move(job));
+            }
+            _cond.notify_one();
+        }
+
+    private:
+        ReadAheadPool(size_t threads_size)
+        {
+            _worker_threads.reserve(threads_size);
+            for (size_t i = 0; i < threads_size; i++)
+                _worker_threads.push_back(std::thread(&ReadAheadPool::ThreadRun, this));
+        }
+        ReadAheadPool(const ReadAheadPool &) = delete;
+        ReadAheadPool &operator=(const ReadAheadPool &) = delete;
+
+        void ThreadRun()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true)
+            {
+                _cond.wait(lock, [&]()
+                           { return _is_stop || !_jobs.empty(); });
+                if (_jobs.empty())
+                    return;
+                std::function<void()> job = std::move(_jobs.front());
+                _jobs.pop_front();
+                lock.unlock();
+                job();
+                lock.lock();
+            }
+        }
+
+    private:
+        std::deque<std::function<void()>> _jobs;
+        std::vector<std::thread> _worker_threads;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        bool _is_stop = false;
+    };
+
+    // 一次下载的预读器: 按下载区间的顺序在后台把接下来最多depth段文件内容提前读入内存，发送当前段的同时磁盘已在读取下一段
+    // 同一下载同一时刻最多只有一个读取在进行，保持顺序读取，底层的StoredFileReader也不需要是线程安全的
+    // 读出的内容以共享只读字符串交给发送缓冲区，发送完释放后其内存回到预读器中给后续的段复用
+    class ReadAheadReader : public std::enable_shared_from_this<ReadAheadReader>
+    {
+    public:
+        using ptr = std::shared_ptr<ReadAheadReader>;
+        ReadAheadReader(StoredFileReader::ptr reader, std::vector<ByteRange> ranges, int64_t chunk_size, size_t depth)
+            : _reader(std::move(reader)), _ranges(std::move(ranges)),
+              _chunk_size(std::max<int64_t>(chunk_size, 1)), _depth(depth) {}
+
+        // 读取第range_index个区间中[pos, pos+len)的内容，调用者必须按区间顺序逐段读取，每段长度为min(chunk_size, 区间剩余长度)
+        // 正好是已预读的下一段时等待其读完后直接取用，否则丢弃已预读的内容在当前线程读取，之后继续在后台预读后续的段，失败返回false
+        bool Read(size_t range_index, int64_t pos, int64_t len, std::shared_ptr<const std::string> *out)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_slots.empty() || _slots.front()->_range_index != range_index || _slots.front()->_pos != pos || _slots.front()->_len != len)
+            {
+                _cond.wait(lock, [&]()
+                           { return !_is_reading; });
+                for (auto &slot : _slots)
+                    RecycleBuffer(std::move(slot->_content));
+                _slots.clear();
+                Slot::ptr slot = NewSlot(range_index, pos, len);
+                lock.unlock();
+                ReadSlot(slot);
+                lock.lock();
+            }
+            _cond.wait(lock, [&]()
+                       { return _slots.front()->_is_done; });
+            Slot::ptr slot = _slots.front();
+            _slots.pop_front();
+            if (!slot->_is_ok)
+            {
+                RecycleBuffer(std::move(slot->_content));
+                return false;
+            }
+            // 发送缓冲区释放内容后把内存还给预读器，预读器已析构时直接释放
+            std::weak_ptr<ReadAheadReader> weak_self = weak_from_this();
+            std::shared_ptr<const std::string> content(new std::string(std::move(slot->_content)), [weak_self](const std::string *content)
+                                                      {
+                                                          if (auto self = weak_self.lock())
+                                                          {
+                                                              std::unique_lock<std::mutex> lock(self->_mutex);
+                                                              self->RecycleBuffer(std::move(*const_cast<std::string *>(content)));
+                                                          }
+                                                          delete content; });
+            StartNextRead();
+            // 释放out中原有的内容可能会归还缓冲区，需要先解锁
+            lock.unlock();
+            *out = std::move(content);
+            return true;
+        }
+
+    private:
+        ReadAheadReader(const ReadAheadReader &) = delete;
+        ReadAheadReader &operator=(const ReadAheadReader &) = delete;
+
+        // 一段要读取的文件内容
+        struct Slot
+        {
+            using ptr = std::shared_ptr<Slot>;
+            size_t _range_index;
+            int64_t _pos;
+            int64_t _len;
+            std::string _content;
+            bool _is_done = false;
+            bool _is_ok = false;
+        };
+
+        // 以下函数需要持有_mutex时调用
+        // 创建一个读取段加入队尾并标记为正在读取，同时计算出紧跟其后的一段
+        Slot::ptr NewSlot(size_t range_index, int64_t pos, int64_t len)
+        {
+            Slot::ptr slot = std::make_shared<Slot>();
+            slot->_range_index = range_index;
+            slot->_pos = pos;
+            slot->_len = len;
+            if (!_free_buffers.empty())
+            {
+                slot->_content = std::move(_free_buffers.back());
+                _free_buffers.pop_back();
+            }
+            _slots.push_back(slot);
+            _is_reading = true;
+            _next_range_index = range_index;
+            _next_pos = pos + len;
+            if (range_index < _ranges.size() && _next_pos >= _ranges[range_index]._end && ++_next_range_index < _ranges.size())
+                _next_pos = _ranges[_next_range_index]._start;
+            return slot;
+        }
+        // 没有读取正在进行且预读的段不足depth时在后台读取下一段
+        void StartNextRead()
+        {
+            if (_is_reading || _slots.size() >= _depth || _next_range_index >= _ranges.size())
+                return;
+            int64_t len = std::min(_chunk_size, _ranges[_next_range_index]._end - _next_pos);
+            Slot::ptr slot = NewSlot(_next_range_index, _next_pos, len);
+            std::weak_ptr<ReadAheadReader> weak_self = weak_from_this();
+            ReadAheadPool::GetInstance()->Push([weak_self, slot]()
+                                               {
+                                                   if (auto self = weak_self.lock())
+                                                       self->ReadSlot(slot); });
+        }
+        void RecycleBuffer(std::string &&buffer)
+        {
+            buffer.clear();
+            if (_free_buffers.size() < _depth + 1)
+                _free_buffers.push_back(std::move(buffer));
+        }
+
+        // 不持有_mutex时调用，读取完成后继续预读下一段
+        void ReadSlot(const Slot::ptr &slot)
+        {
+            bool ret;
+            {
+                // 每段读取期间处于EpochReclaimer的临界区内，文件被删除或迁移时等待这段读完才改动存储，不修改节点上任何共享的数据
+                EpochReclaimer::Guard guard;
+                ret = _reader->Read(slot->_pos, slot->_len, &slot->_content);
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            slot->_is_ok = ret;
+            slot->_is_done = true;
+            _is_reading = false;
+            _cond.notify_all();
+            if (ret)
+                StartNextRead();
+        }
+
+    private:
+        StoredFileReader::ptr _reader;
+        std::vector<ByteRange> _ranges;
+        int64_t _chunk_size;
+        size_t _depth;                          // 最多预读的段数，为0时不预读，每段都在调用Read的线程中读取
+        std::deque<Slot::ptr> _slots;           // 已读完或正在读取、还未被取走的段，按读取顺序排列
+        std::vector<std::string> _free_buffers; // 可以复用的缓冲区
+        size_t _next_range_index = 0;           // 下一个要预读的段所在的区间，等于区间数时没有后续的段
+        int64_t _next_pos = 0;
+        bool _is_reading = false;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+    };
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef CLOUD_BACKUP_RESPONSE_GENERATOR_HPP
+#define CLOUD_BACKUP_RESPONSE_GENERATOR_HPP
+
+#include "data_manager.hpp"
+
+namespace cloud_backup
+{
+    // 流式生成的响应body，由连接在发送缓冲区有空闲时反复调用，每次只生成一段数据，不需要在内存中构建完整的body
+    class ResponseGenerator
+    {
+    public:
+        using ptr = std::shared_ptr<ResponseGenerator>;
+        virtual ~ResponseGenerator() {}
+        // 生成下一段body数据追加到out中，生成的数据达到max_size后就返回(最后一条记录可能略微超出)，body已全部生成时返回true
+        virtual bool Generate(std::string *out, size_t max_size) = 0;
+    };
+
+    // 生成/api/GetBackupFiles的文件列表JSON: {"files":[{"filename":...,"size":...,"time":...},...]}
+    // 构造时只保存文件节点指针的快照，之后逐条格式化，生成过程中文件列表的变化不会影响本次响应
+    class FileListGenerator : public ResponseGenerator
+    {
+    public:
+        FileListGenerator() { DataManager::GetInstance()->GetAllFileInfoNodes(&_nodes); }
+
+        bool Generate(std::string *out, size_t max_size) override
+        {
+            if (!_is_started)
+            {
+                out->append("{\"files\":[");
+                _is_started = true;
+            }
+            while (_index < _nodes.size() && out->size() < max_size)
+            {
+                const BackupInfoNode &info = _nodes[_index]->_info;
+                if (_index > 0)
+                    out->push_back(',');
+                out->append("{\"filename\":");
+                JsonUtil::AppendQuotedString(info._filename, out);
+                out->append(",\"size\":");
+                out->append(std::to_string(info._size));
+                out->append(",\"time\":");
+                out->append(std::to_string(info._time));
+                out->push_back('}');
+                // 已格式化的节点不再需要，及时释放快照中的引用
+                _nodes[_index++].reset();
+            }
+            if (_index < _nodes.size())
+                return false;
+            out->append("]}");
+            return true;
+        }
+
+    private:
+        std::vector<DataManagerNode::ptr> _nodes;
+        size_t _index = 0;        // 下一个要格式化的节点下标
+        bool _is_started = false; // 是否已经生成了开头部分
+    };
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef CLOUD_BACKUP_ROUTER_HPP
+#define CLOUD_BACKUP_ROUTER_HPP
+
+#include <array>
+#include <string_view>
+#include "util.hpp"
+
+namespace cloud_backup
+{
+    // 对(请求方法, URL前缀)计算FNV-1a哈希，constexpr函数使路由表中的字面量前缀可以在编译期求出哈希值
+    constexpr uint64_t RouteHash(llhttp_method_t method, std::string_view prefix)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        hash = (hash ^ static_cast<uint8_t>(method)) * 1099511628211ULL;
+        for (char ch : prefix)
+            hash = (hash ^ static_cast<uint8_t>(ch)) * 1099511628211ULL;
+        return hash;
+    }
+
+    // 路由器，Handler是处理请求的连接类型，每条路由由(请求方法, URL前缀)唯一确定
+    // 每条路由可以注册三个钩子: 请求头解析完成、收到一段body、请求解析完成，钩子为Handler的成员函数指针，不需要的钩子置为nullptr
+    // 路由存放在固定大小的开放寻址哈希表中，匹配一次请求只需要计算一次哈希并比较一次前缀
+    template <class Handler>
+    class HTTPRouter
+    {
+    public:
+        using headers_hook_t = void (Handler::*)();
+        using body_hook_t = void (Handler::*)(const char *, size_t);
+        using complete_hook_t = void (Handler::*)();
+        struct Route
+        {
+            llhttp_method_t _method;            // 请求方法
+            std::string_view _prefix;           // URL前缀，即URL中第一段路径(如"/download")，要求指向静态存储的字符串
+            headers_hook_t _on_headers;         // 请求头解析完成时调用
+            body_hook_t _on_body;               // 收到一段body数据时调用
+            complete_hook_t _on_complete;       // 请求解析完成时调用，负责构建响应
+        };
+
+        // 注册一条路由，(请求方法, URL前缀)重复或路由表已满时返回false
+        bool Register(const Route &route)
+        {
+            uint64_t hash = RouteHash(route._method, route._prefix);
+            for (size_t i = 0; i < TABLE_SIZE; i++)
+            {
+                Slot &slot = _slots[(hash + i) & (TABLE_SIZE - 1)];
+                if (!slot._used)
+                {
+                    slot._used = true;
+                    slot._hash = hash;
+                    slot._route = route;
+                    return true;
+                }
+                if (slot._hash == hash && slot._route._method == route._method && slot._route._prefix == route._prefix)
+                {
+                    LOG_ERROR("Router Register error, route already exists: %s %.*s", llhttp_method_name(route._method),
+                              (int)route._prefix.size(), route._prefix.data());
+                    return false;
+                }
+            }
+            LOG_ERROR("Router Register error, route table is full");
+            return false;
+        }
+        // 根据请求方法和URL前缀查找路由，未找到返回nullptr
+        const Route *Match(llhttp_method_t method, std::string_view prefix) const
+        {
+            uint64_t hash = RouteHash(method, prefix);
+            for (size_t i = 0; i < TABLE_SIZE; i++)
+            {
+                const Slot &slot = _slots[(hash + i) & (TABLE_SIZE - 1)];
+                if (!slot._used)
+                    return nullptr;
+                if (slot._hash == hash && slot._route._method == method && slot._route._prefix == prefix)
+                    return &slot._route;
+            }
+            return nullptr;
+        }
+
+    private:
+        static const size_t TABLE_SIZE = 64; // 哈希表槽位数，必须是2的幂
+        struct Slot
+        {
+            bool _used = false;
+            uint64_t _hash = 0;
+            Route _route{};
+        };
+        std::array<Slot, TABLE_SIZE> _slots;
+    };
+}
+
+#endif
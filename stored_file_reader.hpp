@@ -0,0 +1,179 @@
+#ifndef CLOUD_BACKUP_STORED_FILE_READER_HPP
+#define CLOUD_BACKUP_STORED_FILE_READER_HPP
+
+#include "data_manager.hpp"
+#include "dedup_store.hpp"
+#include "frame_store.hpp"
+#include "large_file_io.hpp"
+#include "fd_cache.hpp"
+
+namespace cloud_backup
+{
+    // 按逻辑偏移读取备份文件内容的读取器，屏蔽文件在备份目录中的不同存储方式，一次下载请求对应一个读取器
+    class StoredFileReader
+    {
+    public:
+        using ptr = std::shared_ptr<StoredFileReader>;
+        virtual ~StoredFileReader() {}
+        // 读取文件逻辑位置[pos, pos+len)的内容，超出文件末尾的部分被忽略，失败返回false
+        virtual bool Read(int64_t pos, int64_t len, std::string *out) = 0;
+
+        // 根据节点记录的存储方式创建对应的读取器，失败返回nullptr
+        // 在EpochReclaimer::Guard内打开，不加节点的锁，节点已不是文件的当前版本(被替换、迁移或删除)时返回nullptr，此时调用者可以重新查找节点后再试
+        static StoredFileReader::ptr Open(const DataManagerNode &node);
+    };
+
+    // 直接保存的文件在创建读取器时就打开(描述符通常来自FdCache，多个下载共享)，之后文件被删除或替换也仍然读取打开时的版本
+    // 大文件按配置读取后丢弃页缓存，或以O_DIRECT打开后读入对齐的缓冲区再拷贝出需要的部分
+    class PlainFileReader : public StoredFileReader
+    {
+    public:
+        PlainFileReader(CachedFd::ptr file, LargeFileIOMode mode = LargeFileIOMode::BUFFERED)
+            : _file(std::move(file)), _fd(_file->_fd), _mode(mode) {}
+        ~PlainFileReader() { free(_direct_buffer); }
+        bool Read(int64_t pos, int64_t len, std::string *out) override
+        {
+            if (_mode == LargeFileIOMode::DIRECT)
+                return ReadDirect(pos, len, out);
+            out->resize(len);
+            int64_t read_size;
+            if (!ReadAll(out->data(), pos, len, &read_size))
+                return false;
+            out->resize(read_size);
+            if (_mode == LargeFileIOMode::FADVISE && read_size > 0)
+                LargeFileIO::DropCache(_fd, pos, read_size);
+            return true;
+        }
+
+    private:
+        bool ReadAll(char *data, int64_t pos, int64_t len, int64_t *read_size)
+        {
+            *read_size = 0;
+            while (*read_size < len)
+            {
+                ssize_t read_bytes = pread(_fd, data + *read_size, len - *read_size, pos + *read_size);
+                if (read_bytes < 0 && errno == EINTR)
+                    continue;
+                if (read_bytes < 0)
+                {
+                    LOG_ERROR("PlainFileReader Read error, pread error:%d message:%s", errno, strerror(errno));
+                    return false;
+                }
+                if (read_bytes == 0)
+                    break;
+                *read_size += read_bytes;
+            }
+            return true;
+        }
+        // 将[pos, pos+len)扩展到对齐的边界后读入对齐的缓冲区，文件末尾不足对齐长度的部分由内核按实际长度返回
+        bool ReadDirect(int64_t pos, int64_t len, std::string *out)
+        {
+            const int64_t alignment = LargeFileIO::DIRECT_IO_ALIGNMENT;
+            int64_t aligned_pos = pos - pos % alignment;
+            int64_t aligned_len = (pos + len - aligned_pos + alignment - 1) / alignment * alignment;
+            if ((size_t)aligned_len > _direct_buffer_size)
+            {
+                free(_direct_buffer);
+                _direct_buffer_size = 0;
+                if (posix_memalign(reinterpret_cast<void **>(&_direct_buffer), alignment, aligned_len) != 0)
+                {
+                    _direct_buffer = nullptr;
+                    LOG_ERROR("PlainFileReader Read error, alloc direct read buffer failed");
+                    return false;
+                }
+                _direct_buffer_size = aligned_len;
+            }
+            int64_t read_size;
+            if (!ReadAll(_direct_buffer, aligned_pos, aligned_len, &read_size))
+                return false;
+            int64_t skip = pos - aligned_pos;
+            out->assign(_direct_buffer + std::min(skip, read_size), std::clamp<int64_t>(read_size - skip, 0, len));
+            return true;
+        }
+
+    private:
+        CachedFd::ptr _file;
+        int _fd;
+        LargeFileIOMode _mode;
+        char *_direct_buffer = nullptr; // O_DIRECT读取使用的对齐缓冲区
+        size_t _direct_buffer_size = 0;
+    };
+
+    class DedupFileReader : public StoredFileReader
+    {
+    public:
+        DedupFileReader(DedupManifest::ptr manifest) : _manifest(std::move(manifest)) {}
+        bool Read(int64_t pos, int64_t len, std::string *out) override { return DedupStore::GetInstance()->Read(_manifest, pos, len, out); }
+
+    private:
+        DedupManifest::ptr _manifest;
+    };
+
+    class FrameFileReader : public StoredFileReader
+    {
+    public:
+        FrameFileReader(FrameIndex::ptr index) : _index(std::move(index)) {}
+        bool Read(int64_t pos, int64_t len, std::string *out) override { return FrameStore::Read(_index, pos, len, out); }
+
+    private:
+        FrameIndex::ptr _index;
+    };
+
+    // 包文件存储的文件读取时直接从包文件中的记录位置pread，包文件的描述符来自FdCache，所有文件共享
+    class PackedFileReader : public StoredFileReader
+    {
+    public:
+        PackedFileReader(CachedFd::ptr pack, int64_t offset, int64_t size) : _pack(std::move(pack)), _offset(offset), _size(size) {}
+        bool Read(int64_t pos, int64_t len, std::string *out) override
+        {
+            out->resize(std::clamp<int64_t>(_size - pos, 0, len));
+            return _pack->ReadAt(out->data(), out->size(), _offset + pos);
+        }
+
+    private:
+        CachedFd::ptr _pack;
+        int64_t _offset; // 文件内容在包文件中的起始位置
+        int64_t _size;
+    };
+
+    inline StoredFileReader::ptr StoredFileReader::Open(const DataManagerNode &node)
+    {
+        // 写者标记节点失效后会等待已进入Guard的读者退出才改动存储，这里看到节点未失效时打开的一定是该节点记录的版本
+        EpochReclaimer::Guard guard;
+        if (node._is_retired)
+        {
+            LOG_INFO("StoredFileReader Open, file:%s was replaced or deleted", node._info._filename.c_str());
+            return nullptr;
+        }
+        const BackupInfoNode &info = node._info;
+        if (info._storage == FileStorageType::PACKED)
+        {
+            CachedFd::ptr pack = FdCache::GetInstance()->Open(PackStore::GetInstance()->PackPath(info._pack_id));
+            return pack == nullptr ? nullptr : std::make_shared<PackedFileReader>(pack, info._pack_offset, info._size);
+        }
+        std::string filepath = BackupPathResolver::FilePath(info._filename, info._tier);
+        if (info._storage == FileStorageType::DEDUP)
+        {
+            DedupManifest::ptr manifest = DedupStore::GetInstance()->LoadManifest(filepath);
+            return manifest == nullptr ? nullptr : std::make_shared<DedupFileReader>(manifest);
+        }
+        if (info._storage == FileStorageType::FRAMES)
+        {
+            FrameIndex::ptr index = FrameStore::LoadIndex(filepath);
+            return index == nullptr ? nullptr : std::make_shared<FrameFileReader>(index);
+        }
+        // O_DIRECT的描述符单独打开不进入缓存，文件系统不支持O_DIRECT时退回为读取后丢弃页缓存
+        LargeFileIOMode mode = LargeFileIO::ModeFor(info._size);
+        if (mode == LargeFileIOMode::DIRECT)
+        {
+            int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+            if (fd != -1)
+                return std::make_shared<PlainFileReader>(std::make_shared<const CachedFd>(fd), mode);
+            mode = LargeFileIOMode::FADVISE;
+        }
+        CachedFd::ptr file = FdCache::GetInstance()->Open(filepath);
+        return file == nullptr ? nullptr : std::make_shared<PlainFileReader>(file, mode);
+    }
+}
+
+#endif
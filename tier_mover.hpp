@@ -0,0 +1,214 @@
+#ifndef CLOUD_BACKUP_TIER_MOVER_HPP
+#define CLOUD_BACKUP_TIER_MOVER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include "data_manager.hpp"
+#include "file_writer.hpp"
+
+namespace cloud_backup
+{
+    // 在热存储层和冷存储层之间迁移文件的后台线程，只在配置了cold_storage_dir时启动
+    // 定期把热存储层中超过tier_demote_after_days天没有被下载的文件降级到冷存储层，冷存储层的文件被连续下载多次后提升回热存储层
+    // 迁移时先按tier_migrate_rate限速复制到目标层，再由DataManager::MoveTier切换，复制期间文件照常可以下载
+    // 去重存储的文件在备份目录中只有文件清单，内容在共享的块目录中，包文件存储的文件不在备份目录中，都不参与迁移
+    class TierMover
+    {
+    public:
+        using ptr = std::shared_ptr<TierMover>;
+        static constexpr time_t PROMOTE_ACCESS_GAP = 24 * 3600; // 冷存储层的文件相邻两次下载间隔超过该秒数时重新计数
+        static constexpr int64_t COPY_BLOCK_SIZE = 1024 * 1024;  // 迁移时每次复制的字节数
+
+        ~TierMover()
+        {
+            if (!_mover_thread.joinable())
+                return;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _is_stop = true;
+            }
+            _cond.notify_all();
+            _mover_thread.join();
+        }
+        static TierMover::ptr GetInstance()
+        {
+            static TierMover::ptr mover(new TierMover());
+            if (mover == nullptr)
+                LOG_FATAL("create TierMover object fail");
+            return mover;
+        }
+
+        // 记录文件的一次下载，冷存储层的文件连续被下载达到tier_promote_access_count次时加入提升队列
+        void RecordAccess(DataManagerNode &node)
+        {
+            // 热门文件的下载只读取这两个值，同一秒内的重复下载不再写入所有下载线程共享的缓存行
+            time_t now = time(nullptr);
+            time_t last_access = node._last_access.load(std::memory_order_relaxed);
+            if (last_access != now)
+                last_access = node._last_access.exchange(now);
+            if (!_has_new_access.load(std::memory_order_relaxed))
+                _has_new_access = true;
+            int promote_count = Config::GetInstance()->GetTierPromoteAccessCount();
+            if (!_mover_thread.joinable() || node._info._tier != StorageTier::COLD || promote_count <= 0)
+                return;
+            int streak = now - last_access > PROMOTE_ACCESS_GAP ? 1 : node._access_streak + 1;
+            node._access_streak = streak;
+            if (streak != promote_count)
+                return;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _promote_queue.push_back(node._info._filename);
+            }
+            _cond.notify_all();
+        }
+
+    private:
+        TierMover()
+        {
+            if (!BackupPathResolver::TieringEnabled())
+                return;
+            DataManager::GetInstance();
+            _mover_thread = std::thread(&TierMover::MoverThread, this);
+        }
+        TierMover(const TierMover &) = delete;
+        TierMover &operator=(const TierMover &) = delete;
+
+        void MoverThread()
+        {
+            time_t next_scan = 0;
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cond.wait_for(lock, std::chrono::seconds(std::max<time_t>(next_scan - time(nullptr), 0)), [&]()
+                                   { return _is_stop || !_promote_queue.empty(); });
+                    if (_is_stop)
+                        return;
+                }
+                ProcessPromotions();
+                if (time(nullptr) >= next_scan)
+                {
+                    DemoteIdleFiles();
+                    next_scan = time(nullptr) + std::max(Config::GetInstance()->GetTierScanInterval(), 1);
+                }
+            }
+        }
+        // 处理提升队列中的所有文件
+        void ProcessPromotions()
+        {
+            while (true)
+            {
+                std::string filename;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if (_is_stop || _promote_queue.empty())
+                        return;
+                    filename = std::move(_promote_queue.front());
+                    _promote_queue.pop_front();
+                }
+                DataManagerNode::ptr node = DataManager::GetInstance()->GetFileInfoNode(filename);
+                if (node != nullptr && node->_info._tier == StorageTier::COLD)
+                    Move(node, StorageTier::HOT);
+            }
+        }
+        // 把热存储层中超过配置天数没有被下载的文件降级到冷存储层，每迁移一个文件前先处理等待提升的文件
+        void DemoteIdleFiles()
+        {
+            if (_has_new_access.exchange(false))
+                DataManager::GetInstance()->SaveAccessTimes();
+            time_t deadline = time(nullptr) - static_cast<time_t>(Config::GetInstance()->GetTierDemoteAfterDays()) * 24 * 3600;
+            std::vector<DataManagerNode::ptr> nodes;
+            DataManager::GetInstance()->GetAllFileInfoNodes(&nodes);
+            size_t count = 0;
+            for (auto &node : nodes)
+            {
+                if (node->_info._tier != StorageTier::HOT || node->_info._storage == FileStorageType::DEDUP ||
+                    node->_info._storage == FileStorageType::PACKED ||
+                    std::max(node->_info._time, node->_last_access.load()) > deadline)
+                    continue;
+                ProcessPromotions();
+                if (IsStopped())
+                    return;
+                if (Move(node, StorageTier::COLD))
+                    count++;
+            }
+            if (count > 0)
+                LOG_INFO("TierMover demoted %zu file to cold storage", count);
+        }
+        // 把文件复制到目标层的迁移临时目录后切换到目标层，降级的文件切换后丢弃其页缓存，失败返回false
+        bool Move(const DataManagerNode::ptr &node, StorageTier tier)
+        {
+            const std::string &filename = node->_info._filename;
+            std::string staging_path = BackupPathResolver::MigratingPath(filename, tier);
+            if (!CopyFile(BackupPathResolver::FilePath(filename, node->_info._tier), staging_path) ||
+                !DataManager::GetInstance()->MoveTier(node, staging_path, tier))
+            {
+                unlink(staging_path.c_str());
+                return false;
+            }
+            if (tier == StorageTier::COLD)
+                LargeFileIO::DropFileCache(BackupPathResolver::FilePath(filename, tier));
+            LOG_INFO("TierMover moved file:%s to %s storage", filename.c_str(), tier == StorageTier::COLD ? "cold" : "hot");
+            return true;
+        }
+        // 按tier_migrate_rate限速复制文件，停止时中断复制并返回false
+        bool CopyFile(const std::string &src_path, const std::string &dst_path)
+        {
+            int fd = open(src_path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (fd == -1 || fstat(fd, &st) == -1)
+            {
+                LOG_ERROR("TierMover error, open file:%s error:%d message:%s", src_path.c_str(), errno, strerror(errno));
+                if (fd != -1)
+                    close(fd);
+                return false;
+            }
+            FileWriter writer;
+            bool ret = writer.Open(dst_path) && writer.Preallocate(st.st_size);
+            if (ret)
+                writer.SetCachePolicy(st.st_size);
+            std::string buffer(COPY_BLOCK_SIZE, '\0');
+            int64_t rate = Config::GetInstance()->GetTierMigrateRate();
+            auto start = std::chrono::steady_clock::now();
+            int64_t copied = 0;
+            while (ret && copied < st.st_size)
+            {
+                ssize_t read_bytes = pread(fd, buffer.data(), std::min<int64_t>(COPY_BLOCK_SIZE, st.st_size - copied), copied);
+                if (read_bytes < 0 && errno == EINTR)
+                    continue;
+                if (read_bytes <= 0)
+                {
+                    LOG_ERROR("TierMover error, read file:%s error:%d", src_path.c_str(), read_bytes < 0 ? errno : 0);
+                    ret = false;
+                    break;
+                }
+                ret = writer.Write(buffer.data(), read_bytes);
+                copied += read_bytes;
+                if (rate > 0)
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if (_cond.wait_until(lock, start + std::chrono::microseconds(copied * 1000000 / rate), [&]()
+                                         { return _is_stop; }))
+                        ret = false;
+                }
+            }
+            close(fd);
+            return writer.Close() && ret;
+        }
+        bool IsStopped()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _is_stop;
+        }
+
+    private:
+        std::deque<std::string> _promote_queue;      // 等待提升回热存储层的文件名
+        std::atomic<bool> _has_new_access = false;   // 上次扫描之后是否有文件被下载过，有则在扫描时持久化最近下载时间
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        bool _is_stop = false;
+        std::thread _mover_thread;
+    };
+}
+
+#endif
@@ -0,0 +1,335 @@
+#ifndef CLOUD_BACKUP_UPLOAD_SESSION_HPP
+#define CLOUD_BACKUP_UPLOAD_SESSION_HPP
+
+#include <random>
+#include "data_manager.hpp"
+#include "file_writer.hpp"
+
+namespace cloud_backup
+{
+    // 一个可续传的上传会话，文件内容先写入暂存目录中的"<id>.part"，会话信息保存在"<id>.info"中
+    struct UploadSession
+    {
+        using ptr = std::shared_ptr<UploadSession>;
+        std::string _id;
+        std::string _filename; // 上传完成后在备份目录中的文件名，创建会话时已在DataManager中注册
+        int64_t _length = 0;   // 文件的总大小
+        int64_t _offset = 0;   // 已经写入暂存文件的字节数，客户端续传时从该位置继续
+        time_t _expire_time = 0;
+        bool _is_busy = false; // 是否有PATCH请求正在写入，同一时刻只允许一个请求写入，由UploadSessionManager的锁保护
+    };
+
+    // 管理所有可续传上传会话的单例类，会话信息持久化在暂存目录中，服务器重启后未过期的会话可以继续上传
+    // 只有完整上传的文件才会移入备份目录并Insert进DataManager，过期的会话由后台线程清理并注销其文件名
+    class UploadSessionManager
+    {
+    public:
+        using ptr = std::shared_ptr<UploadSessionManager>;
+        static constexpr int CLEAN_INTERVAL_SECONDS = 60; // 后台线程检查过期会话的时间间隔
+
+        ~UploadSessionManager()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _is_stop = true;
+            }
+            _clean_cond.notify_all();
+            _clean_thread.join();
+        }
+        static UploadSessionManager::ptr GetInstance()
+        {
+            static UploadSessionManager::ptr manager(new UploadSessionManager());
+            if (manager == nullptr)
+                LOG_FATAL("create UploadSessionManager object fail");
+            return manager;
+        }
+
+        // 为已在DataManager中注册的文件名创建上传会话，失败返回nullptr
+        UploadSession::ptr Create(const std::string &filename, int64_t length)
+        {
+            UploadSession::ptr session = std::make_shared<UploadSession>();
+            session->_id = NewSessionId();
+            session->_filename = filename;
+            session->_length = length;
+            session->_expire_time = time(nullptr) + Config::GetInstance()->GetUploadSessionExpireSeconds();
+            // 创建暂存文件时按声明的总大小预先分配磁盘空间，之后分多次PATCH追加写入时不会产生碎片
+            int fd = open(StagingFilePath(session->_id).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            bool ret = fd != -1 && LargeFileIO::Preallocate(fd, 0, length);
+            if (fd != -1)
+                close(fd);
+            if (!ret || !SaveSession(*session))
+            {
+                LOG_ERROR("UploadSessionManager Create error, create staging file failed, filename:%s", filename.c_str());
+                RemoveSessionFiles(session->_id);
+                return nullptr;
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            _sessions[session->_id] = session;
+            return session;
+        }
+        // 获取一个未过期的会话，不存在时返回nullptr，返回的会话中的字段可能随时被修改，需要通过GetState读取
+        UploadSession::ptr Get(const std::string &id)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _sessions.find(id);
+            if (it == _sessions.end() || it->second->_expire_time < time(nullptr))
+                return nullptr;
+            return it->second;
+        }
+        // 读取会话当前的偏移、总大小和过期时间
+        void GetState(const UploadSession::ptr &session, int64_t *offset, int64_t *length, time_t *expire_time)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            *offset = session->_offset;
+            *length = session->_length;
+            *expire_time = session->_expire_time;
+        }
+        // 开始一次从offset处写入的PATCH，offset必须与已写入的偏移一致且没有其他PATCH正在进行，失败返回false
+        // 暂存文件会被截断到已写入的偏移，丢弃上一次异常中断时可能残留的多余数据
+        bool BeginPatch(const UploadSession::ptr &session, int64_t offset)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (session->_is_busy || session->_offset != offset || _sessions.count(session->_id) == 0)
+                return false;
+            if (truncate(StagingFilePath(session->_id).c_str(), session->_offset) == -1)
+            {
+                LOG_ERROR("UploadSessionManager BeginPatch error, truncate error:%d message:%s", errno, strerror(errno));
+                return false;
+            }
+            session->_is_busy = true;
+            return true;
+        }
+        // 结束一次PATCH，以暂存文件的实际大小作为新的偏移(已写入的数据都是按顺序收到的有效数据)，并刷新过期时间
+        // 数据已全部上传时将暂存文件移入备份目录并Insert进DataManager，*completed返回上传是否已完成
+        // Insert需要计算校验信息并等待落盘，在释放_mutex之后进行，不阻塞其他会话；Insert失败时注销文件名并删除临时文件
+        bool EndPatch(const UploadSession::ptr &session, int64_t *offset, bool *completed)
+        {
+            *completed = false;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                session->_is_busy = false;
+                int64_t file_size = FileUtil(StagingFilePath(session->_id)).GetFileSize();
+                if (file_size != -1)
+                    session->_offset = std::min(file_size, session->_length);
+                session->_expire_time = time(nullptr) + Config::GetInstance()->GetUploadSessionExpireSeconds();
+                *offset = session->_offset;
+                if (session->_offset < session->_length)
+                    return SaveSession(*session);
+                if (rename(StagingFilePath(session->_id).c_str(), BackupPathResolver::UploadingPath(session->_filename).c_str()) == -1)
+                {
+                    LOG_ERROR("UploadSessionManager EndPatch error, rename error:%d message:%s", errno, strerror(errno));
+                    return false;
+                }
+                unlink(InfoFilePath(session->_id).c_str());
+                _sessions.erase(session->_id);
+            }
+            if (!DataManager::GetInstance()->Insert(session->_filename, session->_length))
+            {
+                LOG_ERROR("UploadSessionManager EndPatch error, Insert fail, filename:%s", session->_filename.c_str());
+                DataManager::GetInstance()->Deregister(session->_filename);
+                return false;
+            }
+            LOG_INFO("upload session:%s completed, filename:%s", session->_id.c_str(), session->_filename.c_str());
+            *completed = true;
+            return true;
+        }
+        // 主动终止一个会话，删除暂存数据并注销文件名，会话不存在或正在写入时返回false
+        bool Terminate(const std::string &id)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _sessions.find(id);
+            if (it == _sessions.end() || it->second->_is_busy)
+                return false;
+            DropSession(*it->second);
+            _sessions.erase(it);
+            return true;
+        }
+        // 会话暂存文件的路径
+        std::string StagingFilePath(const std::string &id) { return _staging_dir + id + ".part"; }
+
+    private:
+        UploadSessionManager() : _staging_dir(Config::GetInstance()->GetUploadStagingDir())
+        {
+            if (_staging_dir.back() != '/')
+                _staging_dir += '/';
+            if (!FileUtil(_staging_dir).CreateDirectories())
+                LOG_ERROR("UploadSessionManager initialization error, create staging dir failed: %s", _staging_dir.c_str());
+            LoadSessions();
+            _clean_thread = std::thread(&UploadSessionManager::CleanThread, this);
+            LOG_INFO("UploadSessionManager initialized successfully, loaded %zu session", _sessions.size());
+        }
+        UploadSessionManager(const UploadSessionManager &) = delete;
+        UploadSessionManager &operator=(const UploadSessionManager &) = delete;
+
+        static std::string NewSessionId()
+        {
+            static std::mutex random_mutex;
+            static std::mt19937_64 random_engine(std::random_device{}());
+            uint64_t high, low;
+            {
+                std::unique_lock<std::mutex> lock(random_mutex);
+                high = random_engine();
+                low = random_engine();
+            }
+            char id[33];
+            snprintf(id, sizeof(id), "%016llx%016llx", (unsigned long long)high, (unsigned long long)low);
+            return id;
+        }
+        std::string InfoFilePath(const std::string &id) { return _staging_dir + id + ".info"; }
+        // 将会话信息写入临时文件后再rename覆盖，保证会话信息文件在任何时刻都是完整的
+        bool SaveSession(const UploadSession &session)
+        {
+            Json::Value root;
+            root["id"] = session._id;
+            root["filename"] = session._filename;
+            root["length"] = (Json::Int64)session._length;
+            root["offset"] = (Json::Int64)session._offset;
+            root["expire_time"] = (Json::Int64)session._expire_time;
+            std::string content;
+            if (!JsonUtil::Serialize(root, &content))
+                return false;
+            std::string tmp_path = InfoFilePath(session._id) + ".tmp";
+            FileUtil tmp_file(tmp_path);
+            if (tmp_file.Exists() && !tmp_file.Clear())
+                return false;
+            if (!tmp_file.AppendContent(content))
+                return false;
+            if (rename(tmp_path.c_str(), InfoFilePath(session._id).c_str()) == -1)
+            {
+                LOG_ERROR("UploadSessionManager SaveSession error, rename error:%d message:%s", errno, strerror(errno));
+                return false;
+            }
+            return true;
+        }
+        void RemoveSessionFiles(const std::string &id)
+        {
+            unlink(StagingFilePath(id).c_str());
+            unlink(InfoFilePath(id).c_str());
+        }
+        // 丢弃会话的所有数据并注销其文件名
+        void DropSession(const UploadSession &session)
+        {
+            RemoveSessionFiles(session._id);
+            if (!DataManager::GetInstance()->Deregister(session._filename))
+                LOG_ERROR("UploadSessionManager error, Deregister fail, filename:%s", session._filename.c_str());
+        }
+        // 初始化时加载暂存目录中未过期的会话，重新注册其文件名，无法恢复的会话和没有会话信息的暂存文件都会被删除
+        void LoadSessions()
+        {
+            std::vector<FileUtil> files;
+            if (!FileUtil(_staging_dir).ScanDirectory(&files))
+                return;
+            time_t now = time(nullptr);
+            for (auto &file : files)
+            {
+                std::string name = file.GetFileName();
+                if (name.size() <= 5 || name.substr(name.size() - 5) != ".info")
+                    continue;
+                std::string content;
+                Json::Value root;
+                if (!file.GetContent(&content) || !JsonUtil::Deserialize(content, &root))
+                    continue;
+                UploadSession::ptr session = std::make_shared<UploadSession>();
+                session->_id = root["id"].asString();
+                session->_filename = root["filename"].asString();
+                session->_length = root["length"].asInt64();
+                session->_expire_time = root["expire_time"].asInt64();
+                int64_t part_size = FileUtil(StagingFilePath(session->_id)).GetFileSize();
+                if (session->_id + ".info" != name || session->_expire_time < now || part_size == -1 ||
+                    !DataManager::GetInstance()->Register(session->_filename))
+                {
+                    LOG_WARN("UploadSessionManager drop session:%s", name.c_str());
+                    RemoveSessionFiles(name.substr(0, name.size() - 5));
+                    continue;
+                }
+                session->_offset = std::min(part_size, session->_length);
+                _sessions[session->_id] = session;
+            }
+            for (auto &file : files)
+            {
+                std::string name = file.GetFileName();
+                size_t dot_pos = name.find('.');
+                if (dot_pos == std::string::npos || _sessions.count(name.substr(0, dot_pos)) == 0)
+                    file.RemoveRegularFile();
+            }
+        }
+        // 后台线程定期清理过期且没有正在写入的会话
+        void CleanThread()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_is_stop)
+            {
+                _clean_cond.wait_for(lock, std::chrono::seconds(CLEAN_INTERVAL_SECONDS));
+                time_t now = time(nullptr);
+                for (auto it = _sessions.begin(); it != _sessions.end();)
+                {
+                    if (it->second->_expire_time < now && !it->second->_is_busy)
+                    {
+                        LOG_INFO("upload session:%s expired, filename:%s", it->first.c_str(), it->second->_filename.c_str());
+                        DropSession(*it->second);
+                        it = _sessions.erase(it);
+                    }
+                    else
+                        ++it;
+                }
+            }
+        }
+
+    private:
+        std::string _staging_dir;
+        std::unordered_map<std::string, UploadSession::ptr> _sessions;
+        std::mutex _mutex; // 保护_sessions以及其中每个会话的字段
+        bool _is_stop = false;
+        std::condition_variable _clean_cond;
+        std::thread _clean_thread;
+    };
+
+    // 一次PATCH请求对会话暂存文件的写入，析构时(包括连接中途断开)会自动结束本次写入，已收到的数据不会丢失
+    class UploadPatch
+    {
+    public:
+        UploadPatch(UploadSession::ptr session, int64_t offset, int64_t length)
+            : _session(std::move(session)), _remain(length - offset) {}
+        ~UploadPatch()
+        {
+            int64_t offset;
+            bool completed;
+            if (!_is_ended)
+                End(&offset, &completed);
+        }
+        bool Open()
+        {
+            if (!_writer.Open(UploadSessionManager::GetInstance()->StagingFilePath(_session->_id), true))
+                return false;
+            _writer.SetCachePolicy(_session->_length);
+            return true;
+        }
+        // 写入数据，超出文件总大小时返回false
+        bool Write(const char *data, size_t len)
+        {
+            if ((int64_t)len > _remain)
+            {
+                LOG_WARN("upload session:%s PATCH body exceeds upload length", _session->_id.c_str());
+                return false;
+            }
+            _remain -= len;
+            return _writer.Write(data, len);
+        }
+        // 将缓冲的数据写入暂存文件并结束本次写入，返回值与UploadSessionManager::EndPatch相同
+        bool End(int64_t *offset, bool *completed)
+        {
+            _is_ended = true;
+            _writer.Close();
+            return UploadSessionManager::GetInstance()->EndPatch(_session, offset, completed);
+        }
+        int LastError() { return _writer.LastError(); }
+
+    private:
+        UploadSession::ptr _session;
+        FileWriter _writer;
+        int64_t _remain; // 本次最多还能写入的字节数
+        bool _is_ended = false;
+    };
+}
+
+#endif
@@ -8,12 +8,14 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <sys/epoll.h>
 #include <fcntl.h>
 #include <memory>
 #include <string>
 #include <cstring>
 #include <jsoncpp/json/json.h>
+#include <openssl/evp.h>
 #include <filesystem>
 #include <thread>
 #include "log.hpp"
@@ -112,6 +114,11 @@ namespace cloud_backup
         }
         // 追加的向文件中写入内容，如果文件不存在会默认创建新文件，失败返回false
         bool AppendContent(const std::string &buffer)
+        {
+            return AppendContent(buffer.c_str(), buffer.size());
+        }
+        // 追加的向文件中写入[data, data+len)的内容，避免调用方为写入而构造临时字符串，失败返回false
+        bool AppendContent(const char *data, size_t len)
         {
             std::ofstream ofs;
             ofs.open(_filepath, std::ios::binary | std::ios::app);
@@ -120,7 +127,7 @@ namespace cloud_backup
                 LOG_ERROR("SetContent error, file open failed");
                 return false;
             }
-            ofs.write(buffer.c_str(), buffer.size());
+            ofs.write(data, len);
             if (!ofs.good())
             {
                 LOG_ERROR("SetContent error, write file failed");
@@ -130,6 +137,18 @@ namespace cloud_backup
             ofs.close();
             return true;
         }
+        // 获取当前路径所在文件系统中非特权用户可用的剩余空间，单位为字节，失败返回-1
+        int64_t GetAvailableSpace()
+        {
+            struct statvfs st;
+            if (statvfs(_filepath.c_str(), &st) == -1)
+            {
+                int err = errno;
+                LOG_ERROR("statvfs error:%d  message:%s", err, strerror(err));
+                return -1;
+            }
+            return static_cast<int64_t>(st.f_bavail) * st.f_frsize;
+        }
         // 检测当前文件是否已经存在，若存在则返回true
         bool Exists()
         {
@@ -396,6 +415,128 @@ namespace cloud_backup
             }
             return true;
         }
+        // 将字符串转义为JSON字符串字面量(含双引号)追加到out中，非ASCII字符按UTF-8原样输出，与Serialize的emitUTF8保持一致
+        static void AppendQuotedString(const std::string &str, std::string *out)
+        {
+            out->push_back('"');
+            for (unsigned char ch : str)
+            {
+                switch (ch)
+                {
+                case '"': out->append("\\\""); break;
+                case '\\': out->append("\\\\"); break;
+                case '\b': out->append("\\b"); break;
+                case '\f': out->append("\\f"); break;
+                case '\n': out->append("\\n"); break;
+                case '\r': out->append("\\r"); break;
+                case '\t': out->append("\\t"); break;
+                default:
+                    if (ch < 0x20)
+                    {
+                        char escaped[8];
+                        snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+                        out->append(escaped);
+                    }
+                    else
+                        out->push_back(ch);
+                }
+            }
+            out->push_back('"');
+        }
+    };
+
+    class Base64Util
+    {
+    public:
+        // 按标准Base64字母表(带'='填充)编码
+        static std::string Encode(const std::string &data)
+        {
+            static const char *table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            std::string ret;
+            ret.reserve((data.size() + 2) / 3 * 4);
+            size_t i = 0;
+            for (; i + 2 < data.size(); i += 3)
+            {
+                uint32_t n = (uint8_t)data[i] << 16 | (uint8_t)data[i + 1] << 8 | (uint8_t)data[i + 2];
+                ret.push_back(table[n >> 18 & 0x3f]);
+                ret.push_back(table[n >> 12 & 0x3f]);
+                ret.push_back(table[n >> 6 & 0x3f]);
+                ret.push_back(table[n & 0x3f]);
+            }
+            if (i < data.size())
+            {
+                uint32_t n = (uint8_t)data[i] << 16;
+                if (i + 1 < data.size())
+                    n |= (uint8_t)data[i + 1] << 8;
+                ret.push_back(table[n >> 18 & 0x3f]);
+                ret.push_back(table[n >> 12 & 0x3f]);
+                ret.push_back(i + 1 < data.size() ? table[n >> 6 & 0x3f] : '=');
+                ret.push_back('=');
+            }
+            return ret;
+        }
+        // 解码标准Base64字符串，填充'='可以省略，包含非法字符时返回false
+        static bool Decode(const std::string &str, std::string *data)
+        {
+            data->clear();
+            uint32_t n = 0;
+            int bits = 0;
+            for (char ch : str)
+            {
+                int value;
+                if (ch >= 'A' && ch <= 'Z')
+                    value = ch - 'A';
+                else if (ch >= 'a' && ch <= 'z')
+                    value = ch - 'a' + 26;
+                else if (ch >= '0' && ch <= '9')
+                    value = ch - '0' + 52;
+                else if (ch == '+')
+                    value = 62;
+                else if (ch == '/')
+                    value = 63;
+                else if (ch == '=')
+                    break;
+                else
+                    return false;
+                n = n << 6 | value;
+                bits += 6;
+                if (bits >= 8)
+                {
+                    bits -= 8;
+                    data->push_back(static_cast<char>(n >> bits & 0xff));
+                }
+            }
+            return true;
+        }
+    };
+
+    class HashUtil
+    {
+    public:
+        // 计算[data, data+len)的SHA-256摘要，返回64个字符的小写十六进制字符串
+        static std::string Sha256Hex(const char *data, size_t len)
+        {
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            unsigned int digest_len = 0;
+            if (EVP_Digest(data, len, digest, &digest_len, EVP_sha256(), nullptr) != 1)
+            {
+                LOG_ERROR("Sha256Hex error, EVP_Digest failed");
+                return "";
+            }
+            return HexEncode(digest, digest_len);
+        }
+        static std::string HexEncode(const unsigned char *data, size_t len)
+        {
+            static const char *digits = "0123456789abcdef";
+            std::string ret;
+            ret.reserve(len * 2);
+            for (size_t i = 0; i < len; i++)
+            {
+                ret.push_back(digits[data[i] >> 4]);
+                ret.push_back(digits[data[i] & 0xf]);
+            }
+            return ret;
+        }
     };
 
     class NetSocketUtil